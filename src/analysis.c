@@ -0,0 +1,511 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analysis.h"
+#include "chip8_internal.h"
+
+/*
+ STATIC ANALYSIS
+
+ Code is found by walking from PC along every static successor: jump and call targets, the instruction after a
+ call (assuming the callee returns), both outcomes of a skip and the entries of BNNN jump tables. A table is the
+ usual idiom of 1NNN jumps right at the BNNN base, indexed by v[0] in steps of 2. Along a straight-line path idx is
+ followed from ANNN / F000 NNNN, so the sprites, loads and stores through it land on known addresses (FX1E, FX29
+ and FX30 make it unknown again, and so does every block start).
+*/
+
+#define MAX_TABLE_ENTRIES 128 // v[0] reaches 255 bytes past the base
+
+struct analysis_ {
+    const PROFILE* profile;
+    uint32_t memory_mask;
+    uint8_t* memory; // copy of the analyzed memory
+    uint8_t* flags; // ADDR_* by address
+    bool long_skips; // the profile's skips step over F000 NNNN as a whole
+
+    // addresses still to walk (each one is queued once)
+    uint16_t* work;
+    uint32_t work_count;
+
+    CODE_BLOCK* blocks;
+    int block_count, block_capacity;
+    uint16_t* successors;
+    int successor_count, successor_capacity;
+    CALL_EDGE* calls;
+    int call_count, call_capacity;
+    STORE_SITE* stores;
+    int store_count, store_capacity;
+};
+
+// makes room for one more item in a growing array
+static bool reserve(void** items, int* capacity, int count, size_t item_size) {
+    if (count < *capacity) return true;
+
+    int new_capacity = *capacity > 0 ? *capacity * 2 : 64;
+    void* grown = realloc(*items, new_capacity * item_size);
+    if (grown == NULL) return false;
+    *items = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+// the kind whose meaning the profile gives to the instruction at addr
+// (an extension the profile lacks runs the handler of a classic kind, or opNOP)
+static INSTRUCTION decodeAt(const ANALYSIS* a, uint16_t addr, DECODED* op) {
+    uint16_t inst = (a->memory[addr & a->memory_mask] << 8)|(a->memory[(addr+1) & a->memory_mask]);
+    INSTRUCTION kind = decodeInstruction(a->profile, inst, op);
+    if (kind <= OP_FX65) return kind;
+
+    for(int k = OP_NOP; k <= OP_FX65; k++) {
+        if (a->profile->handlers[k] == a->profile->handlers[kind]) return k;
+    }
+    return kind;
+}
+
+static int instructionLength(INSTRUCTION kind) {
+    return kind == OP_F000 ? 4 : 2;
+}
+
+static bool isSkip(INSTRUCTION kind) {
+    return kind == OP_3XNN || kind == OP_4XNN || kind == OP_5XY0 || kind == OP_9XY0 || kind == OP_EX9E || kind == OP_EXA1;
+}
+
+// the address a skip at addr jumps to when it skips
+static uint16_t skipTarget(const ANALYSIS* a, uint16_t next) {
+    bool long_instruction = a->long_skips && a->memory[next] == 0xF0 && a->memory[(next+1) & a->memory_mask] == 0x00;
+    return (next + (long_instruction ? 4 : 2)) & a->memory_mask;
+}
+
+// entries of the jump table of a BNNN with base nnn (the first one is the target for v[0] = 0, always kept)
+static int tableEntries(const ANALYSIS* a, uint16_t base, uint16_t* entries) {
+    int count = 0;
+    for(int i = 0; i < MAX_TABLE_ENTRIES; i++) {
+        uint16_t entry = (base + 2*i) & a->memory_mask;
+        DECODED op;
+        if (i > 0 && decodeAt(a, entry, &op) != OP_1NNN) break;
+        entries[count++] = entry;
+    }
+    return count;
+}
+
+/*
+    REACHABLE CODE
+*/
+
+// a successor: a block starts there, and it is walked unless it already was (or is queued)
+static void addTarget(ANALYSIS* a, uint16_t addr, uint8_t flags) {
+    addr &= a->memory_mask;
+    bool known = a->flags[addr] & (ADDR_CODE | ADDR_BLOCK);
+    a->flags[addr] |= ADDR_BLOCK | flags;
+    if (!known) a->work[a->work_count++] = addr;
+}
+
+// a data access through idx (-1: unknown), stores are listed either way
+static bool addAccess(ANALYSIS* a, uint16_t site, int32_t idx, uint16_t len, bool store) {
+    if (idx >= 0) {
+        for(int i = 0; i < len; i++) a->flags[(idx + i) & a->memory_mask] |= store ? ADDR_WRITTEN : ADDR_READ;
+    }
+    if (!store) return true;
+
+    if (!reserve((void**) &a->stores, &a->store_capacity, a->store_count, sizeof(STORE_SITE))) return false;
+    STORE_SITE* s = &a->stores[a->store_count++];
+    s->site = site;
+    s->addr = idx;
+    s->len = len;
+    s->into_code = false;
+    return true;
+}
+
+// records the memory the instruction at pc accesses, returns idx after it (-1: unknown)
+static int32_t trackIdx(ANALYSIS* a, uint16_t pc, INSTRUCTION kind, const DECODED* op, int32_t idx, bool* ok) {
+    int32_t after = a->profile->quirks.increment_idx && idx >= 0 ? (int32_t) ((idx + op->x + 1) & a->memory_mask) : idx;
+
+    switch (kind) {
+        case OP_ANNN: return op->nnn;
+        case OP_F000: return (a->memory[(pc+2) & a->memory_mask] << 8)|(a->memory[(pc+3) & a->memory_mask]);
+        case OP_FX1E:
+        case OP_FX29:
+        case OP_FX30:
+            return -1;
+
+        case OP_DXYN: *ok = addAccess(a, pc, idx, op->n, false); return idx;
+        case OP_DXY0: *ok = addAccess(a, pc, idx, 32, false); return idx;
+        case OP_5XY3: *ok = addAccess(a, pc, idx, abs(op->y - op->x) + 1, false); return idx;
+        case OP_F002: *ok = addAccess(a, pc, idx, AUDIO_PATTERN_SIZE, false); return idx;
+        case OP_FX65: *ok = addAccess(a, pc, idx, op->x + 1, false); return after;
+
+        case OP_FX33: *ok = addAccess(a, pc, idx, 3, true); return idx;
+        case OP_5XY2: *ok = addAccess(a, pc, idx, abs(op->y - op->x) + 1, true); return idx;
+        case OP_FX55: *ok = addAccess(a, pc, idx, op->x + 1, true); return after;
+
+        default: return idx;
+    }
+}
+
+// walks straight-line code from pc until a jump, call, return, skip or code walked before
+static bool walkCode(ANALYSIS* a, uint16_t pc) {
+    int32_t idx = -1;
+    bool ok = true;
+
+    while (!(a->flags[pc] & ADDR_CODE)) {
+        DECODED op;
+        INSTRUCTION kind = decodeAt(a, pc, &op);
+        int length = instructionLength(kind);
+        uint16_t next = (pc + length) & a->memory_mask;
+
+        a->flags[pc] |= ADDR_CODE;
+        for(int i = 1; i < length; i++) a->flags[(pc+i) & a->memory_mask] |= ADDR_OPERAND;
+
+        idx = trackIdx(a, pc, kind, &op, idx, &ok);
+        if (!ok) return false;
+
+        if (isSkip(kind)) {
+            addTarget(a, next, 0);
+            addTarget(a, skipTarget(a, next), 0);
+            return true;
+        }
+
+        switch (kind) {
+            case OP_1NNN:
+                addTarget(a, op.nnn, 0);
+                return true;
+            case OP_2NNN:
+                addTarget(a, op.nnn, ADDR_FUNCTION);
+                addTarget(a, next, 0);
+                return true;
+            case OP_BNNN: {
+                uint16_t entries[MAX_TABLE_ENTRIES];
+                int count = tableEntries(a, op.nnn, entries);
+                for(int i = 0; i < count; i++) addTarget(a, entries[i], ADDR_JUMP_TABLE);
+                return true;
+            }
+            case OP_00EE:
+            case OP_HALT:
+            case OP_00FD:
+                return true;
+            default:
+                break;
+        }
+        pc = next;
+    }
+
+    // ran into code walked before: a block starts there
+    a->flags[pc] |= ADDR_BLOCK;
+    return true;
+}
+
+/*
+    BLOCKS AND CALLS
+*/
+
+static bool addSuccessor(ANALYSIS* a, CODE_BLOCK* block, uint16_t addr) {
+    if (!reserve((void**) &a->successors, &a->successor_capacity, a->successor_count, sizeof(uint16_t))) return false;
+    a->successors[a->successor_count++] = addr & a->memory_mask;
+    block->successor_count++;
+    return true;
+}
+
+// the block starting at start: up to the next block or the instruction that leaves it
+static bool addBlock(ANALYSIS* a, uint16_t start) {
+    if (!reserve((void**) &a->blocks, &a->block_capacity, a->block_count, sizeof(CODE_BLOCK))) return false;
+    CODE_BLOCK* block = &a->blocks[a->block_count++];
+    memset(block, 0, sizeof(CODE_BLOCK));
+    block->start = start;
+    block->exit = EXIT_FALLTHROUGH;
+
+    uint16_t pc = start;
+    for(uint32_t n = 0; n <= a->memory_mask; n++) {
+        DECODED op;
+        INSTRUCTION kind = decodeAt(a, pc, &op);
+        uint16_t next = (pc + instructionLength(kind)) & a->memory_mask;
+        block->end = next;
+
+        bool ok = true;
+        if (isSkip(kind)) {
+            block->exit = EXIT_SKIP;
+            ok = addSuccessor(a, block, next) && addSuccessor(a, block, skipTarget(a, next));
+        } else if (kind == OP_1NNN) {
+            block->exit = EXIT_JUMP;
+            ok = addSuccessor(a, block, op.nnn);
+        } else if (kind == OP_2NNN) {
+            block->exit = EXIT_CALL;
+            ok = addSuccessor(a, block, op.nnn) && addSuccessor(a, block, next);
+        } else if (kind == OP_BNNN) {
+            uint16_t entries[MAX_TABLE_ENTRIES];
+            int count = tableEntries(a, op.nnn, entries);
+            block->exit = EXIT_TABLE;
+            for(int i = 0; i < count && ok; i++) ok = addSuccessor(a, block, entries[i]);
+        } else if (kind == OP_00EE) {
+            block->exit = EXIT_RETURN;
+        } else if (kind == OP_HALT || kind == OP_00FD) {
+            block->exit = EXIT_HALT;
+        } else if (a->flags[next] & ADDR_BLOCK) {
+            ok = addSuccessor(a, block, next);
+        } else {
+            pc = next;
+            continue;
+        }
+        return ok;
+    }
+    return true;
+}
+
+static int compareCalls(const void* a, const void* b) {
+    const CALL_EDGE* x = (const CALL_EDGE*) a;
+    const CALL_EDGE* y = (const CALL_EDGE*) b;
+    if (x->caller != y->caller) return x->caller < y->caller ? -1 : 1;
+    return x->site < y->site ? -1 : x->site > y->site;
+}
+
+// the calls of each function: the blocks reachable from it without entering a callee (the return site goes on)
+static bool findCalls(ANALYSIS* a) {
+    int32_t* block_at = (int32_t*) malloc((a->memory_mask + 1) * sizeof(int32_t));
+    int* seen = (int*) calloc(a->block_count + 1, sizeof(int));
+    int* queue = (int*) malloc((a->block_count + 1) * sizeof(int));
+    bool ok = block_at != NULL && seen != NULL && queue != NULL;
+
+    if (ok) {
+        for(uint32_t i = 0; i <= a->memory_mask; i++) block_at[i] = -1;
+        for(int b = 0; b < a->block_count; b++) block_at[a->blocks[b].start] = b;
+    }
+
+    int function = 0;
+    for(int f = 0; ok && f < a->block_count; f++) {
+        if (!(a->flags[a->blocks[f].start] & ADDR_FUNCTION)) continue;
+        function++;
+
+        int head = 0, tail = 0;
+        queue[tail++] = f;
+        seen[f] = function;
+        while (ok && head < tail) {
+            const CODE_BLOCK* block = &a->blocks[queue[head++]];
+            int first = block->exit == EXIT_CALL ? 1 : 0;
+
+            if (block->exit == EXIT_CALL) {
+                ok = reserve((void**) &a->calls, &a->call_capacity, a->call_count, sizeof(CALL_EDGE));
+                if (!ok) break;
+                CALL_EDGE* call = &a->calls[a->call_count++];
+                call->caller = a->blocks[f].start;
+                call->site = (block->end - 2) & a->memory_mask;
+                call->callee = block->successors[0];
+            }
+
+            for(int s = first; s < block->successor_count; s++) {
+                int next = block_at[block->successors[s]];
+                if (next < 0 || seen[next] == function) continue;
+                seen[next] = function;
+                queue[tail++] = next;
+            }
+        }
+    }
+
+    free(block_at);
+    free(seen);
+    free(queue);
+    if (ok) qsort(a->calls, a->call_count, sizeof(CALL_EDGE), compareCalls);
+    return ok;
+}
+
+static bool analyze(ANALYSIS* a, uint16_t entry) {
+    addTarget(a, entry, ADDR_FUNCTION);
+    while (a->work_count > 0) {
+        if (!walkCode(a, a->work[--a->work_count])) return false;
+    }
+
+    // stores that may hit reached code
+    for(int i = 0; i < a->store_count; i++) {
+        STORE_SITE* s = &a->stores[i];
+        for(int j = 0; s->addr >= 0 && j < s->len; j++) {
+            uint8_t* flags = &a->flags[(s->addr + j) & a->memory_mask];
+            if (*flags & (ADDR_CODE | ADDR_OPERAND)) {
+                *flags |= ADDR_SELF_MODIFIED;
+                s->into_code = true;
+            }
+        }
+    }
+
+    for(uint32_t addr = 0; addr <= a->memory_mask; addr++) {
+        if ((a->flags[addr] & (ADDR_BLOCK | ADDR_CODE)) == (ADDR_BLOCK | ADDR_CODE) && !addBlock(a, addr)) return false;
+    }
+
+    // the successor lists are complete: point the blocks into them
+    int offset = 0;
+    for(int b = 0; b < a->block_count; b++) {
+        a->blocks[b].successors = a->successors + offset;
+        offset += a->blocks[b].successor_count;
+    }
+
+    return findCalls(a);
+}
+
+ANALYSIS* analyzeProgram(CHIP8* chip8) {
+    ANALYSIS* a = (ANALYSIS*) calloc(1, sizeof(ANALYSIS));
+    if (a == NULL) return NULL;
+
+    uint32_t size = chip8->memory_mask + 1;
+    a->profile = chip8->profile;
+    a->memory_mask = chip8->memory_mask;
+    a->long_skips = a->profile->handlers[OP_F000] != a->profile->handlers[OP_NOP];
+    a->memory = (uint8_t*) malloc(size);
+    a->flags = (uint8_t*) calloc(size, 1);
+    a->work = (uint16_t*) malloc(size * sizeof(uint16_t));
+
+    if (a->memory == NULL || a->flags == NULL || a->work == NULL) {
+        freeAnalysis(a);
+        return NULL;
+    }
+    memcpy(a->memory, chip8->memory, size);
+
+    if (!analyze(a, chip8->pc & chip8->memory_mask)) {
+        freeAnalysis(a);
+        return NULL;
+    }
+
+    free(a->work);
+    a->work = NULL;
+    return a;
+}
+
+void freeAnalysis(ANALYSIS* analysis) {
+    free(analysis->memory);
+    free(analysis->flags);
+    free(analysis->work);
+    free(analysis->blocks);
+    free(analysis->successors);
+    free(analysis->calls);
+    free(analysis->stores);
+    free(analysis);
+}
+
+uint8_t getAddressFlags(const ANALYSIS* analysis, uint16_t addr) {
+    return analysis->flags[addr & analysis->memory_mask];
+}
+
+int getBlockCount(const ANALYSIS* analysis) {
+    return analysis->block_count;
+}
+
+const CODE_BLOCK* getBlocks(const ANALYSIS* analysis) {
+    return analysis->blocks;
+}
+
+int getCallCount(const ANALYSIS* analysis) {
+    return analysis->call_count;
+}
+
+const CALL_EDGE* getCalls(const ANALYSIS* analysis) {
+    return analysis->calls;
+}
+
+int getStoreCount(const ANALYSIS* analysis) {
+    return analysis->store_count;
+}
+
+const STORE_SITE* getStores(const ANALYSIS* analysis) {
+    return analysis->stores;
+}
+
+/*
+    DISASSEMBLY
+*/
+
+int disassembleInstruction(const ANALYSIS* analysis, uint16_t addr, char* out, size_t size) {
+    const ANALYSIS* a = analysis;
+    DECODED op;
+    INSTRUCTION kind = decodeAt(a, addr, &op);
+    uint16_t inst = (a->memory[addr & a->memory_mask] << 8)|(a->memory[(addr+1) & a->memory_mask]);
+    const QUIRKS* quirks = &a->profile->quirks;
+    int x = op.x, y = op.y;
+
+    switch (kind) {
+        case OP_HALT: snprintf(out, size, "HALT"); break;
+        case OP_00E0: snprintf(out, size, "CLS"); break;
+        case OP_00EE: snprintf(out, size, "RET"); break;
+        case OP_1NNN: snprintf(out, size, "JP 0x%03X", op.nnn); break;
+        case OP_2NNN: snprintf(out, size, "CALL 0x%03X", op.nnn); break;
+        case OP_3XNN: snprintf(out, size, "SE V%X, 0x%02X", x, op.nn); break;
+        case OP_4XNN: snprintf(out, size, "SNE V%X, 0x%02X", x, op.nn); break;
+        case OP_5XY0: snprintf(out, size, "SE V%X, V%X", x, y); break;
+        case OP_6XNN: snprintf(out, size, "LD V%X, 0x%02X", x, op.nn); break;
+        case OP_7XNN: snprintf(out, size, "ADD V%X, 0x%02X", x, op.nn); break;
+        case OP_8XY0: snprintf(out, size, "LD V%X, V%X", x, y); break;
+        case OP_8XY1: snprintf(out, size, "OR V%X, V%X", x, y); break;
+        case OP_8XY2: snprintf(out, size, "AND V%X, V%X", x, y); break;
+        case OP_8XY3: snprintf(out, size, "XOR V%X, V%X", x, y); break;
+        case OP_8XY4: snprintf(out, size, "ADD V%X, V%X", x, y); break;
+        case OP_8XY5: snprintf(out, size, "SUB V%X, V%X", x, y); break;
+        case OP_8XY7: snprintf(out, size, "SUBN V%X, V%X", x, y); break;
+        case OP_8XY6:
+        case OP_8XYE:
+            if (quirks->shift_vy) snprintf(out, size, "%s V%X, V%X", kind == OP_8XY6 ? "SHR" : "SHL", x, y);
+            else snprintf(out, size, "%s V%X", kind == OP_8XY6 ? "SHR" : "SHL", x);
+            break;
+        case OP_9XY0: snprintf(out, size, "SNE V%X, V%X", x, y); break;
+        case OP_ANNN: snprintf(out, size, "LD I, 0x%03X", op.nnn); break;
+        case OP_BNNN: snprintf(out, size, "JP V%X, 0x%03X", quirks->jump_vx ? x : 0, op.nnn); break;
+        case OP_CXNN: snprintf(out, size, "RND V%X, 0x%02X", x, op.nn); break;
+        case OP_DXYN:
+        case OP_DXY0: snprintf(out, size, "DRW V%X, V%X, %d", x, y, op.n); break;
+        case OP_EX9E: snprintf(out, size, "SKP V%X", x); break;
+        case OP_EXA1: snprintf(out, size, "SKNP V%X", x); break;
+        case OP_FX07: snprintf(out, size, "LD V%X, DT", x); break;
+        case OP_FX0A: snprintf(out, size, "LD V%X, K", x); break;
+        case OP_FX15: snprintf(out, size, "LD DT, V%X", x); break;
+        case OP_FX18: snprintf(out, size, "LD ST, V%X", x); break;
+        case OP_FX1E: snprintf(out, size, "ADD I, V%X", x); break;
+        case OP_FX29: snprintf(out, size, "LD F, V%X", x); break;
+        case OP_FX33: snprintf(out, size, "LD B, V%X", x); break;
+        case OP_FX55: snprintf(out, size, "LD [I], V%X", x); break;
+        case OP_FX65: snprintf(out, size, "LD V%X, [I]", x); break;
+        case OP_00CN: snprintf(out, size, "SCD %d", op.n); break;
+        case OP_00DN: snprintf(out, size, "SCU %d", op.n); break;
+        case OP_00FB: snprintf(out, size, "SCR"); break;
+        case OP_00FC: snprintf(out, size, "SCL"); break;
+        case OP_00FD: snprintf(out, size, "EXIT"); break;
+        case OP_00FE: snprintf(out, size, "LOW"); break;
+        case OP_00FF: snprintf(out, size, "HIGH"); break;
+        case OP_FX30: snprintf(out, size, "LD HF, V%X", x); break;
+        case OP_FX75: snprintf(out, size, "LD R, V%X", x); break;
+        case OP_FX85: snprintf(out, size, "LD V%X, R", x); break;
+        case OP_5XY2: snprintf(out, size, "SAVE V%X - V%X", x, y); break;
+        case OP_5XY3: snprintf(out, size, "LOAD V%X - V%X", x, y); break;
+        case OP_FN01: snprintf(out, size, "PLANE %d", x); break;
+        case OP_F002: snprintf(out, size, "AUDIO"); break;
+        case OP_FX3A: snprintf(out, size, "PITCH V%X", x); break;
+        case OP_F000:
+            snprintf(out, size, "LD I, 0x%04X", (a->memory[(addr+2) & a->memory_mask] << 8)|(a->memory[(addr+3) & a->memory_mask]));
+            break;
+
+        // ignored here: machine code calls (0NNN) and unknown opcodes
+        default:
+            if ((inst & 0xF000) == 0) snprintf(out, size, "SYS 0x%03X", inst & 0xFFF);
+            else snprintf(out, size, "DW 0x%04X", inst);
+            break;
+    }
+
+    return instructionLength(kind);
+}
+
+/*
+    PREWARMING
+*/
+
+void prewarmInterpreter(CHIP8* chip8, const ANALYSIS* analysis) {
+    if (analysis->memory_mask != chip8->memory_mask) return;
+
+    for(uint32_t addr = 0; addr <= chip8->memory_mask; addr++) {
+        if (!(analysis->flags[addr] & ADDR_CODE)) continue;
+
+        DECODED* op = &chip8->decode_cache[addr];
+        if (op->generation == chip8->cache_generation) continue;
+
+        uint16_t inst = (chip8->memory[addr] << 8)|(chip8->memory[(addr+1) & chip8->memory_mask]);
+        decodeInstruction(chip8->profile, inst, op);
+        op->generation = chip8->cache_generation;
+    }
+
+    if (chip8->jit == NULL) return;
+    for(int b = 0; b < analysis->block_count; b++) prewarmJit(chip8->jit, chip8, analysis->blocks[b].start);
+}
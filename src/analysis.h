@@ -0,0 +1,73 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// static analysis of a loaded program with the interpreter's own decoder and quirk profile: the code reachable
+// from PC, its basic blocks, calls, jump tables, the bytes read as data and the stores into code
+typedef struct analysis_ ANALYSIS;
+
+// flags of each address
+#define ADDR_CODE           0x01 // a reachable instruction starts here
+#define ADDR_OPERAND        0x02 // inside a reachable instruction (second byte, F000's address)
+#define ADDR_BLOCK          0x04 // a basic block starts here
+#define ADDR_FUNCTION       0x08 // 2NNN target (or the entry point)
+#define ADDR_JUMP_TABLE     0x10 // entry of a BNNN jump table
+#define ADDR_READ           0x20 // read as data through a known idx (sprites, FX65, 5XY3, F002)
+#define ADDR_WRITTEN        0x40 // stored to through a known idx (FX33, FX55, 5XY2)
+#define ADDR_SELF_MODIFIED  0x80 // code that is also written
+
+// how a block ends
+#define EXIT_FALLTHROUGH 0 // into the next block
+#define EXIT_JUMP 1
+#define EXIT_CALL 2 // successors: the callee, then the return site
+#define EXIT_RETURN 3
+#define EXIT_SKIP 4 // successors: the next instruction, then the one after it
+#define EXIT_TABLE 5 // successors: the BNNN jump table entries found
+#define EXIT_HALT 6 // 0000 / 00FD
+
+typedef struct code_block_ {
+    uint16_t start, end; // [start, end) bytes
+    uint8_t exit;
+    int successor_count;
+    const uint16_t* successors;
+} CODE_BLOCK;
+
+// one call site of a function (a block shared by two functions gives a call to each)
+typedef struct call_edge_ {
+    uint16_t caller, site, callee;
+} CALL_EDGE;
+
+// FX33 / FX55 / 5XY2 (addr is -1 when idx isn't known there)
+typedef struct store_site_ {
+    uint16_t site;
+    int32_t addr;
+    uint16_t len;
+    bool into_code;
+} STORE_SITE;
+
+// analyzes the machine's memory from its PC, returns NULL if out of memory
+ANALYSIS* analyzeProgram(CHIP8* chip8);
+void freeAnalysis(ANALYSIS* analysis);
+
+uint8_t getAddressFlags(const ANALYSIS* analysis, uint16_t addr);
+int getBlockCount(const ANALYSIS* analysis);
+const CODE_BLOCK* getBlocks(const ANALYSIS* analysis); // by address
+int getCallCount(const ANALYSIS* analysis);
+const CALL_EDGE* getCalls(const ANALYSIS* analysis); // by caller, then site
+int getStoreCount(const ANALYSIS* analysis);
+const STORE_SITE* getStores(const ANALYSIS* analysis); // by site
+
+// writes the instruction at addr as text (CLS, LD V1, 0x05, ...) with the quirk profile's meaning of it
+// returns its length in bytes (F000 NNNN is 4)
+int disassembleInstruction(const ANALYSIS* analysis, uint16_t addr, char* out, size_t size);
+
+// decodes the reachable instructions into the decode cache and compiles the blocks with the recompiler (if enabled),
+// so the first frames don't pay for it
+void prewarmInterpreter(CHIP8* chip8, const ANALYSIS* analysis);
+
+#endif
@@ -0,0 +1,126 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio.h"
+#include "chip8_internal.h"
+
+#define PATTERN_BITS (8*AUDIO_PATTERN_SIZE)
+#define PATTERN_RATE 4000.0 // pattern bits per second at DEFAULT_PITCH
+#define AMPLITUDE 6000
+
+#define CACHE_LINE 64
+
+/*
+    SYNTHESIS
+*/
+
+void renderAudio(CHIP8* chip8, int16_t* samples, uint32_t n, uint32_t sample_rate, double* phase) {
+    if (chip8->sound_timer == 0) {
+        memset(samples, 0, n * sizeof(int16_t));
+        *phase = 0.0;
+        return;
+    }
+
+    // XO-CHIP: every 48 pitch steps double the playback rate
+    double step = PATTERN_RATE * pow(2.0, (chip8->pitch - DEFAULT_PITCH) / 48.0) / sample_rate;
+    double p = *phase;
+
+    for(uint32_t i = 0; i < n; i++) {
+        int bit = (int) p;
+        bool on = (chip8->audio_pattern[bit >> 3] >> (7 - (bit & 7))) & 1;
+        samples[i] = on ? AMPLITUDE : -AMPLITUDE;
+
+        p += step;
+        while (p >= PATTERN_BITS) p -= PATTERN_BITS;
+    }
+
+    *phase = p;
+}
+
+/*
+    RING BUFFER
+*/
+
+// head is only written by the producer, tail and underruns only by the consumer
+// (both counters run freely and are masked on access; each sits on its own cache line)
+struct audio_ring_ {
+    int16_t* samples;
+    uint32_t mask;
+
+    char pad0[CACHE_LINE];
+    uint32_t head;
+    char pad1[CACHE_LINE - sizeof(uint32_t)];
+    uint32_t tail;
+    uint64_t underruns;
+    char pad2[CACHE_LINE];
+};
+
+// the capacity is rounded up to a power of two
+AUDIO_RING* createAudioRing(uint32_t capacity) {
+    uint32_t size = 1;
+    while (size < capacity) size <<= 1;
+
+    AUDIO_RING* ring = (AUDIO_RING*) calloc(1, sizeof(AUDIO_RING));
+    if (ring == NULL) return NULL;
+
+    ring->samples = (int16_t*) calloc(size, sizeof(int16_t));
+    if (ring->samples == NULL) {
+        free(ring);
+        return NULL;
+    }
+    ring->mask = size - 1;
+
+    return ring;
+}
+
+// producer side: returns how many samples fit
+uint32_t writeAudio(AUDIO_RING* ring, const int16_t* samples, uint32_t n) {
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    uint32_t space = ring->mask + 1 - (head - tail);
+    if (n > space) n = space;
+
+    for(uint32_t i = 0; i < n; i++) ring->samples[(head + i) & ring->mask] = samples[i];
+
+    // the samples must be visible before the consumer sees the new head
+    __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+// consumer side: always fills n samples, padding with silence (one underrun) when the ring runs dry
+uint32_t readAudio(AUDIO_RING* ring, int16_t* samples, uint32_t n) {
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    uint32_t available = head - tail;
+    uint32_t count = n < available ? n : available;
+
+    for(uint32_t i = 0; i < count; i++) samples[i] = ring->samples[(tail + i) & ring->mask];
+    if (count < n) {
+        memset(&samples[count], 0, (n - count) * sizeof(int16_t));
+        __atomic_store_n(&ring->underruns, ring->underruns + 1, __ATOMIC_RELAXED);
+    }
+
+    // the slots may be reused only after they have been read
+    __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+// samples written and not read yet (the consumer may be taking some of them right now)
+uint32_t getAudioQueued(AUDIO_RING* ring) {
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    return head - tail;
+}
+
+uint64_t getAudioUnderruns(AUDIO_RING* ring) {
+    return __atomic_load_n(&ring->underruns, __ATOMIC_RELAXED);
+}
+
+void freeAudioRing(AUDIO_RING* ring) {
+    free(ring->samples);
+    free(ring);
+}
@@ -0,0 +1,23 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+typedef struct audio_ring_ AUDIO_RING;
+
+// renders n mono samples of what the machine is playing now (silence while the sound timer is 0)
+// phase keeps the position in the pattern between calls, so consecutive buffers join without clicks
+void renderAudio(CHIP8* chip8, int16_t* samples, uint32_t n, uint32_t sample_rate, double* phase);
+
+// single-producer / single-consumer lock-free ring of samples: the emulation thread writes, the audio callback reads
+// neither side ever waits (writes are cut short when full, reads are padded with silence and counted as underruns)
+AUDIO_RING* createAudioRing(uint32_t capacity);
+uint32_t writeAudio(AUDIO_RING* ring, const int16_t* samples, uint32_t n);
+uint32_t readAudio(AUDIO_RING* ring, int16_t* samples, uint32_t n);
+uint32_t getAudioQueued(AUDIO_RING* ring);
+uint64_t getAudioUnderruns(AUDIO_RING* ring);
+void freeAudioRing(AUDIO_RING* ring);
+
+#endif
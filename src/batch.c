@@ -0,0 +1,469 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "capture.h"
+#include "chip8.h"
+#include "jit.h"
+#include "movie.h"
+#include "romlib.h"
+#include "threadpool.h"
+
+/*
+ chip8-batch: runs many ROMs headlessly in parallel and writes one JSON line per ROM
+
+ config file (key = value, # starts a comment):
+   cycles = 1000000        cycle slots to run (slots stalled by FX0A count as elapsed time)
+   cycles_per_tick = 12    slots between two 60 Hz timer ticks
+   quirks = vip            quirk profile (vip, schip, xo-chip, modern)
+   jit = 0                 0: interpreter, 1: recompiler, 2: recompiler cross-checked
+   seed = 0                seed of every instance's random generator
+   input = keys.txt        scripted input: lines "<slot> <hex key mask>" in increasing order
+   movie = run.c8m         replays a movie recorded with --record instead (its quirks, seed, frames and keys;
+                           cycles, cycles_per_tick, quirks, seed and input are ignored)
+   capture = frames/       writes the screen at every timer tick to <directory>/<rom>.c8v (or .gif, or numbered .png)
+   capture_format = c8v    c8v (run-length coded 1 bpp stream), gif or png
+*/
+
+#define DEFAULT_CYCLES 1000000
+#define DEFAULT_CYCLES_PER_TICK 12
+#define CAPTURE_HZ 60 // frames are captured at the timer ticks
+
+typedef struct input_event_ {
+    uint64_t cycle;
+    uint16_t keys;
+} INPUT_EVENT;
+
+typedef struct config_ {
+    uint64_t cycles;
+    uint32_t cycles_per_tick;
+    int jit_mode;
+    uint64_t seed;
+    char quirks[32];
+
+    INPUT_EVENT* input;
+    int input_count;
+
+    char* movie_path;
+
+    char* capture_dir;
+    int capture_format;
+} CONFIG;
+
+typedef struct result_ {
+    bool loaded;
+    uint64_t hash, cycles;
+    double wall_ms;
+    REGISTERS regs;
+    bool ended, waiting_key;
+    bool captured; // the capture was written
+    uint64_t capture_frames; // changed frames in it
+} RESULT;
+
+typedef struct batch_ {
+    CONFIG* config;
+    char** roms;
+    const ROM_ENTRY** entries; // with -L: the library entry of each ROM (NULL: ROMs are files)
+    RESULT* results;
+} BATCH;
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000.0 + t.tv_nsec/1000000.0;
+}
+
+// removes comments and surrounding whitespace in place
+static char* trim(char* line) {
+    char* comment = strchr(line, '#');
+    if (comment != NULL) *comment = '\0';
+
+    while (*line == ' ' || *line == '\t') line++;
+    char* end = line + strlen(line);
+    while (end > line && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r')) end--;
+    *end = '\0';
+
+    return line;
+}
+
+void loadInputScript(CONFIG* config, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    int capacity = 64;
+    config->input = (INPUT_EVENT*) malloc(capacity * sizeof(INPUT_EVENT));
+
+    char buffer[256];
+    int line_number = 0;
+    while (fgets(buffer, sizeof(buffer), f) != NULL) {
+        line_number++;
+        char* line = trim(buffer);
+        if (*line == '\0') continue;
+
+        unsigned long long cycle;
+        unsigned int keys;
+        if (sscanf(line, "%llu %x", &cycle, &keys) != 2 || keys > 0xffff ||
+            (config->input_count > 0 && cycle < config->input[config->input_count-1].cycle)) {
+            fprintf(stderr, "ERROR: %s:%d: expected \"<slot> <hex key mask>\" in increasing order\n", path, line_number);
+            exit(1);
+        }
+
+        if (config->input_count == capacity) {
+            capacity *= 2;
+            config->input = (INPUT_EVENT*) realloc(config->input, capacity * sizeof(INPUT_EVENT));
+        }
+        config->input[config->input_count].cycle = cycle;
+        config->input[config->input_count].keys = keys;
+        config->input_count++;
+    }
+
+    fclose(f);
+}
+
+void loadConfig(CONFIG* config, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    char buffer[512];
+    int line_number = 0;
+    while (fgets(buffer, sizeof(buffer), f) != NULL) {
+        line_number++;
+        char* line = trim(buffer);
+        if (*line == '\0') continue;
+
+        char* equal = strchr(line, '=');
+        if (equal == NULL) {
+            fprintf(stderr, "ERROR: %s:%d: expected \"key = value\"\n", path, line_number);
+            exit(1);
+        }
+        *equal = '\0';
+        char* key = trim(line);
+        char* value = trim(equal + 1);
+
+        if (strcmp(key, "cycles") == 0) config->cycles = strtoull(value, NULL, 10);
+        else if (strcmp(key, "cycles_per_tick") == 0) config->cycles_per_tick = strtoul(value, NULL, 10);
+        else if (strcmp(key, "jit") == 0) config->jit_mode = atoi(value);
+        else if (strcmp(key, "seed") == 0) config->seed = strtoull(value, NULL, 10);
+        else if (strcmp(key, "quirks") == 0) {
+            int i = 0;
+            while (getQuirkProfileName(i) != NULL && strcmp(getQuirkProfileName(i), value) != 0) i++;
+            if (getQuirkProfileName(i) == NULL) {
+                fprintf(stderr, "ERROR: %s:%d: unknown quirk profile \"%s\"\n", path, line_number, value);
+                exit(1);
+            }
+            snprintf(config->quirks, sizeof(config->quirks), "%s", value);
+        }
+        else if (strcmp(key, "input") == 0) loadInputScript(config, value);
+        else if (strcmp(key, "movie") == 0) {
+            free(config->movie_path);
+            config->movie_path = strdup(value);
+        }
+        else if (strcmp(key, "capture") == 0) {
+            free(config->capture_dir);
+            config->capture_dir = strdup(value);
+        }
+        else if (strcmp(key, "capture_format") == 0) {
+            char name[16];
+            snprintf(name, sizeof(name), "x.%s", value);
+            config->capture_format = getCaptureFormat(name);
+            if (config->capture_format < 0) {
+                fprintf(stderr, "ERROR: %s:%d: unknown capture format \"%s\"\n", path, line_number, value);
+                exit(1);
+            }
+        }
+        else {
+            fprintf(stderr, "ERROR: %s:%d: unknown key \"%s\"\n", path, line_number, key);
+            exit(1);
+        }
+    }
+
+    if (config->cycles_per_tick == 0) {
+        fprintf(stderr, "ERROR: %s: cycles_per_tick must be positive\n", path);
+        exit(1);
+    }
+
+    fclose(f);
+}
+
+// runs the configured number of slots, with the scripted input (capture can be NULL)
+void runSlots(CHIP8* chip8, CONFIG* config, uint32_t cycles_per_tick, CAPTURE* capture) {
+    uint64_t slot = 0;
+    int next_input = 0;
+    while (slot < config->cycles) {
+        while (next_input < config->input_count && config->input[next_input].cycle <= slot) {
+            setKeys(chip8, config->input[next_input].keys);
+            next_input++;
+        }
+
+        // run until the next timer tick, input change or end of the budget
+        uint64_t stop = slot + cycles_per_tick - slot % cycles_per_tick;
+        if (stop > config->cycles) stop = config->cycles;
+        if (next_input < config->input_count && config->input[next_input].cycle < stop)
+            stop = config->input[next_input].cycle;
+
+        uint8_t events = runCycles(chip8, stop - slot, EVENT_NONE);
+        slot = stop;
+
+        if (slot % cycles_per_tick == 0) {
+            updateTimers(chip8);
+            if (capture != NULL) captureFrame(capture, getFramebuffer(chip8));
+        }
+        if (events & EVENT_HALT) break;
+    }
+}
+
+// plays every frame of the movie, ticking the timers after each (capture can be NULL)
+void runMovie(CHIP8* chip8, MOVIE* movie, CAPTURE* capture) {
+    while (moviePlaying(movie)) {
+        uint8_t events = runMovieFrame(movie, chip8);
+        updateTimers(chip8);
+        if (capture != NULL) captureFrame(capture, getFramebuffer(chip8));
+        if (events & EVENT_HALT) break;
+    }
+}
+
+// runs one ROM for the configured number of slots
+void runRom(int index, void* data) {
+    BATCH* batch = (BATCH*) data;
+    CONFIG* config = batch->config;
+    RESULT* result = &batch->results[index];
+
+    double start = now();
+
+    // a movie brings its own quirk profile and seed, and must have been recorded with this ROM
+    MOVIE* movie = NULL;
+    if (config->movie_path != NULL) {
+        movie = loadMovie(config->movie_path);
+        if (movie == NULL) {
+            result->loaded = false;
+            return;
+        }
+    }
+
+    // the profile goes first, so XO-CHIP ROMs have their 64 KB (a library entry may recommend another profile)
+    const ROM_ENTRY* entry = batch->entries != NULL ? batch->entries[index] : NULL;
+    CHIP8* chip8 = createInterpreter();
+    bool loaded = chip8 != NULL && setQuirkProfile(chip8, movie != NULL ? getMovieQuirks(movie) : config->quirks) &&
+        (entry != NULL ? loadLibraryRom(chip8, entry) : loadRom(chip8, batch->roms[index]));
+    if (loaded) seedRandom(chip8, config->seed);
+    if (loaded && movie != NULL) loaded = startPlayback(movie, chip8);
+    if (!loaded) {
+        if (chip8 != NULL) freeInterpreter(chip8);
+        if (movie != NULL) freeMovie(movie);
+        result->loaded = false;
+        return;
+    }
+
+    if (config->jit_mode != JIT_OFF) enableJit(chip8, config->jit_mode);
+
+    // batches have no real time to keep up with: the capture never drops a frame
+    CAPTURE* capture = NULL;
+    char capture_path[4096];
+    if (config->capture_dir != NULL) {
+        static const char* extensions[] = { "c8v", "png", "gif" };
+        const char* name = strrchr(batch->roms[index], '/');
+        snprintf(capture_path, sizeof(capture_path), "%s/%s.%s", config->capture_dir,
+                 name != NULL ? name + 1 : batch->roms[index], extensions[config->capture_format]);
+        capture = createCapture(capture_path, config->capture_format, CAPTURE_HZ, NULL, true);
+        if (capture == NULL) fprintf(stderr, "WARNING: %s: %s\n", capture_path, strerror(errno));
+    }
+
+    if (movie != NULL) {
+        runMovie(chip8, movie, capture);
+        freeMovie(movie);
+    } else {
+        // a library entry's recommended speed (timers stay at 60 Hz)
+        uint32_t cycles_per_tick = config->cycles_per_tick;
+        if (entry != NULL && entry->cpu_hz >= 60) cycles_per_tick = (entry->cpu_hz + 30) / 60;
+        runSlots(chip8, config, cycles_per_tick, capture);
+    }
+
+    if (capture != NULL) {
+        CAPTURE_STATS stats;
+        result->captured = closeCapture(capture, &stats);
+        result->capture_frames = stats.written;
+        if (!result->captured) fprintf(stderr, "WARNING: couldn't write %s\n", capture_path);
+    }
+
+    result->loaded = true;
+    result->hash = hashFramebuffer(getFramebuffer(chip8));
+    result->cycles = getCycleCount(chip8);
+    result->ended = hasEnded(chip8);
+    result->waiting_key = waitingForKey(chip8);
+    getRegisters(chip8, &result->regs);
+
+    freeInterpreter(chip8);
+
+    result->wall_ms = now() - start;
+}
+
+void printResult(FILE* out, const char* rom, RESULT* result) {
+    // escape the path for JSON
+    fprintf(out, "{\"rom\": \"");
+    for(const char* c = rom; *c; c++) {
+        if (*c == '"' || *c == '\\') fputc('\\', out);
+        fputc(*c, out);
+    }
+    fprintf(out, "\"");
+
+    if (!result->loaded) {
+        fprintf(out, ", \"error\": \"couldn't load (or the movie was recorded with another ROM)\"}\n");
+        return;
+    }
+
+    REGISTERS* r = &result->regs;
+    fprintf(out, ", \"hash\": \"%016llx\", \"cycles\": %llu, \"wall_ms\": %.3f",
+            (unsigned long long) result->hash, (unsigned long long) result->cycles, result->wall_ms);
+    fprintf(out, ", \"pc\": %u, \"idx\": %u, \"sp\": %u, \"dt\": %u, \"st\": %u, \"v\": [",
+            r->pc, r->idx, r->sp, r->delay_timer, r->sound_timer);
+    for(int i = 0; i < 16; i++) fprintf(out, i ? ", %u" : "%u", r->v[i]);
+    fprintf(out, "], \"ended\": %s, \"waiting_key\": %s",
+            result->ended ? "true" : "false", result->waiting_key ? "true" : "false");
+    if (result->captured) fprintf(out, ", \"capture_frames\": %llu", (unsigned long long) result->capture_frames);
+    fprintf(out, "}\n");
+}
+
+void printUsage(char* program) {
+    fprintf(stderr, "usage: %s [-c config] [-j threads] [-l rom-list] [-L library] [-o results] [rom ...]\n", program);
+}
+
+int main(int argc, char* argv[]) {
+    CONFIG config;
+    memset(&config, 0, sizeof(config));
+    config.cycles = DEFAULT_CYCLES;
+    config.cycles_per_tick = DEFAULT_CYCLES_PER_TICK;
+    config.jit_mode = JIT_OFF;
+    snprintf(config.quirks, sizeof(config.quirks), "%s", getQuirkProfileName(0));
+
+    int threads = getCpuCount();
+    const char* output_path = NULL;
+    const char* library_path = NULL;
+
+    int rom_capacity = argc + 16, rom_count = 0;
+    char** roms = (char**) malloc(rom_capacity * sizeof(char*));
+
+    for(int i = 1; i < argc; i++) {
+        bool has_value = i+1 < argc;
+
+        if (strcmp(argv[i], "-c") == 0 && has_value) loadConfig(&config, argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0 && has_value) threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && has_value) output_path = argv[++i];
+        else if (strcmp(argv[i], "-L") == 0 && has_value) library_path = argv[++i];
+        else if (strcmp(argv[i], "-l") == 0 && has_value) {
+            const char* list_path = argv[++i];
+            FILE* f = fopen(list_path, "r");
+            if (f == NULL) {
+                fprintf(stderr, "ERROR: %s: %s\n", list_path, strerror(errno));
+                return 1;
+            }
+
+            char buffer[4096];
+            while (fgets(buffer, sizeof(buffer), f) != NULL) {
+                char* line = trim(buffer);
+                if (*line == '\0') continue;
+                if (rom_count == rom_capacity) {
+                    rom_capacity *= 2;
+                    roms = (char**) realloc(roms, rom_capacity * sizeof(char*));
+                }
+                roms[rom_count++] = strdup(line);
+            }
+            fclose(f);
+        }
+        else if (argv[i][0] != '-') {
+            if (rom_count == rom_capacity) {
+                rom_capacity *= 2;
+                roms = (char**) realloc(roms, rom_capacity * sizeof(char*));
+            }
+            roms[rom_count++] = strdup(argv[i]);
+        }
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // with a library, the ROMs given are names (or content hashes) in it, and no ROMs means all of them
+    ROM_LIBRARY* library = NULL;
+    const ROM_ENTRY** entries = NULL;
+    if (library_path != NULL) {
+        library = openRomLibrary(library_path);
+        if (library == NULL) {
+            fprintf(stderr, "ERROR: %s: %s\n", library_path, strerror(errno));
+            return 1;
+        }
+
+        if (rom_count == 0) {
+            rom_count = getLibrarySize(library);
+            if (rom_count > rom_capacity) roms = (char**) realloc(roms, rom_count * sizeof(char*));
+            for(int i = 0; i < rom_count; i++) roms[i] = strdup(getLibraryRom(library, i)->name);
+        }
+
+        entries = (const ROM_ENTRY**) malloc((rom_count > 0 ? rom_count : 1) * sizeof(ROM_ENTRY*));
+        for(int i = 0; i < rom_count; i++) {
+            entries[i] = findRomByName(library, roms[i]);
+
+            char* end;
+            uint64_t hash = strtoull(roms[i], &end, 16);
+            if (entries[i] == NULL && strlen(roms[i]) == 16 && *end == '\0') entries[i] = findRomByHash(library, hash);
+            if (entries[i] == NULL) {
+                fprintf(stderr, "ERROR: %s isn't in %s\n", roms[i], library_path);
+                return 1;
+            }
+        }
+    }
+
+    if (rom_count == 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    BATCH batch;
+    batch.config = &config;
+    batch.roms = roms;
+    batch.entries = entries;
+    batch.results = (RESULT*) calloc(rom_count, sizeof(RESULT));
+
+    double start = now();
+    runParallel(threads, rom_count, runRom, &batch);
+    double total_ms = now() - start;
+
+    FILE* out = stdout;
+    if (output_path != NULL) {
+        out = fopen(output_path, "w");
+        if (out == NULL) {
+            fprintf(stderr, "ERROR: %s: %s\n", output_path, strerror(errno));
+            return 1;
+        }
+    }
+
+    int failed = 0;
+    for(int i = 0; i < rom_count; i++) {
+        printResult(out, roms[i], &batch.results[i]);
+        if (!batch.results[i].loaded) failed++;
+    }
+
+    if (out != stdout) fclose(out);
+    fprintf(stderr, "%d ROMs (%d failed) in %.1f ms on %d threads\n", rom_count, failed, total_ms, threads);
+
+    for(int i = 0; i < rom_count; i++) free(roms[i]);
+    free(roms);
+    free(batch.results);
+    free(config.input);
+    free(config.movie_path);
+    free(config.capture_dir);
+    free(entries);
+    if (library != NULL) closeRomLibrary(library);
+
+    return failed > 0 ? 1 : 0;
+}
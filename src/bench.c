@@ -0,0 +1,541 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "chip8.h"
+#include "jit.h"
+#include "lockstep.h"
+#include "profiler.h"
+
+/*
+ chip8-bench: headless micro and macro benchmarks, one JSON line per metric
+   {"name": "rom/BRIX/interpreter", "value": 123456789.0, "unit": "instructions/s", "higher_is_better": true}
+
+ micro: synthetic loops of one instruction kind (ns per instruction, sprites per second for DXYN)
+ rom:   each ROM for a fixed number of cycles with scripted input (instructions per second with the interpreter,
+        the recompiler and the lockstep engine, ns per sprite draw, and time per frame of renderFramebuffer,
+        the CPU side of updateDisplay)
+
+ every benchmark is repeated and the best run is kept; with -b the metrics are compared against a saved run
+ and the exit status is 1 if one got worse by more than the tolerance
+*/
+
+#define DEFAULT_CYCLES 300000
+#define DEFAULT_REPEATS 3
+#define DEFAULT_TOLERANCE 10.0 // percent
+#define CYCLES_PER_TICK 12
+#define MICRO_CYCLES 2000000
+#define MICRO_LOOP 64 // instructions in a micro loop before the jump back
+#define MAX_METRICS 4096
+#define LOCKSTEP_LANES 64 // the cycles are split between them
+#define MAX_ROM_SIZE 0x1000
+
+// scripted input: every INPUT_PERIOD ticks the next key is held for INPUT_HOLD ticks
+#define INPUT_PERIOD 30
+#define INPUT_HOLD 10
+
+typedef struct config_ {
+    uint64_t cycles;
+    int repeats;
+    double tolerance;
+    char quirks[32];
+} CONFIG;
+
+typedef struct metric_ {
+    char name[128];
+    double value;
+    const char* unit;
+    bool higher_is_better;
+} METRIC;
+
+typedef struct report_ {
+    METRIC* metrics;
+    int count;
+} REPORT;
+
+/*
+ micro benchmarks: the ROM starts with "1204 00EE" (a return stub at 0x202 for the 2NNN benchmark),
+ runs setup once, then loops over body repeated to MICRO_LOOP instructions
+ (the loop is longer than an idle loop, so it never gets skipped)
+*/
+typedef struct micro_ {
+    const char* name;
+    const char* quirks;
+    bool sprites; // reported in sprites per second
+    uint16_t setup[4]; // 0-terminated
+    uint16_t body[4]; // 0-terminated, its length divides MICRO_LOOP
+} MICRO;
+
+static const MICRO micros[] = {
+    { "6XNN", "vip", false, {0}, {0x6A12} },
+    { "7XNN", "vip", false, {0}, {0x7A01} },
+    { "8XY4", "vip", false, {0x6B03}, {0x8AB4} },
+    { "8XY6", "vip", false, {0x6BF1}, {0x8AB6} },
+    { "ANNN", "vip", false, {0}, {0xA123} },
+    { "CXNN", "vip", false, {0}, {0xC0FF} },
+    { "3XNN", "vip", false, {0}, {0x3AFF} },
+    { "EXA1", "vip", false, {0}, {0xE0A1, 0x6B01} },
+    { "2NNN/00EE", "vip", false, {0}, {0x2202} },
+    { "FX07", "vip", false, {0}, {0xF007} },
+    { "FX15", "vip", false, {0}, {0xF015} },
+    { "FX1E", "vip", false, {0}, {0xF01E} },
+    { "FX33", "vip", false, {0xA800}, {0xF033} },
+    { "FX55", "vip", false, {0}, {0xA800, 0xF755} }, // vip moves idx past the registers: reset it before it wraps onto the code
+    { "FX65", "vip", false, {0xA800}, {0xF765} },
+    { "DXY5 lo-res", "vip", true, {0xF029}, {0xD015} },
+    { "DXYF lo-res", "vip", true, {0xF029}, {0xD01F} },
+    { "DXYF hi-res", "schip", true, {0x00FF, 0xF029}, {0xD01F} },
+    { "DXY0 hi-res", "schip", true, {0x00FF, 0xF029}, {0xD010} },
+    { "DXYF 2 planes", "xo-chip", true, {0xF301, 0xF029}, {0xD01F} },
+};
+
+#define MICRO_COUNT ((int) (sizeof(micros) / sizeof(micros[0])))
+
+// any four colors (only the time matters)
+static const uint32_t palette[4] = { 0xFF000000, 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555 };
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void addMetric(REPORT* report, const char* unit, bool higher_is_better, double value, const char* format, ...) {
+    if (report->count == MAX_METRICS) {
+        fprintf(stderr, "ERROR: too many metrics\n");
+        exit(1);
+    }
+
+    METRIC* m = &report->metrics[report->count++];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(m->name, sizeof(m->name), format, args);
+    va_end(args);
+    m->value = value;
+    m->unit = unit;
+    m->higher_is_better = higher_is_better;
+}
+
+/*
+    MICRO BENCHMARKS
+*/
+
+static size_t buildMicroRom(const MICRO* micro, uint8_t* rom) {
+    uint16_t words[8 + MICRO_LOOP + 1];
+    int n = 0;
+
+    words[n++] = 0x1204;
+    words[n++] = 0x00EE;
+    for(int i = 0; micro->setup[i] != 0; i++) words[n++] = micro->setup[i];
+
+    int body_length = 0;
+    while (micro->body[body_length] != 0) body_length++;
+
+    uint16_t loop = 0x200 + 2*n;
+    for(int i = 0; i < MICRO_LOOP; i++) words[n++] = micro->body[i % body_length];
+    words[n++] = 0x1000 | loop;
+
+    for(int i = 0; i < n; i++) {
+        rom[2*i] = words[i] >> 8;
+        rom[2*i + 1] = words[i] & 0xff;
+    }
+    return 2*n;
+}
+
+// best time per instruction in ns (0 if the engine isn't available)
+static double runMicro(const MICRO* micro, int jit_mode, int repeats) {
+    uint8_t rom[2*(8 + MICRO_LOOP + 1)];
+    size_t size = buildMicroRom(micro, rom);
+    double best = 0;
+
+    for(int r = 0; r < repeats; r++) {
+        // the profile goes first (it sizes the memory the program is loaded into)
+        CHIP8* chip8 = createInterpreter();
+        if (chip8 == NULL || !setQuirkProfile(chip8, micro->quirks) || !loadProgram(chip8, rom, size)) {
+            fprintf(stderr, "ERROR: out of memory\n");
+            exit(1);
+        }
+        if (jit_mode != JIT_OFF && !enableJit(chip8, jit_mode)) {
+            freeInterpreter(chip8);
+            return 0;
+        }
+
+        // the first pass decodes / compiles the loop
+        runCycles(chip8, 2*MICRO_LOOP, EVENT_NONE);
+        uint64_t start_cycles = getCycleCount(chip8);
+
+        double start = now();
+        runCycles(chip8, MICRO_CYCLES, EVENT_NONE);
+        double elapsed = now() - start;
+
+        // a loop that halted (or ran into zeroed memory) would time a handful of instructions
+        if (hasEnded(chip8)) {
+            fprintf(stderr, "ERROR: micro benchmark %s ended after %llu instructions\n", micro->name,
+                    (unsigned long long) getCycleCount(chip8));
+            exit(1);
+        }
+
+        double ns = elapsed * 1e9 / (getCycleCount(chip8) - start_cycles);
+        if (r == 0 || ns < best) best = ns;
+        freeInterpreter(chip8);
+    }
+
+    return best;
+}
+
+void runMicros(REPORT* report, CONFIG* config) {
+    static const char* engines[] = { "interpreter", "jit" };
+
+    for(int i = 0; i < MICRO_COUNT; i++) {
+        const MICRO* micro = &micros[i];
+
+        for(int e = 0; e < 2; e++) {
+            // the recompiler only handles the 4 KB profiles
+            if (e == 1 && strcmp(micro->quirks, "xo-chip") == 0) continue;
+
+            double ns = runMicro(micro, e == 0 ? JIT_OFF : JIT_ON, config->repeats);
+            if (ns == 0) continue;
+
+            if (micro->sprites) {
+                // one jump per loop besides the draws
+                double sprites = 1e9 / ns * MICRO_LOOP / (MICRO_LOOP + 1);
+                addMetric(report, "sprites/s", true, sprites, "sprite/%s/%s", engines[e], micro->name);
+            } else {
+                addMetric(report, "ns/instruction", false, ns, "micro/%s/%s", engines[e], micro->name);
+            }
+        }
+    }
+}
+
+/*
+    ROM BENCHMARKS
+*/
+
+typedef struct rom_run_ {
+    double run_time; // running instructions only
+    uint64_t cycles;
+    uint64_t frames;
+    double render_time;
+    PROFILE_SUMMARY profile;
+} ROM_RUN;
+
+static uint16_t scriptedKeys(uint64_t tick) {
+    if (tick % INPUT_PERIOD >= INPUT_HOLD) return 0;
+    return 1 << ((tick / INPUT_PERIOD) % 16);
+}
+
+// runs a ROM for the configured cycles, rendering every frame that changed (false if it can't be loaded)
+static bool runRom(const char* path, CONFIG* config, int jit_mode, bool profile, ROM_RUN* run) {
+    // the profile goes first, so XO-CHIP ROMs have their 64 KB
+    CHIP8* chip8 = createInterpreter();
+    if (chip8 == NULL || !setQuirkProfile(chip8, config->quirks) || !loadRom(chip8, path)) {
+        if (chip8 != NULL) freeInterpreter(chip8);
+        return false;
+    }
+    seedRandom(chip8, 0);
+    if (jit_mode != JIT_OFF && !enableJit(chip8, jit_mode)) {
+        freeInterpreter(chip8);
+        return false;
+    }
+    if (profile && !enableProfiler(chip8)) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+
+    static uint32_t pixels[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+    memset(run, 0, sizeof(ROM_RUN));
+
+    // the whole loop is timed at once (a tick is too short to time on its own), then rendering is taken out
+    uint64_t ticks = (config->cycles + CYCLES_PER_TICK - 1) / CYCLES_PER_TICK;
+    double loop_start = now();
+    for(uint64_t tick = 0; tick < ticks; tick++) {
+        setKeys(chip8, scriptedKeys(tick));
+        uint8_t events = runCycles(chip8, CYCLES_PER_TICK, EVENT_NONE);
+        updateTimers(chip8);
+
+        if (needsToDraw(chip8)) {
+            double start = now();
+            renderFramebuffer(getFramebuffer(chip8), pixels, DISPLAY_WIDTH * sizeof(uint32_t), palette);
+            run->render_time += now() - start;
+            run->frames++;
+            markDrawn(chip8);
+        }
+
+        if (events & EVENT_HALT) break;
+    }
+    run->run_time = now() - loop_start - run->render_time;
+
+    run->cycles = getCycleCount(chip8);
+    if (profile) getProfileSummary(chip8, &run->profile);
+    freeInterpreter(chip8);
+    return true;
+}
+
+// runs LOCKSTEP_LANES instances of a ROM in the lockstep engine, each with the scripted input delayed by its lane
+// returns instructions per second over all lanes (0 if the engine can't run the ROM)
+static double runLockstepRom(const char* path, CONFIG* config) {
+    static uint8_t rom[MAX_ROM_SIZE];
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) return 0;
+    size_t size = fread(rom, 1, sizeof(rom), f);
+    fclose(f);
+
+    LOCKSTEP* lockstep = createLockstep(LOCKSTEP_LANES, rom, size, config->quirks);
+    if (lockstep == NULL) return 0;
+    for(int lane = 0; lane < LOCKSTEP_LANES; lane++) seedLane(lockstep, lane, lane);
+
+    uint64_t cycles = config->cycles / LOCKSTEP_LANES;
+    uint64_t ticks = (cycles + CYCLES_PER_TICK - 1) / CYCLES_PER_TICK;
+    double start = now();
+    for(uint64_t tick = 0; tick < ticks; tick++) {
+        for(int lane = 0; lane < LOCKSTEP_LANES; lane++) setLaneKeys(lockstep, lane, scriptedKeys(tick + lane));
+        runLockstep(lockstep, CYCLES_PER_TICK);
+        tickLockstep(lockstep);
+    }
+    double time = now() - start;
+
+    uint64_t total = 0;
+    bool supported = true;
+    for(int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        total += getLaneCycles(lockstep, lane);
+        if (getLaneState(lockstep, lane) == LANE_UNSUPPORTED) supported = false;
+    }
+    freeLockstep(lockstep);
+    return supported && time > 0 ? total / time : 0;
+}
+
+static const char* baseName(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+// returns false if the ROM couldn't be loaded
+bool benchRom(REPORT* report, CONFIG* config, const char* path) {
+    const char* name = baseName(path);
+    ROM_RUN run, best;
+    double best_render = 0;
+
+    // instructions per second (stalled FX0A slots and skipped idle loop passes count as executed)
+    for(int e = 0; e < 2; e++) {
+        bool available = false;
+        for(int r = 0; r < config->repeats; r++) {
+            if (!runRom(path, config, e == 0 ? JIT_OFF : JIT_ON, false, &run)) {
+                if (e == 0) return false;
+                break;
+            }
+            if (!available || run.run_time < best.run_time) best = run;
+            if (e == 0 && run.frames > 0 && (best_render == 0 || run.render_time / run.frames < best_render))
+                best_render = run.render_time / run.frames;
+            available = true;
+        }
+
+        if (available && best.run_time > 0)
+            addMetric(report, "instructions/s", true, best.cycles / best.run_time, "rom/%s/%s", name,
+                      e == 0 ? "interpreter" : "jit");
+    }
+
+    // the same total of instructions spread over many lanes (only ROMs the engine runs to the end)
+    double best_lockstep = 0;
+    for(int r = 0; r < config->repeats; r++) {
+        double rate = runLockstepRom(path, config);
+        if (rate == 0) break;
+        if (rate > best_lockstep) best_lockstep = rate;
+    }
+    if (best_lockstep > 0) addMetric(report, "instructions/s", true, best_lockstep, "rom/%s/lockstep", name);
+
+    if (best_render > 0) addMetric(report, "us/frame", false, best_render * 1e6, "rom/%s/render", name);
+
+    // sprite draws, timed one by one in the profiler's loop
+    double best_draw = 0;
+    for(int r = 0; r < config->repeats; r++) {
+        runRom(path, config, JIT_OFF, true, &run);
+        if (run.profile.draws == 0) break;
+
+        double ns = run.profile.draw_time / run.profile.draws * 1e9;
+        if (r == 0 || ns < best_draw) best_draw = ns;
+    }
+    if (best_draw > 0) addMetric(report, "ns/draw", false, best_draw, "rom/%s/draw", name);
+
+    return true;
+}
+
+/*
+    OUTPUT AND BASELINES
+*/
+
+void writeReport(FILE* out, REPORT* report) {
+    for(int i = 0; i < report->count; i++) {
+        METRIC* m = &report->metrics[i];
+        fprintf(out, "{\"name\": \"");
+        for(const char* c = m->name; *c; c++) {
+            if (*c == '"' || *c == '\\') fputc('\\', out);
+            fputc(*c, out);
+        }
+        fprintf(out, "\", \"value\": %.6g, \"unit\": \"%s\", \"higher_is_better\": %s}\n",
+                m->value, m->unit, m->higher_is_better ? "true" : "false");
+    }
+}
+
+// reads the name and value of each line written by writeReport
+void loadBaseline(REPORT* baseline, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    char line[512];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line_number++;
+        if (line[0] != '{') continue;
+
+        char* name = strstr(line, "\"name\": \"");
+        char* value = strstr(line, "\"value\": ");
+        if (name == NULL || value == NULL || baseline->count == MAX_METRICS) {
+            fprintf(stderr, "ERROR: %s:%d: not a benchmark result\n", path, line_number);
+            exit(1);
+        }
+
+        METRIC* m = &baseline->metrics[baseline->count++];
+        const char* c = name + strlen("\"name\": \"");
+        size_t length = 0;
+        while (*c != '\0' && *c != '"' && length < sizeof(m->name) - 1) {
+            if (*c == '\\' && c[1] != '\0') c++;
+            m->name[length++] = *c++;
+        }
+        m->name[length] = '\0';
+        m->value = strtod(value + strlen("\"value\": "), NULL);
+    }
+
+    fclose(f);
+}
+
+// prints every metric against the baseline and returns the number of regressions
+int compareReports(FILE* out, REPORT* report, REPORT* baseline, double tolerance) {
+    int regressions = 0;
+
+    fprintf(out, "%-36s %14s %14s %9s\n", "benchmark", "baseline", "now", "change");
+    for(int i = 0; i < report->count; i++) {
+        METRIC* m = &report->metrics[i];
+
+        METRIC* base = NULL;
+        for(int j = 0; j < baseline->count && base == NULL; j++) {
+            if (strcmp(baseline->metrics[j].name, m->name) == 0) base = &baseline->metrics[j];
+        }
+        if (base == NULL || base->value <= 0 || m->value <= 0) {
+            fprintf(out, "%-36s %14s %14.6g %9s\n", m->name, "-", m->value, "new");
+            continue;
+        }
+
+        // positive is an improvement, whichever direction is better
+        double change = m->higher_is_better ? m->value / base->value - 1 : base->value / m->value - 1;
+        bool regression = change * 100 < -tolerance;
+        if (regression) regressions++;
+
+        fprintf(out, "%-36s %14.6g %14.6g %+8.1f%%%s\n", m->name, base->value, m->value, change * 100,
+                regression ? "  REGRESSION" : "");
+    }
+
+    return regressions;
+}
+
+void printUsage(char* program) {
+    fprintf(stderr, "usage: %s [-n cycles] [-r repeats] [-q quirks] [-o results] [-b baseline] [-t tolerance%%] [rom ...]\n", program);
+}
+
+int main(int argc, char* argv[]) {
+    CONFIG config;
+    memset(&config, 0, sizeof(config));
+    config.cycles = DEFAULT_CYCLES;
+    config.repeats = DEFAULT_REPEATS;
+    config.tolerance = DEFAULT_TOLERANCE;
+    snprintf(config.quirks, sizeof(config.quirks), "%s", getQuirkProfileName(0));
+
+    const char* output_path = NULL;
+    const char* baseline_path = NULL;
+    char** roms = (char**) malloc(argc * sizeof(char*));
+    int rom_count = 0;
+
+    for(int i = 1; i < argc; i++) {
+        bool has_value = i+1 < argc;
+
+        if (strcmp(argv[i], "-n") == 0 && has_value) config.cycles = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-r") == 0 && has_value) config.repeats = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && has_value) config.tolerance = atof(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && has_value) output_path = argv[++i];
+        else if (strcmp(argv[i], "-b") == 0 && has_value) baseline_path = argv[++i];
+        else if (strcmp(argv[i], "-q") == 0 && has_value) {
+            const char* quirks = argv[++i];
+            int q = 0;
+            while (getQuirkProfileName(q) != NULL && strcmp(getQuirkProfileName(q), quirks) != 0) q++;
+            if (getQuirkProfileName(q) == NULL) {
+                fprintf(stderr, "ERROR: unknown quirk profile \"%s\"\n", quirks);
+                return 1;
+            }
+            snprintf(config.quirks, sizeof(config.quirks), "%s", quirks);
+        }
+        else if (argv[i][0] != '-') roms[rom_count++] = argv[i];
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (config.repeats < 1) config.repeats = 1;
+
+    REPORT report = { (METRIC*) calloc(MAX_METRICS, sizeof(METRIC)), 0 };
+    if (report.metrics == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return 1;
+    }
+
+    double start = now();
+    runMicros(&report, &config);
+
+    int failed = 0;
+    for(int i = 0; i < rom_count; i++) {
+        if (!benchRom(&report, &config, roms[i])) {
+            fprintf(stderr, "ERROR: couldn't load %s\n", roms[i]);
+            failed++;
+        }
+    }
+
+    FILE* out = stdout;
+    if (output_path != NULL) {
+        out = fopen(output_path, "w");
+        if (out == NULL) {
+            fprintf(stderr, "ERROR: %s: %s\n", output_path, strerror(errno));
+            return 1;
+        }
+    }
+    writeReport(out, &report);
+    if (out != stdout) fclose(out);
+
+    fprintf(stderr, "%d metrics, %d ROMs (%d failed) in %.1f s\n", report.count, rom_count, failed, now() - start);
+
+    int regressions = 0;
+    if (baseline_path != NULL) {
+        REPORT baseline = { (METRIC*) calloc(MAX_METRICS, sizeof(METRIC)), 0 };
+        if (baseline.metrics == NULL) {
+            fprintf(stderr, "ERROR: out of memory\n");
+            return 1;
+        }
+        loadBaseline(&baseline, baseline_path);
+
+        regressions = compareReports(stderr, &report, &baseline, config.tolerance);
+        fprintf(stderr, "%d regressions (tolerance %.1f%%)\n", regressions, config.tolerance);
+        free(baseline.metrics);
+    }
+
+    free(report.metrics);
+    free(roms);
+
+    return failed > 0 || regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,692 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+
+/*
+ raw stream format (version 1, little-endian):
+   "C8CV" magic, u16 version, u32 frame_hz
+   frames: varint ticks since the previous frame, u8 resolution (0: 64 x 32, 1: 128 x 64), coded delta
+   end: varint ticks from the last frame to the end of the capture, u8 0xFF
+
+ the delta is the XOR against the previous frame (a blank screen after a resolution change) of both planes,
+ each row by row at 1 bit per pixel, most significant bit first. It is coded as pairs
+ (varint run of zero bytes, varint count of literal bytes, the literal bytes) that add up to the frame size
+*/
+
+#define RAW_MAGIC "C8CV"
+#define RAW_VERSION 1
+#define RAW_END 0xFF
+#define FRAME_BYTES (DISPLAY_PLANES * DISPLAY_HEIGHT * ROW_WORDS * 8)
+
+#define CAPTURE_QUEUE 64 // frames waiting for the writer
+#define PNG_ROW_BYTES (DISPLAY_WIDTH / 4) // 2 bits per pixel
+#define LZW_CODES 4096
+
+static const uint32_t default_palette[1 << DISPLAY_PLANES] = {
+    0xFF000000, 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555
+};
+
+typedef struct queued_frame_ {
+    FRAMEBUFFER fb;
+    uint64_t tick;
+} QUEUED_FRAME;
+
+// growable output buffer (failed once an allocation failed)
+typedef struct bytes_ {
+    uint8_t* data;
+    size_t size, capacity;
+    bool failed;
+} BYTES;
+
+// least significant bit first bit stream (deflate and GIF LZW)
+typedef struct bits_ {
+    BYTES* out;
+    uint32_t acc;
+    int count;
+} BITS;
+
+// rendered image, one palette index per pixel (lo-res doubled)
+typedef uint8_t IMAGE[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+
+struct capture_ {
+    int format;
+    uint32_t frame_hz;
+    uint32_t palette[1 << DISPLAY_PLANES];
+    bool lossless;
+    FILE* file; // raw stream and GIF
+    char* prefix; // PNG file names
+
+    // producer side (the emulation thread)
+    uint64_t ticks;
+    uint64_t last_hash;
+    bool has_last;
+    uint64_t dropped;
+
+    // queue: frames [tail, head) wait for the writer
+    QUEUED_FRAME* queue;
+    uint64_t head, tail;
+    bool closing;
+    pthread_mutex_t lock;
+    pthread_cond_t ready, room;
+    pthread_t writer;
+
+    // writer side
+    uint64_t written;
+    bool failed;
+    BYTES out;
+    uint64_t last_tick;
+    bool hires;
+    uint8_t previous[FRAME_BYTES]; // raw: the last frame, packed
+    IMAGE shown; // GIF: the image after the pending frame
+    int pending_left, pending_top, pending_width, pending_height; // GIF: frame not written yet (width 0 if none)
+    uint64_t pending_tick;
+    int16_t lzw[LZW_CODES][1 << DISPLAY_PLANES]; // GIF: code of prefix + color (-1 if none)
+};
+
+int getCaptureFormat(const char* path) {
+    static const char* extensions[] = { ".c8v", ".png", ".gif" };
+    size_t length = strlen(path);
+    for(int i = 0; i < 3; i++) {
+        if (length > 4 && strcmp(path + length - 4, extensions[i]) == 0) return i;
+    }
+    return -1;
+}
+
+/*
+    OUTPUT
+*/
+
+static void putByte(BYTES* b, uint8_t value) {
+    if (b->size == b->capacity) {
+        size_t capacity = b->capacity > 0 ? 2 * b->capacity : 4096;
+        uint8_t* data = (uint8_t*) realloc(b->data, capacity);
+        if (data == NULL) {
+            b->failed = true;
+            return;
+        }
+        b->data = data;
+        b->capacity = capacity;
+    }
+    b->data[b->size++] = value;
+}
+
+static void putBytes(BYTES* b, const void* data, size_t n) {
+    for(size_t i = 0; i < n; i++) putByte(b, ((const uint8_t*) data)[i]);
+}
+
+static void put16(BYTES* b, uint16_t value) {
+    putByte(b, value);
+    putByte(b, value >> 8);
+}
+
+static void put32(BYTES* b, uint32_t value) {
+    for(int i = 0; i < 4; i++) putByte(b, value >> (8*i));
+}
+
+static void put32BigEndian(BYTES* b, uint32_t value) {
+    for(int i = 3; i >= 0; i--) putByte(b, value >> (8*i));
+}
+
+static void putVarint(BYTES* b, uint64_t value) {
+    while (value >= 0x80) {
+        putByte(b, value | 0x80);
+        value >>= 7;
+    }
+    putByte(b, value);
+}
+
+static void putBits(BITS* bits, uint32_t value, int n) {
+    bits->acc |= value << bits->count;
+    bits->count += n;
+    while (bits->count >= 8) {
+        putByte(bits->out, bits->acc);
+        bits->acc >>= 8;
+        bits->count -= 8;
+    }
+}
+
+static void flushBits(BITS* bits) {
+    if (bits->count > 0) putByte(bits->out, bits->acc);
+    bits->acc = 0;
+    bits->count = 0;
+}
+
+// writes out (and empties) the output buffer
+static void flushOutput(CAPTURE* capture, FILE* file) {
+    if (capture->out.failed || fwrite(capture->out.data, 1, capture->out.size, file) != capture->out.size)
+        capture->failed = true;
+    capture->out.size = 0;
+    capture->out.failed = false;
+}
+
+static void expandFrame(const FRAMEBUFFER* fb, IMAGE image) {
+    int scale = fb->width == LORES_WIDTH ? 2 : 1;
+    for(int y = 0; y < fb->height; y++) {
+        uint8_t* row = image[y * scale];
+        for(int w = 0; w < fb->width / 64; w++) {
+            uint64_t bits[DISPLAY_PLANES];
+            for(int p = 0; p < DISPLAY_PLANES; p++) bits[p] = fb->rows[p][y][w];
+
+            // most significant bit first
+            for(int x = 64*w; x < 64*(w + 1); x++) {
+                uint8_t color = 0;
+                for(int p = 0; p < DISPLAY_PLANES; p++) {
+                    color |= (bits[p] >> 63) << p;
+                    bits[p] <<= 1;
+                }
+                for(int i = 0; i < scale; i++) row[x * scale + i] = color;
+            }
+        }
+        if (scale == 2) memcpy(image[y * 2 + 1], row, DISPLAY_WIDTH);
+    }
+}
+
+/*
+    RAW STREAM
+*/
+
+// both planes at the current resolution, 1 bit per pixel (returns the size)
+static int packFrame(const FRAMEBUFFER* fb, uint8_t* packed) {
+    int n = 0;
+    for(int p = 0; p < DISPLAY_PLANES; p++) {
+        for(int y = 0; y < fb->height; y++) {
+            for(int w = 0; w < fb->width / 64; w++) {
+                for(int i = 0; i < 8; i++) packed[n++] = fb->rows[p][y][w] >> (56 - 8*i);
+            }
+        }
+    }
+    return n;
+}
+
+static void writeRawFrame(CAPTURE* capture, const FRAMEBUFFER* fb, uint64_t tick) {
+    bool hires = fb->width == DISPLAY_WIDTH;
+    if (hires != capture->hires) {
+        memset(capture->previous, 0, FRAME_BYTES);
+        capture->hires = hires;
+    }
+
+    uint8_t delta[FRAME_BYTES];
+    int n = packFrame(fb, delta);
+    for(int i = 0; i < n; i++) {
+        uint8_t byte = delta[i];
+        delta[i] ^= capture->previous[i];
+        capture->previous[i] = byte;
+    }
+
+    BYTES* out = &capture->out;
+    putVarint(out, tick - capture->last_tick);
+    putByte(out, hires);
+
+    // literals run until two zero bytes in a row (a single one is cheaper to copy than to code)
+    for(int i = 0; i < n; ) {
+        int zeros = 0;
+        while (i + zeros < n && delta[i + zeros] == 0) zeros++;
+        i += zeros;
+
+        int literals = 0;
+        while (i + literals < n && !(delta[i + literals] == 0 && (i + literals + 1 == n || delta[i + literals + 1] == 0)))
+            literals++;
+
+        putVarint(out, zeros);
+        putVarint(out, literals);
+        putBytes(out, delta + i, literals);
+        i += literals;
+    }
+
+    flushOutput(capture, capture->file);
+}
+
+/*
+    PNG
+ 2 bits per pixel with the palette, rows filtered by their difference with the row above,
+ compressed with fixed Huffman codes and distance 1 runs only (enough for mostly blank, blocky screens)
+*/
+
+static uint32_t crc32(const uint8_t* data, size_t n) {
+    uint32_t crc = 0xFFFFFFFF;
+    for(size_t i = 0; i < n; i++) {
+        crc ^= data[i];
+        for(int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static uint32_t adler32(const uint8_t* data, size_t n) {
+    uint32_t a = 1, b = 0;
+    for(size_t i = 0; i < n; i++) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+// Huffman codes go most significant bit first
+static void putHuffman(BITS* bits, uint32_t code, int length) {
+    for(int i = length - 1; i >= 0; i--) putBits(bits, (code >> i) & 1, 1);
+}
+
+// a literal / length symbol with the fixed codes
+static void putSymbol(BITS* bits, int symbol) {
+    if (symbol < 144) putHuffman(bits, 0x30 + symbol, 8);
+    else if (symbol < 256) putHuffman(bits, 0x190 + symbol - 144, 9);
+    else if (symbol < 280) putHuffman(bits, symbol - 256, 7);
+    else putHuffman(bits, 0xC0 + symbol - 280, 8);
+}
+
+// a copy of the previous byte, length 3 - 258
+static void putRun(BITS* bits, int length) {
+    static const uint16_t base[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const uint8_t extra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+
+    int code = 28;
+    while (base[code] > length) code--;
+    putSymbol(bits, 257 + code);
+    putBits(bits, length - base[code], extra[code]);
+    putHuffman(bits, 0, 5); // distance 1
+}
+
+// zlib stream of one fixed Huffman block
+static void putZlib(BYTES* out, const uint8_t* data, size_t n) {
+    putByte(out, 0x78);
+    putByte(out, 0x01);
+
+    BITS bits = { out, 0, 0 };
+    putBits(&bits, 1, 1); // last block
+    putBits(&bits, 1, 2); // fixed codes
+    for(size_t i = 0; i < n; ) {
+        size_t run = 0;
+        while (i > 0 && i + run < n && run < 258 && data[i + run] == data[i - 1]) run++;
+        if (run >= 3) {
+            putRun(&bits, run);
+            i += run;
+        } else {
+            putSymbol(&bits, data[i++]);
+        }
+    }
+    putSymbol(&bits, 256);
+    flushBits(&bits);
+
+    put32BigEndian(out, adler32(data, n));
+}
+
+static void putChunk(BYTES* out, const char* type, const uint8_t* data, size_t n) {
+    put32BigEndian(out, n);
+    size_t start = out->size;
+    putBytes(out, type, 4);
+    putBytes(out, data, n);
+    if (!out->failed) put32BigEndian(out, crc32(out->data + start, n + 4));
+}
+
+static void writePngFrame(CAPTURE* capture, const FRAMEBUFFER* fb, uint64_t tick) {
+    IMAGE image;
+    expandFrame(fb, image);
+
+    // filter 2 (up) on every row but the first, which has nothing above it
+    uint8_t filtered[DISPLAY_HEIGHT * (PNG_ROW_BYTES + 1)];
+    uint8_t above[PNG_ROW_BYTES] = {0};
+    for(int y = 0; y < DISPLAY_HEIGHT; y++) {
+        uint8_t* row = &filtered[y * (PNG_ROW_BYTES + 1)];
+        row[0] = y > 0 ? 2 : 0;
+        for(int i = 0; i < PNG_ROW_BYTES; i++) {
+            const uint8_t* p = &image[y][4*i];
+            uint8_t byte = (p[0] << 6) | (p[1] << 4) | (p[2] << 2) | p[3];
+            row[1 + i] = byte - above[i];
+            above[i] = byte;
+        }
+    }
+
+    BYTES* out = &capture->out;
+    putBytes(out, "\x89PNG\r\n\x1a\n", 8);
+
+    uint8_t header[13] = {0};
+    header[2] = DISPLAY_WIDTH >> 8;
+    header[3] = DISPLAY_WIDTH & 0xFF;
+    header[6] = DISPLAY_HEIGHT >> 8;
+    header[7] = DISPLAY_HEIGHT & 0xFF;
+    header[8] = 2; // bits per pixel
+    header[9] = 3; // indexed colors
+    putChunk(out, "IHDR", header, sizeof(header));
+
+    uint8_t colors[3 << DISPLAY_PLANES];
+    for(int i = 0; i < 1 << DISPLAY_PLANES; i++) {
+        colors[3*i] = capture->palette[i] >> 16;
+        colors[3*i + 1] = capture->palette[i] >> 8;
+        colors[3*i + 2] = capture->palette[i];
+    }
+    putChunk(out, "PLTE", colors, sizeof(colors));
+
+    BYTES compressed = {0};
+    putZlib(&compressed, filtered, sizeof(filtered));
+    out->failed |= compressed.failed;
+    putChunk(out, "IDAT", compressed.data, compressed.size);
+    free(compressed.data);
+    putChunk(out, "IEND", NULL, 0);
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s-%06llu.png", capture->prefix, (unsigned long long) tick);
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        capture->failed = true;
+        capture->out.size = 0;
+        capture->out.failed = false;
+        return;
+    }
+    flushOutput(capture, file);
+    if (fclose(file) != 0) capture->failed = true;
+}
+
+/*
+    GIF
+ 4-color global palette, every frame only covers the rectangle that changed (drawn over the previous one),
+ with the delay to the next changed frame
+*/
+
+static void writeGifHeader(CAPTURE* capture) {
+    BYTES* out = &capture->out;
+    putBytes(out, "GIF89a", 6);
+    put16(out, DISPLAY_WIDTH);
+    put16(out, DISPLAY_HEIGHT);
+    putByte(out, 0x80 | 0x01); // global palette of 4 colors
+    putByte(out, 0); // background color
+    putByte(out, 0); // aspect ratio
+    for(int i = 0; i < 1 << DISPLAY_PLANES; i++) {
+        putByte(out, capture->palette[i] >> 16);
+        putByte(out, capture->palette[i] >> 8);
+        putByte(out, capture->palette[i]);
+    }
+
+    // loop forever
+    putBytes(out, "\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 19);
+}
+
+// LZW codes of the pixels (minimum code size 2)
+static void putLzw(CAPTURE* capture, BITS* bits, const uint8_t* pixels, int n) {
+    const int clear = 1 << DISPLAY_PLANES, end = clear + 1;
+    int size = DISPLAY_PLANES + 1, next = clear + 2;
+    memset(capture->lzw, 0xFF, sizeof(capture->lzw));
+
+    putBits(bits, clear, size);
+    int prefix = pixels[0];
+    for(int i = 1; i < n; i++) {
+        int code = capture->lzw[prefix][pixels[i]];
+        if (code >= 0) {
+            prefix = code;
+            continue;
+        }
+
+        putBits(bits, prefix, size);
+        if (next == (1 << size)) size++;
+        capture->lzw[prefix][pixels[i]] = next++;
+        prefix = pixels[i];
+
+        // table full: start over
+        if (next == LZW_CODES) {
+            putBits(bits, clear, size);
+            memset(capture->lzw, 0xFF, sizeof(capture->lzw));
+            size = DISPLAY_PLANES + 1;
+            next = clear + 2;
+        }
+    }
+    putBits(bits, prefix, size);
+
+    // the decoder adds an entry for the last code, which can make the end code one bit wider
+    if (next == (1 << size) && size < 12) size++;
+    putBits(bits, end, size);
+    flushBits(bits);
+}
+
+// writes the pending frame, shown from its tick until this one
+static void flushGifFrame(CAPTURE* capture, uint64_t tick) {
+    if (capture->pending_width == 0) return;
+
+    uint64_t start = capture->pending_tick * 100 / capture->frame_hz, stop = tick * 100 / capture->frame_hz;
+    uint64_t delay = stop - start;
+    if (delay > 0xFFFF) delay = 0xFFFF;
+
+    BYTES* out = &capture->out;
+    putBytes(out, "\x21\xF9\x04", 3);
+    putByte(out, 1 << 2); // drawn over by the next frame
+    put16(out, delay);
+    putByte(out, 0); // no transparent color
+    putByte(out, 0);
+
+    int left = capture->pending_left, top = capture->pending_top;
+    int width = capture->pending_width, height = capture->pending_height;
+    putByte(out, 0x2C);
+    put16(out, left);
+    put16(out, top);
+    put16(out, width);
+    put16(out, height);
+    putByte(out, 0); // no local palette, not interlaced
+
+    uint8_t pixels[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+    for(int y = 0; y < height; y++) memcpy(&pixels[y * width], &capture->shown[top + y][left], width);
+
+    BYTES codes = {0};
+    BITS bits = { &codes, 0, 0 };
+    putLzw(capture, &bits, pixels, width * height);
+    out->failed |= codes.failed;
+
+    // data sub-blocks of up to 255 bytes
+    putByte(out, DISPLAY_PLANES);
+    for(size_t i = 0; i < codes.size; i += 255) {
+        size_t n = codes.size - i < 255 ? codes.size - i : 255;
+        putByte(out, n);
+        putBytes(out, codes.data + i, n);
+    }
+    putByte(out, 0);
+    free(codes.data);
+
+    capture->pending_width = 0;
+    flushOutput(capture, capture->file);
+}
+
+static void writeGifFrame(CAPTURE* capture, const FRAMEBUFFER* fb, uint64_t tick) {
+    IMAGE image;
+    expandFrame(fb, image);
+
+    // the rectangle that changed (the whole screen for the first frame)
+    int left = DISPLAY_WIDTH, right = -1, top = DISPLAY_HEIGHT, bottom = -1;
+    for(int y = 0; y < DISPLAY_HEIGHT; y++) {
+        const uint8_t* row = image[y];
+        const uint8_t* shown = capture->shown[y];
+        if (capture->written > 0 && memcmp(row, shown, DISPLAY_WIDTH) == 0) continue;
+
+        int first = 0, last = DISPLAY_WIDTH - 1;
+        if (capture->written > 0) {
+            while (row[first] == shown[first]) first++;
+            while (row[last] == shown[last]) last--;
+        }
+        if (first < left) left = first;
+        if (last > right) right = last;
+        if (y < top) top = y;
+        bottom = y;
+    }
+    if (right < 0) return; // looks the same: the pending frame lasts longer
+
+    flushGifFrame(capture, tick);
+    memcpy(capture->shown, image, sizeof(IMAGE));
+    capture->pending_left = left;
+    capture->pending_top = top;
+    capture->pending_width = right - left + 1;
+    capture->pending_height = bottom - top + 1;
+    capture->pending_tick = tick;
+}
+
+/*
+    WRITER THREAD
+*/
+
+static void writeFrame(CAPTURE* capture, const QUEUED_FRAME* frame) {
+    switch (capture->format) {
+        case CAPTURE_RAW: writeRawFrame(capture, &frame->fb, frame->tick); break;
+        case CAPTURE_PNG: writePngFrame(capture, &frame->fb, frame->tick); break;
+        case CAPTURE_GIF: writeGifFrame(capture, &frame->fb, frame->tick); break;
+    }
+    capture->written++;
+    capture->last_tick = frame->tick;
+}
+
+static void* writerMain(void* arg) {
+    CAPTURE* capture = (CAPTURE*) arg;
+
+    while (true) {
+        pthread_mutex_lock(&capture->lock);
+        while (capture->tail == capture->head && !capture->closing) pthread_cond_wait(&capture->ready, &capture->lock);
+        bool done = capture->tail == capture->head;
+        pthread_mutex_unlock(&capture->lock);
+        if (done) break;
+
+        // the slot stays the writer's until tail moves past it
+        writeFrame(capture, &capture->queue[capture->tail % CAPTURE_QUEUE]);
+
+        pthread_mutex_lock(&capture->lock);
+        capture->tail++;
+        pthread_cond_signal(&capture->room);
+        pthread_mutex_unlock(&capture->lock);
+    }
+    return NULL;
+}
+
+static void freeCapture(CAPTURE* capture) {
+    if (capture->file != NULL) fclose(capture->file);
+    free(capture->prefix);
+    free(capture->queue);
+    free(capture->out.data);
+    free(capture);
+}
+
+CAPTURE* createCapture(const char* path, int format, uint32_t frame_hz, const uint32_t* palette, bool lossless) {
+    if (format < CAPTURE_RAW || format > CAPTURE_GIF || frame_hz == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    CAPTURE* capture = (CAPTURE*) calloc(1, sizeof(CAPTURE));
+    if (capture == NULL) return NULL;
+    capture->format = format;
+    capture->frame_hz = frame_hz;
+    memcpy(capture->palette, palette != NULL ? palette : default_palette, sizeof(capture->palette));
+    capture->lossless = lossless;
+
+    capture->queue = (QUEUED_FRAME*) malloc(CAPTURE_QUEUE * sizeof(QUEUED_FRAME));
+    if (capture->queue == NULL) {
+        freeCapture(capture);
+        return NULL;
+    }
+
+    if (format == CAPTURE_PNG) {
+        // "run.png" numbers its frames run-000042.png
+        size_t length = strlen(path);
+        if (getCaptureFormat(path) == CAPTURE_PNG) length -= 4;
+        capture->prefix = strndup(path, length);
+        if (capture->prefix == NULL) {
+            freeCapture(capture);
+            return NULL;
+        }
+    } else {
+        capture->file = fopen(path, "wb");
+        if (capture->file == NULL) {
+            freeCapture(capture);
+            return NULL;
+        }
+
+        if (format == CAPTURE_RAW) {
+            putBytes(&capture->out, RAW_MAGIC, 4);
+            put16(&capture->out, RAW_VERSION);
+            put32(&capture->out, frame_hz);
+        } else {
+            writeGifHeader(capture);
+        }
+        flushOutput(capture, capture->file);
+    }
+
+    pthread_mutex_init(&capture->lock, NULL);
+    pthread_cond_init(&capture->ready, NULL);
+    pthread_cond_init(&capture->room, NULL);
+    int error = pthread_create(&capture->writer, NULL, writerMain, capture);
+    if (error != 0) {
+        pthread_cond_destroy(&capture->room);
+        pthread_cond_destroy(&capture->ready);
+        pthread_mutex_destroy(&capture->lock);
+        freeCapture(capture);
+        errno = error;
+        return NULL;
+    }
+    return capture;
+}
+
+void captureFrame(CAPTURE* capture, const FRAMEBUFFER* fb) {
+    uint64_t tick = capture->ticks++;
+    uint64_t hash = hashFramebuffer(fb);
+    if (capture->has_last && hash == capture->last_hash) return;
+
+    // the lock is never held during encoding or I/O
+    pthread_mutex_lock(&capture->lock);
+    while (capture->lossless && capture->head - capture->tail == CAPTURE_QUEUE)
+        pthread_cond_wait(&capture->room, &capture->lock);
+    bool full = capture->head - capture->tail == CAPTURE_QUEUE;
+    pthread_mutex_unlock(&capture->lock);
+
+    // a dropped frame leaves the last hash as it was, so the next change gets queued
+    if (full) {
+        capture->dropped++;
+        return;
+    }
+
+    QUEUED_FRAME* frame = &capture->queue[capture->head % CAPTURE_QUEUE];
+    frame->fb = *fb;
+    frame->tick = tick;
+    capture->last_hash = hash;
+    capture->has_last = true;
+
+    pthread_mutex_lock(&capture->lock);
+    capture->head++;
+    pthread_cond_signal(&capture->ready);
+    pthread_mutex_unlock(&capture->lock);
+}
+
+bool closeCapture(CAPTURE* capture, CAPTURE_STATS* stats) {
+    pthread_mutex_lock(&capture->lock);
+    capture->closing = true;
+    pthread_cond_signal(&capture->ready);
+    pthread_mutex_unlock(&capture->lock);
+    pthread_join(capture->writer, NULL);
+
+    // the last frame lasts until the end of the capture
+    if (capture->format == CAPTURE_RAW) {
+        putVarint(&capture->out, capture->ticks - capture->last_tick);
+        putByte(&capture->out, RAW_END);
+        flushOutput(capture, capture->file);
+    } else if (capture->format == CAPTURE_GIF) {
+        flushGifFrame(capture, capture->ticks);
+        putByte(&capture->out, 0x3B);
+        flushOutput(capture, capture->file);
+    }
+
+    bool ok = !capture->failed;
+    if (capture->file != NULL && fclose(capture->file) != 0) ok = false;
+    capture->file = NULL;
+
+    if (stats != NULL) {
+        stats->frames = capture->ticks;
+        stats->written = capture->written;
+        stats->dropped = capture->dropped;
+    }
+
+    pthread_cond_destroy(&capture->room);
+    pthread_cond_destroy(&capture->ready);
+    pthread_mutex_destroy(&capture->lock);
+    freeCapture(capture);
+    return ok;
+}
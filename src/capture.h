@@ -0,0 +1,38 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "framebuffer.h"
+
+// headless capture of the displayed frames into a file, encoded and written on a background thread
+// a frame with the same hashFramebuffer as the previous one is only counted (a still screen costs no I/O)
+typedef struct capture_ CAPTURE;
+
+// formats
+#define CAPTURE_RAW 0 // one stream of 1 bpp frames, run-length coded XOR deltas against the previous frame (.c8v)
+#define CAPTURE_PNG 1 // one PNG per changed frame, named <path without .png>-<frame>.png
+#define CAPTURE_GIF 2 // one animated GIF, each changed frame lasting until the next one
+
+typedef struct capture_stats_ {
+    uint64_t frames; // captureFrame calls
+    uint64_t written; // changed frames encoded
+    uint64_t dropped; // changed frames lost because the writer was behind
+} CAPTURE_STATS;
+
+// the format of a file name from its extension (-1 if none matches)
+int getCaptureFormat(const char* path);
+
+// frame_hz: rate of the captureFrame calls (for timestamps and GIF delays)
+// palette: colors by set of planes (NULL for the display's), lossless: wait for the writer instead of dropping frames
+// returns NULL (with errno set) if the file can't be created or the writer can't start
+CAPTURE* createCapture(const char* path, int format, uint32_t frame_hz, const uint32_t* palette, bool lossless);
+
+// the frame displayed this tick (copied, so the caller can go on right away)
+void captureFrame(CAPTURE* capture, const FRAMEBUFFER* fb);
+
+// writes out the queued frames and finishes the file, returns false if a write failed (stats can be NULL)
+bool closeCapture(CAPTURE* capture, CAPTURE_STATS* stats);
+
+#endif
@@ -5,7 +5,7 @@
 #include <errno.h>
 
 #include "chip8.h"
-#include "display.h"
+#include "chip8_internal.h"
 
 #define X   0x0f00
 #define Y   0x00f0
@@ -13,419 +13,982 @@
 #define NN  0x00ff
 #define NNN 0x0fff
 
-#define MEMORY_SIZE 4096
+const FRAMEBUFFER* getFramebuffer(CHIP8* chip8) {
+    return &chip8->framebuffer;
+}
 
-/*
- THIS IS RELATED TO SOME AMBIGUOUS INSTRUCTIONS (QUIRKS)
- 0: THE OLD WAY
- 1: THE MODERN WAY
-*/
-#define SHIFT_MODE 0
-#define FLAG_RESET 0
-#define IDX_MODE 0
-#define JUMP_MODE 0
+bool needsToDraw(CHIP8* chip8) {
+    return chip8->needs_to_draw;
+}
 
-const int commands[16] = {SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A, SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z,SDL_SCANCODE_C, SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V};
+void markDrawn(CHIP8* chip8) {
+    chip8->needs_to_draw = false;
+}
 
-struct chip8_ {
-    // 4kb memory
-    uint8_t memory[4096];
+bool waitingForKey(CHIP8* chip8) {
+    return chip8->waiting_key;
+}
 
-    // stack (64 bytes)
-    uint16_t stack[32];
+bool hasEnded(CHIP8* chip8) {
+    return chip8->ended;
+}
 
-    // display with monocromatic color (0 or 1)
-    DISPLAY* display;
-    
-    // special registers
-    uint16_t pc, idx;
-    uint8_t sp; // points to a position in the stack array
-    uint8_t delay_timer, sound_timer;
+void setKeyState(CHIP8* chip8, uint8_t key, bool pressed) {
+    uint16_t bit = 1 << (key & 0xf);
+    bool was_pressed = chip8->keys & bit;
 
-    // general-purpose registers (v[15] is the flag register)
-    uint8_t v[16];
- 
-    bool waiting_key, needs_to_draw; 
-    uint8_t key_register;
-};
+    if (pressed) chip8->keys |= bit;
+    else chip8->keys &= ~bit;
 
-void drawDisplay(CHIP8* chip8) {
-    updateDisplay(chip8->display);
-    chip8->needs_to_draw = false;
+    // FX0A finishes when a key is released
+    if (chip8->waiting_key && was_pressed && !pressed) {
+        chip8->v[chip8->key_register] = key & 0xf;
+        chip8->waiting_key = false;
+    }
 }
 
-bool needsToDraw(CHIP8* chip8) {
-    return chip8->needs_to_draw;
+void setKeys(CHIP8* chip8, uint16_t mask) {
+    uint16_t changed = chip8->keys ^ mask;
+    for(int i = 0; i < 16; i++) {
+        if (changed & (1 << i)) setKeyState(chip8, i, mask & (1 << i));
+    }
 }
 
-bool waitingForKey(CHIP8* chip8) {
-    return chip8->waiting_key;
+uint16_t getKeys(CHIP8* chip8) {
+    return chip8->keys;
+}
+
+uint64_t getCycleCount(CHIP8* chip8) {
+    return chip8->cycles;
+}
+
+void getRegisters(CHIP8* chip8, REGISTERS* regs) {
+    memcpy(regs->v, chip8->v, sizeof(regs->v));
+    regs->pc = chip8->pc;
+    regs->idx = chip8->idx;
+    regs->sp = chip8->sp;
+    regs->delay_timer = chip8->delay_timer;
+    regs->sound_timer = chip8->sound_timer;
+}
+
+/*
+    DECODE CACHE
+*/
+
+// marks the entries overlapping [addr, addr+len) as stale (an instruction at addr-1 also reads addr)
+void invalidateDecodeCache(CHIP8* chip8, uint16_t addr, uint16_t len) {
+    for(int i = -1; i < len; i++) {
+        chip8->decode_cache[(addr+i) & chip8->memory_mask].generation = 0;
+    }
+
+    if (chip8->jit != NULL) invalidateJit(chip8->jit, addr, len);
+}
+
+// marks every entry as stale in O(1) (only wraps the whole table once every 65535 flushes)
+void flushDecodeCache(CHIP8* chip8) {
+    chip8->cache_generation++;
+    if (chip8->cache_generation == 0) {
+        memset(chip8->decode_cache, 0, (chip8->memory_mask+1)*sizeof(DECODED));
+        chip8->cache_generation = 1;
+    }
+
+    if (chip8->jit != NULL) flushJit(chip8->jit);
 }
 
-void handleKeyPressed(CHIP8* chip8, SDL_Event* event) {
-    if ((*event).type == SDL_KEYUP) {
-        SDL_Scancode sc = (*event).key.keysym.scancode;
-        //printf("Scancode: %d (%s)\n", sc, SDL_GetScancodeName(sc));
-        for(int i = 0; i < 16; i++) {
-            if (commands[i] == sc) {
-                chip8->v[chip8->key_register] = i;
-                break;
+/*
+    INSTRUCTION HANDLERS (PC already points to the next instruction)
+*/
+
+// skips the instruction at PC (XO-CHIP: F000 NNNN is 4 bytes long)
+static inline void skipInstruction(CHIP8* chip8) {
+    uint16_t pc = chip8->pc & chip8->memory_mask;
+    bool long_instruction = chip8->memory[pc] == 0xF0 && chip8->memory[(pc+1) & chip8->memory_mask] == 0x00;
+    chip8->pc += long_instruction ? 4 : 2;
+}
+
+// XORs a rows x sprite_width sprite from idx into every selected plane (the planes take consecutive sprites)
+static inline void drawSprite(CHIP8* chip8, const DECODED* op, int rows, int sprite_width, bool wrap) {
+    FRAMEBUFFER* fb = &chip8->framebuffer;
+    int x_coord = chip8->v[op->x] & (fb->width-1);
+    int y_coord = chip8->v[op->y] & (fb->height-1);
+    int row_bytes = sprite_width / 8;
+
+    bool collision = false;
+    uint16_t addr = chip8->idx;
+    for(int p = 0; p < DISPLAY_PLANES; p++) {
+        if (!(chip8->planes & (1 << p))) continue;
+
+        for(int i = 0; i < rows; i++) {
+            // rows past the bottom edge are clipped (or wrap around to the top)
+            int y = y_coord + i;
+            if (y >= fb->height) {
+                if (!wrap) break;
+                y -= fb->height;
             }
+
+            uint16_t sprite = chip8->memory[(addr + i*row_bytes) & chip8->memory_mask];
+            if (row_bytes == 2) sprite = (sprite << 8) | chip8->memory[(addr + i*2 + 1) & chip8->memory_mask];
+            collision |= xorSpriteRow(fb, p, x_coord, y, sprite, sprite_width, wrap);
         }
+        addr += rows*row_bytes;
     }
+    chip8->v[15] = collision;
 
-    chip8->waiting_key = false;
+    chip8->needs_to_draw = true;
+    chip8->events |= EVENT_DRAW;
 }
 
-void processNextInstruction(CHIP8* chip8) {
-    // get the instrucion pointed by PC
-    uint16_t inst = (chip8->memory[chip8->pc] << 8)|(chip8->memory[chip8->pc+1]);
+static void opNOP(CHIP8* chip8, const DECODED* op) {
+    // unknown / ignored instruction
+}
 
-    // program has ended
-    if (inst == 0) {
-        SDL_Event quit_event;
-        quit_event.type = SDL_QUIT;
-        SDL_PushEvent(&quit_event);
-        return;
+static void opHALT(CHIP8* chip8, const DECODED* op) {
+    // 0000 - program has ended (the fetch is undone, the instruction is not counted)
+    chip8->pc -= 2;
+    chip8->cycles--;
+    chip8->ended = true;
+    chip8->events |= EVENT_HALT;
+}
+
+static void op00E0(CHIP8* chip8, const DECODED* op) {
+    // 00E0 - clear the display (sets all the pixels of the selected planes to 0)
+    clearPlanes(&chip8->framebuffer, chip8->planes);
+    chip8->needs_to_draw = true;
+    chip8->events |= EVENT_DRAW;
+}
+
+static void op00EE(CHIP8* chip8, const DECODED* op) {
+    // 00EE - pops stack and sets pc to it (the stack is circular, so an unbalanced ROM can't write outside it)
+    chip8->pc = chip8->stack[chip8->sp & (STACK_SIZE-1)];
+    chip8->sp++;
+}
+
+static void op1NNN(CHIP8* chip8, const DECODED* op) {
+    // 1NNN - sets PC to NNN
+    uint16_t from = chip8->pc - 2;
+    chip8->pc = op->nnn;
+
+    // a short jump back may close an idle loop (runCycles checks it)
+    if ((uint16_t) (from - op->nnn) < IDLE_LOOP_BYTES) {
+        chip8->loop_jump = from;
+        chip8->events |= EVENT_LOOP;
     }
+}
 
-    //printf("pc: %d; inst: %04X\n", chip8->pc, inst);
-    chip8->pc += 2; // update PC
+static void op1NNNBusy(CHIP8* chip8, const DECODED* op) {
+    // 1NNN - same, closing a loop already found not to be idle (until its entry is decoded again)
+    chip8->pc = op->nnn;
+}
 
-    uint16_t optype = 0xf000  & inst;
-    optype >>= 12;
+static void op2NNN(CHIP8* chip8, const DECODED* op) {
+    // 2NNN - calls the subroutine at NNN, pushing the current PC to the stack
+    chip8->sp--;
+    chip8->stack[chip8->sp & (STACK_SIZE-1)] = chip8->pc;
+    chip8->pc = op->nnn;
+}
 
-    uint8_t x = (inst & X) >> 8;
-    uint8_t y = (inst & Y) >> 4;
-    uint8_t n = (inst & N);
-    uint8_t nn = (inst & NN);
-    uint16_t nnn = (inst & NNN);
+static void op3XNN(CHIP8* chip8, const DECODED* op) {
+    // 3XNN - skips one instruction if register v[X] is equal to NN
+    if (chip8->v[op->x] == op->nn) chip8->pc += 2;
+}
 
-    switch (optype) {
-        case 0x0:
-            switch (nnn) {
-                case 0x0EE: 
-                    // 00EE - pops stack and sets pc to it
-                    chip8->pc = chip8->stack[chip8->sp];
-                    chip8->sp++;
-                    break;
-                case 0x0E0:
-                    // 00E0 - clear the display (sets all the pixels to 0)
-                    cleanDisplay(chip8->display);
-                    chip8->needs_to_draw = true;
-                    break;
-                default:
-                    break;
-            }
+static void op3XNNLong(CHIP8* chip8, const DECODED* op) {
+    // 3XNN (xo-chip) - same, skipping F000 NNNN as a whole
+    if (chip8->v[op->x] == op->nn) skipInstruction(chip8);
+}
 
-            break;
-        
-        case 0x1:
-            // 1NNN - sets PC to NNN
-            chip8->pc = nnn;
-            break;
+static void op4XNN(CHIP8* chip8, const DECODED* op) {
+    // 4XNN - skips one instruction if register v[X] is NOT equal to NN
+    if (chip8->v[op->x] != op->nn) chip8->pc += 2;
+}
 
-        case 0x2:
-            // 2NNN - calls the subroutine at NNN, pushing the current PC to the stack
-            chip8->sp--;
-            chip8->stack[chip8->sp] = chip8->pc;
-            chip8->pc = nnn;
-            break;
+static void op4XNNLong(CHIP8* chip8, const DECODED* op) {
+    // 4XNN (xo-chip) - same, skipping F000 NNNN as a whole
+    if (chip8->v[op->x] != op->nn) skipInstruction(chip8);
+}
 
-        case 0x3:
-            // 3XNN - skips one instruction if register v[X] is equal to NN
-            if (chip8->v[x] == nn) chip8->pc += 2;
-            break;
+static void op5XY0(CHIP8* chip8, const DECODED* op) {
+    // 5XY0 - skips one instruction if register v[X] is equal to v[Y]
+    if (chip8->v[op->x] == chip8->v[op->y]) chip8->pc += 2;
+}
 
-        case 0x4:
-            // 4XNN - skips one instruction if register v[X] is NOT equal to NN
-            if (chip8->v[x] != nn) chip8->pc += 2;
-            break;
+static void op5XY0Long(CHIP8* chip8, const DECODED* op) {
+    // 5XY0 (xo-chip) - same, skipping F000 NNNN as a whole
+    if (chip8->v[op->x] == chip8->v[op->y]) skipInstruction(chip8);
+}
 
-        case 0x5:
-            // 5XY0 - skips one instruction if register v[X] is equal to v[Y]
-            if (chip8->v[x] == chip8->v[y]) chip8->pc += 2;
-            break;
+static void op6XNN(CHIP8* chip8, const DECODED* op) {
+    // 6XNN - sets the register v[X] to NN 
+    chip8->v[op->x] = op->nn;
+}
 
-        case 0x6:
-            // 6XNN - sets the register v[X] to NN 
-            chip8->v[x] = nn;
-            break;
+static void op7XNN(CHIP8* chip8, const DECODED* op) {
+    // 7XNN - adds the value NN to v[X] (carry flag is not affected)
+    chip8->v[op->x] += op->nn;
+}
 
-        case 0x7:
-            // 7XNN - adds the value NN to v[X] (carry flag is not affected)
-            chip8->v[x] += nn;
-            break;
+static void op8XY0(CHIP8* chip8, const DECODED* op) {
+    // 8XY0 - sets v[X] to the value of v[Y]
+    chip8->v[op->x] = chip8->v[op->y];
+}
 
-        case 0x8:
-            switch (n) {
-                case 0x0:
-                    // 8XY0 - sets v[X] to the value of v[Y]
-                    chip8->v[x] = chip8->v[y];
-                    break;
-                
-                case 0x1:
-                    // 8XY1 - sets v[X] = v[X] | v[Y]
-                    chip8->v[x] |= chip8->v[y];
-                    if (FLAG_RESET == 0) chip8->v[15] = 0;
-                    break;
-                
-                case 0x2:
-                    // 8XY2 - sets v[X] = v[X] & v[Y]
-                    chip8->v[x] &= chip8->v[y];
-                    if (FLAG_RESET == 0) chip8->v[15] = 0;
-                    break;
-                
-                case 0x3:
-                    // 8XY3 - sets v[X] = v[X] ^ v[Y]
-                    chip8->v[x] ^= chip8->v[y];
-                    if (FLAG_RESET == 0) chip8->v[15] = 0;
-                    break;
+static void op8XY1(CHIP8* chip8, const DECODED* op) {
+    // 8XY1 - sets v[X] = v[X] | v[Y]
+    chip8->v[op->x] |= chip8->v[op->y];
+}
 
-                case 0x4:
-                    // 8XY4 - sets v[X] = v[X] + v[Y] (if overflow -> flag register is set to 1)
-                    uint16_t res = chip8->v[x] + chip8->v[y];
-                    chip8->v[x] += chip8->v[y];
-                    if (res > 0xff) chip8->v[15] = 1;
-                    else chip8->v[15] = 0;
+static void op8XY1ResetVF(CHIP8* chip8, const DECODED* op) {
+    // 8XY1 (vip) - same, and the flag register is cleared
+    chip8->v[op->x] |= chip8->v[op->y];
+    chip8->v[15] = 0;
+}
 
-                    break;
+static void op8XY2(CHIP8* chip8, const DECODED* op) {
+    // 8XY2 - sets v[X] = v[X] & v[Y]
+    chip8->v[op->x] &= chip8->v[op->y];
+}
 
-                case 0x5:
-                    // 8XY5 - sets v[X] = v[X] - v[Y] (if v[Y] > v[X], flag is 0, otherwise flag is 1)
-                    if (chip8->v[y] > chip8->v[x]) {
-                        chip8->v[x] -= chip8->v[y]; 
-                        chip8->v[15] = 0;
-                    } else {
-                        chip8->v[x] -= chip8->v[y];
-                        chip8->v[15] = 1;
-                    }
-                    
-                    break;
+static void op8XY2ResetVF(CHIP8* chip8, const DECODED* op) {
+    // 8XY2 (vip) - same, and the flag register is cleared
+    chip8->v[op->x] &= chip8->v[op->y];
+    chip8->v[15] = 0;
+}
 
-                case 0x6:
-                    // 8XY6 - if !SHIFT_MODE (v[X] = v[Y]) -> v[x] >>= 1 and sets flag to the bit that was shifted out
-                    if (!SHIFT_MODE) chip8->v[x] = chip8->v[y];
-                    chip8->v[15] = 1&chip8->v[x];
-                    if (x == 15) break;
-                    chip8->v[x] >>= 1;
-                    break;
+static void op8XY3(CHIP8* chip8, const DECODED* op) {
+    // 8XY3 - sets v[X] = v[X] ^ v[Y]
+    chip8->v[op->x] ^= chip8->v[op->y];
+}
 
-                case 0x7:
-                    // 8XY7 - sets v[X] = v[Y] - v[X] (if v[X] > v[Y], flag is 0, otherwise flag is 1)
-                    if (chip8->v[x] > chip8->v[y]) {
-                        chip8->v[x] = chip8->v[y] - chip8->v[x];
-                        chip8->v[15] = 0;
-                    } else {
-                        chip8->v[x] = chip8->v[y] - chip8->v[x];
-                        chip8->v[15] = 1;
-                    }
-                    break;
+static void op8XY3ResetVF(CHIP8* chip8, const DECODED* op) {
+    // 8XY3 (vip) - same, and the flag register is cleared
+    chip8->v[op->x] ^= chip8->v[op->y];
+    chip8->v[15] = 0;
+}
 
-                case 0xE:
-                    // 8XYE - if !SHIFT_MODE (v[X] = v[Y]) -> v[x] <<= 1 and sets flag to the bit that was shifted out
-                    if (!SHIFT_MODE) chip8->v[x] = chip8->v[y];
-                    chip8->v[15] = ((1<<7)&chip8->v[x]) >> 7;
-                    if (x == 15) break;
-                    chip8->v[x] <<= 1;
-                    break;
+static void op8XY4(CHIP8* chip8, const DECODED* op) {
+    // 8XY4 - sets v[X] = v[X] + v[Y] (if overflow -> flag register is set to 1)
+    uint16_t res = chip8->v[op->x] + chip8->v[op->y];
+    chip8->v[op->x] += chip8->v[op->y];
+    if (res > 0xff) chip8->v[15] = 1;
+    else chip8->v[15] = 0;
+}
+
+static void op8XY5(CHIP8* chip8, const DECODED* op) {
+    // 8XY5 - sets v[X] = v[X] - v[Y] (if v[Y] > v[X], flag is 0, otherwise flag is 1)
+    uint8_t flag = chip8->v[op->y] > chip8->v[op->x] ? 0 : 1;
+    chip8->v[op->x] -= chip8->v[op->y];
+    chip8->v[15] = flag;
+}
+
+static void op8XY6(CHIP8* chip8, const DECODED* op) {
+    // 8XY6 - v[X] = v[Y] >> 1 and sets flag to the bit that was shifted out
+    chip8->v[op->x] = chip8->v[op->y];
+    chip8->v[15] = 1&chip8->v[op->x];
+    if (op->x == 15) return;
+    chip8->v[op->x] >>= 1;
+}
+
+static void op8XY6InPlace(CHIP8* chip8, const DECODED* op) {
+    // 8XY6 (schip) - v[X] >>= 1 (v[Y] is ignored)
+    chip8->v[15] = 1&chip8->v[op->x];
+    if (op->x == 15) return;
+    chip8->v[op->x] >>= 1;
+}
+
+static void op8XY7(CHIP8* chip8, const DECODED* op) {
+    // 8XY7 - sets v[X] = v[Y] - v[X] (if v[X] > v[Y], flag is 0, otherwise flag is 1)
+    uint8_t flag = chip8->v[op->x] > chip8->v[op->y] ? 0 : 1;
+    chip8->v[op->x] = chip8->v[op->y] - chip8->v[op->x];
+    chip8->v[15] = flag;
+}
+
+static void op8XYE(CHIP8* chip8, const DECODED* op) {
+    // 8XYE - v[X] = v[Y] << 1 and sets flag to the bit that was shifted out
+    chip8->v[op->x] = chip8->v[op->y];
+    chip8->v[15] = ((1<<7)&chip8->v[op->x]) >> 7;
+    if (op->x == 15) return;
+    chip8->v[op->x] <<= 1;
+}
+
+static void op8XYEInPlace(CHIP8* chip8, const DECODED* op) {
+    // 8XYE (schip) - v[X] <<= 1 (v[Y] is ignored)
+    chip8->v[15] = ((1<<7)&chip8->v[op->x]) >> 7;
+    if (op->x == 15) return;
+    chip8->v[op->x] <<= 1;
+}
+
+static void op9XY0(CHIP8* chip8, const DECODED* op) {
+    // 9XY0 - skips one instruction if register v[X] is NOT equal to v[Y]
+    if (chip8->v[op->x] != chip8->v[op->y]) chip8->pc += 2;
+}
+
+static void op9XY0Long(CHIP8* chip8, const DECODED* op) {
+    // 9XY0 (xo-chip) - same, skipping F000 NNNN as a whole
+    if (chip8->v[op->x] != chip8->v[op->y]) skipInstruction(chip8);
+}
+
+static void opANNN(CHIP8* chip8, const DECODED* op) {
+    // ANNN - sets idx register to NNN
+    chip8->idx = op->nnn;
+}
+
+static void opBNNN(CHIP8* chip8, const DECODED* op) {
+    // BNNN - jumps to address NNN plus v[0]
+    chip8->pc = op->nnn + chip8->v[0];
+}
+
+static void opBXNN(CHIP8* chip8, const DECODED* op) {
+    // BXNN (schip) - jumps to address XNN plus v[X]
+    chip8->pc = op->nnn + chip8->v[op->x];
+}
+
+// xorshift64* step (fast, no shared state between instances)
+static inline uint8_t nextRandom(CHIP8* chip8) {
+    uint64_t s = chip8->rng;
+    s ^= s >> 12;
+    s ^= s << 25;
+    s ^= s >> 27;
+    chip8->rng = s;
+    return (s * 0x2545F4914F6CDD1DULL) >> 56;
+}
+
+static void opCXNN(CHIP8* chip8, const DECODED* op) {
+    // CXNN - generates a random number, ANDs with NN, and puts the result in v[X]
+    chip8->v[op->x] = op->nn & nextRandom(chip8);
+}
+
+static void opDXYN(CHIP8* chip8, const DECODED* op) {
+    // DXYN - draw to the screen (each sprite row is one shift + AND + XOR on a packed row)
+    drawSprite(chip8, op, op->n, 8, false);
+}
+
+static void opDXYNWrap(CHIP8* chip8, const DECODED* op) {
+    // DXYN (xo-chip) - same, but the sprite wraps around the edges instead of being clipped
+    drawSprite(chip8, op, op->n, 8, true);
+}
+
+static void opDXY0(CHIP8* chip8, const DECODED* op) {
+    // DXY0 (schip) - draws a 16x16 sprite
+    drawSprite(chip8, op, 16, 16, false);
+}
+
+static void opDXY0Wrap(CHIP8* chip8, const DECODED* op) {
+    // DXY0 (xo-chip) - same, wrapping around the edges
+    drawSprite(chip8, op, 16, 16, true);
+}
+
+static void opEX9E(CHIP8* chip8, const DECODED* op) {
+    // EX9E - skips one instruction if the key corresponding to the value in v[X] is pressed
+    if (chip8->keys & (1 << (chip8->v[op->x] & 0xf))) chip8->pc += 2;
+}
+
+static void opEX9ELong(CHIP8* chip8, const DECODED* op) {
+    // EX9E (xo-chip) - same, skipping F000 NNNN as a whole
+    if (chip8->keys & (1 << (chip8->v[op->x] & 0xf))) skipInstruction(chip8);
+}
+
+static void opEXA1(CHIP8* chip8, const DECODED* op) {
+    // EXA1 - skips one instruction if the key corresponding to the value in v[X] is NOT pressed
+    if (!(chip8->keys & (1 << (chip8->v[op->x] & 0xf)))) chip8->pc += 2;
+}
+
+static void opEXA1Long(CHIP8* chip8, const DECODED* op) {
+    // EXA1 (xo-chip) - same, skipping F000 NNNN as a whole
+    if (!(chip8->keys & (1 << (chip8->v[op->x] & 0xf)))) skipInstruction(chip8);
+}
+
+static void opFX07(CHIP8* chip8, const DECODED* op) {
+    // FX07 - sets v[X] to the current value of the delay timer
+    chip8->v[op->x] = chip8->delay_timer;
+}
+
+static void opFX0A(CHIP8* chip8, const DECODED* op) {
+    // FX0A - waits until a key is pressed and released - sets v[X] to its hex value
+    // (non-blocking: the CPU stalls until setKeyState reports the release)
+    chip8->waiting_key = true;
+    chip8->key_register = op->x;
+    chip8->events |= EVENT_KEY_WAIT;
+}
+
+static void opFX15(CHIP8* chip8, const DECODED* op) {
+    // FX15 - sets the delay timer to the value in v[X]
+    chip8->delay_timer = chip8->v[op->x];
+}
+
+static void opFX18(CHIP8* chip8, const DECODED* op) {
+    // FX18 - sets the sound timer to the value in v[X]
+    if (chip8->sound_timer == 0 && chip8->v[op->x] > 0) chip8->events |= EVENT_SOUND;
+    chip8->sound_timer = chip8->v[op->x];
+}
+
+static void opFX1E(CHIP8* chip8, const DECODED* op) {
+    // FX1E - sets idx = v[X] + idx (flag is set to 1 if idx overflows (> 0x0FFF) - this is ambiguous)
+    chip8->idx += chip8->v[op->x];
+    if (chip8->idx > 0x0FFF) chip8->v[15] = 1;
+}
+
+static void opFX1EKeepVF(CHIP8* chip8, const DECODED* op) {
+    // FX1E - sets idx = v[X] + idx (XO-CHIP: idx above 0x0FFF is normal with 64kb, the flag is left alone)
+    chip8->idx += chip8->v[op->x];
+}
+
+static void opFX29(CHIP8* chip8, const DECODED* op) {
+    // FX29 - sets idx to the address of the hexadecimal character in v[X]
+    uint8_t hex_value = chip8->v[op->x];
+    chip8->idx = FONT_ADDR + hex_value*5;
+}
+
+static void opFX33(CHIP8* chip8, const DECODED* op) {
+    // FX33 - takes the number in v[X] (decimal) and places its digits in idx, idx+1, ...
+    uint8_t decimal_value = chip8->v[op->x];
+    uint8_t digits[3] = {0, 0, 0}; int k = 0;
+
+    while(decimal_value > 0) {
+        uint8_t d = decimal_value%10;
+        decimal_value /= 10;
+        digits[k] = d;
+        k += 1; 
+    }
+
+    int aux = 0;
+    for(int i = 2; i >= 0; i--) {
+        chip8->memory[(chip8->idx+aux) & chip8->memory_mask] = digits[i];
+        aux++;
+    }
+
+    // the digits may overwrite code (self-modifying ROMs)
+    invalidateDecodeCache(chip8, chip8->idx, 3);
+}
+
+static void opFX55KeepIdx(CHIP8* chip8, const DECODED* op) {
+    // FX55 (schip) - stores [v0, v1, ..., vx] in idx, idx+1, ..., idx+x (DONT UPDATE IDX - MODERN WAY)
+    for(int i = 0; i <= op->x; i++) {
+        chip8->memory[(chip8->idx+i) & chip8->memory_mask] = chip8->v[i];
+    }
+
+    // the registers may overwrite code (self-modifying ROMs)
+    invalidateDecodeCache(chip8, chip8->idx, op->x+1);
+}
+
+static void opFX55(CHIP8* chip8, const DECODED* op) {
+    // FX55 - same, and idx ends past the last register (THE OLD WAY)
+    opFX55KeepIdx(chip8, op);
+    chip8->idx += op->x+1;
+}
+
+static void opFX65KeepIdx(CHIP8* chip8, const DECODED* op) {
+    // FX65 (schip) - takes the values stored in idx, idx+1, ... , idx+x and stores in v0, v1, ..., vx (DONT UPDATE IDX - MODERN WAY)
+    for(int i = 0; i <= op->x; i++) {
+        chip8->v[i] = chip8->memory[(chip8->idx+i) & chip8->memory_mask];
+    }
+}
+
+static void opFX65(CHIP8* chip8, const DECODED* op) {
+    // FX65 - same, and idx ends past the last register (THE OLD WAY)
+    opFX65KeepIdx(chip8, op);
+    chip8->idx += op->x+1;
+}
+
+/*
+    SUPER-CHIP / XO-CHIP
+*/
+
+static void op00CN(CHIP8* chip8, const DECODED* op) {
+    // 00CN - scrolls the selected planes down by N pixels
+    scrollDown(&chip8->framebuffer, chip8->planes, op->n);
+    chip8->needs_to_draw = true;
+    chip8->events |= EVENT_DRAW;
+}
+
+static void op00DN(CHIP8* chip8, const DECODED* op) {
+    // 00DN (xo-chip) - scrolls the selected planes up by N pixels
+    scrollUp(&chip8->framebuffer, chip8->planes, op->n);
+    chip8->needs_to_draw = true;
+    chip8->events |= EVENT_DRAW;
+}
+
+static void op00FB(CHIP8* chip8, const DECODED* op) {
+    // 00FB - scrolls the selected planes right by 4 pixels
+    scrollRight(&chip8->framebuffer, chip8->planes, 4);
+    chip8->needs_to_draw = true;
+    chip8->events |= EVENT_DRAW;
+}
+
+static void op00FC(CHIP8* chip8, const DECODED* op) {
+    // 00FC - scrolls the selected planes left by 4 pixels
+    scrollLeft(&chip8->framebuffer, chip8->planes, 4);
+    chip8->needs_to_draw = true;
+    chip8->events |= EVENT_DRAW;
+}
+
+static void op00FD(CHIP8* chip8, const DECODED* op) {
+    // 00FD - exits the interpreter (same as 0000)
+    opHALT(chip8, op);
+}
+
+static void op00FE(CHIP8* chip8, const DECODED* op) {
+    // 00FE - switches to lo-res (64 x 32) and clears the screen
+    setResolution(&chip8->framebuffer, false);
+    chip8->needs_to_draw = true;
+    chip8->events |= EVENT_DRAW;
+}
+
+static void op00FF(CHIP8* chip8, const DECODED* op) {
+    // 00FF - switches to hi-res (128 x 64) and clears the screen
+    setResolution(&chip8->framebuffer, true);
+    chip8->needs_to_draw = true;
+    chip8->events |= EVENT_DRAW;
+}
+
+static void opFX30(CHIP8* chip8, const DECODED* op) {
+    // FX30 - sets idx to the address of the big (8x10) hexadecimal character in v[X]
+    chip8->idx = BIG_FONT_ADDR + (chip8->v[op->x] & 0xf)*10;
+}
+
+static void opFX75(CHIP8* chip8, const DECODED* op) {
+    // FX75 - saves v0, v1, ..., vx to the user flags
+    memcpy(chip8->rpl, chip8->v, op->x+1);
+}
 
+static void opFX85(CHIP8* chip8, const DECODED* op) {
+    // FX85 - loads v0, v1, ..., vx from the user flags
+    memcpy(chip8->v, chip8->rpl, op->x+1);
+}
+
+static void op5XY2(CHIP8* chip8, const DECODED* op) {
+    // 5XY2 (xo-chip) - stores v[X], ..., v[Y] (in either order) in idx, idx+1, ... (idx is not changed)
+    int step = op->x <= op->y ? 1 : -1;
+    int count = abs(op->y - op->x) + 1;
+    for(int i = 0; i < count; i++) {
+        chip8->memory[(chip8->idx+i) & chip8->memory_mask] = chip8->v[op->x + i*step];
+    }
+
+    invalidateDecodeCache(chip8, chip8->idx, count);
+}
+
+static void op5XY3(CHIP8* chip8, const DECODED* op) {
+    // 5XY3 (xo-chip) - loads v[X], ..., v[Y] (in either order) from idx, idx+1, ... (idx is not changed)
+    int step = op->x <= op->y ? 1 : -1;
+    int count = abs(op->y - op->x) + 1;
+    for(int i = 0; i < count; i++) {
+        chip8->v[op->x + i*step] = chip8->memory[(chip8->idx+i) & chip8->memory_mask];
+    }
+}
+
+static void opF002(CHIP8* chip8, const DECODED* op) {
+    // F002 (xo-chip) - loads the 16-byte audio pattern from idx, idx+1, ...
+    for(int i = 0; i < AUDIO_PATTERN_SIZE; i++) {
+        chip8->audio_pattern[i] = chip8->memory[(chip8->idx+i) & chip8->memory_mask];
+    }
+}
+
+static void opFX3A(CHIP8* chip8, const DECODED* op) {
+    // FX3A (xo-chip) - sets the pitch the audio pattern is played at to v[X]
+    chip8->pitch = chip8->v[op->x];
+}
+
+static void opF000(CHIP8* chip8, const DECODED* op) {
+    // F000 NNNN (xo-chip) - sets idx to the 16-bit address that follows (read at run time: it may be patched)
+    uint16_t pc = chip8->pc & chip8->memory_mask;
+    chip8->idx = (chip8->memory[pc] << 8) | chip8->memory[(pc+1) & chip8->memory_mask];
+    chip8->pc += 2;
+}
+
+static void opFN01(CHIP8* chip8, const DECODED* op) {
+    // FN01 (xo-chip) - selects the planes drawn to (bit 0: plane 0, bit 1: plane 1)
+    chip8->planes = op->x & ((1 << DISPLAY_PLANES) - 1);
+}
+
+/*
+    DECODER
+*/
+
+// extracts the operands of inst and selects its handler in the profile table (returns the instruction kind)
+INSTRUCTION decodeInstruction(const PROFILE* profile, uint16_t inst, DECODED* op) {
+    uint16_t optype = 0xf000  & inst;
+    optype >>= 12;
+
+    op->x = (inst & X) >> 8;
+    op->y = (inst & Y) >> 4;
+    op->n = (inst & N);
+    op->nn = (inst & NN);
+    op->nnn = (inst & NNN);
+    INSTRUCTION kind = OP_NOP;
+
+    // program has ended
+    if (inst == 0) {
+        op->handler = profile->handlers[OP_HALT];
+        return OP_HALT;
+    }
+
+    switch (optype) {
+        case 0x0:
+            switch (op->nnn) {
+                case 0x0EE: kind = OP_00EE; break;
+                case 0x0E0: kind = OP_00E0; break;
+                case 0x0FB: kind = OP_00FB; break;
+                case 0x0FC: kind = OP_00FC; break;
+                case 0x0FD: kind = OP_00FD; break;
+                case 0x0FE: kind = OP_00FE; break;
+                case 0x0FF: kind = OP_00FF; break;
                 default:
+                    if ((op->nnn & 0xFF0) == 0x0C0) kind = OP_00CN;
+                    if ((op->nnn & 0xFF0) == 0x0D0) kind = OP_00DN;
                     break;
             }
             break;
-
-        case 0x9:
-            // 9XY0 - skips one instruction if register v[X] is NOT equal to v[Y]
-            if (chip8->v[x] != chip8->v[y]) chip8->pc += 2;
+        
+        case 0x1: kind = OP_1NNN; break;
+        case 0x2: kind = OP_2NNN; break;
+        case 0x3: kind = OP_3XNN; break;
+        case 0x4: kind = OP_4XNN; break;
+        case 0x5:
+            if (op->n == 0x2) kind = OP_5XY2;
+            else if (op->n == 0x3) kind = OP_5XY3;
+            else kind = OP_5XY0;
             break;
 
-        case 0xA:
-            // ANNN - sets idx register to NNN
-            chip8->idx = nnn;
-            break;
+        case 0x6: kind = OP_6XNN; break;
+        case 0x7: kind = OP_7XNN; break;
 
-        case 0xB:
-            // BNNN - (ambiguous, implementing the most common way) - jumps to address NNN plus v[0]
-            chip8->pc = nnn + chip8->v[0];
-            if (JUMP_MODE == 1) chip8->pc += chip8->v[x]; 
+        case 0x8:
+            switch (op->n) {
+                case 0x0: kind = OP_8XY0; break;
+                case 0x1: kind = OP_8XY1; break;
+                case 0x2: kind = OP_8XY2; break;
+                case 0x3: kind = OP_8XY3; break;
+                case 0x4: kind = OP_8XY4; break;
+                case 0x5: kind = OP_8XY5; break;
+                case 0x6: kind = OP_8XY6; break;
+                case 0x7: kind = OP_8XY7; break;
+                case 0xE: kind = OP_8XYE; break;
+                default: break;
+            }
             break;
 
-        case 0xC:
-            // CXNN - generates a random number, ANDs with NN, and puts the result in v[X]
-            chip8->v[x] = nn & rand();
+        case 0x9: kind = OP_9XY0; break;
+        case 0xA: kind = OP_ANNN; break;
+        case 0xB: kind = OP_BNNN; break;
+        case 0xC: kind = OP_CXNN; break;
+        case 0xD: kind = op->n == 0 ? OP_DXY0 : OP_DXYN; break;
+        
+        case 0xE:
+            switch(op->nn) {
+                case 0x9E: kind = OP_EX9E; break;
+                case 0xA1: kind = OP_EXA1; break;
+                default: break;
+            }
             break;
+            
+        case 0xF:
+            switch(op->nn) {
+                case 0x07: kind = OP_FX07; break;
+                case 0x0A: kind = OP_FX0A; break;
+                case 0x15: kind = OP_FX15; break;
+                case 0x18: kind = OP_FX18; break;
+                case 0x1E: kind = OP_FX1E; break;
+                case 0x29: kind = OP_FX29; break;
+                case 0x33: kind = OP_FX33; break;
+                case 0x55: kind = OP_FX55; break;
+                case 0x65: kind = OP_FX65; break;
+                case 0x30: kind = OP_FX30; break;
+                case 0x75: kind = OP_FX75; break;
+                case 0x85: kind = OP_FX85; break;
+                case 0x01: kind = OP_FN01; break;
+                case 0x00: if (op->x == 0) kind = OP_F000; break;
+                case 0x02: if (op->x == 0) kind = OP_F002; break;
+                case 0x3A: kind = OP_FX3A; break;
+                default: break;
+            }
+            break;  
+        
+        default:
+            break;
+    }
 
-        case 0xD:
-            // DXYN - draw to the screen (complex)
-            int x_coord = chip8->v[x] & (DISPLAY_WIDTH-1);
-            int y_coord = chip8->v[y] & (DISPLAY_HEIGHT-1);
+    op->handler = profile->handlers[kind];
+    return kind;
+}
 
-            chip8->v[15] = 0;
+/*
+    QUIRK PROFILES
+*/
 
-            for(int i = 0; i < n; i++) {
-                uint8_t sprite = chip8->memory[chip8->idx+i];
+// handlers that behave the same in every profile
+#define COMMON_HANDLERS \
+    [OP_NOP] = opNOP, [OP_HALT] = opHALT, \
+    [OP_00E0] = op00E0, [OP_00EE] = op00EE, [OP_1NNN] = op1NNN, [OP_2NNN] = op2NNN, \
+    [OP_6XNN] = op6XNN, [OP_7XNN] = op7XNN, \
+    [OP_8XY0] = op8XY0, [OP_8XY4] = op8XY4, [OP_8XY5] = op8XY5, [OP_8XY7] = op8XY7, \
+    [OP_ANNN] = opANNN, [OP_CXNN] = opCXNN, \
+    [OP_FX07] = opFX07, [OP_FX0A] = opFX0A, [OP_FX15] = opFX15, [OP_FX18] = opFX18, \
+    [OP_FX29] = opFX29, [OP_FX33] = opFX33
+
+// skips over 2-byte instructions
+#define CLASSIC_SKIPS \
+    [OP_3XNN] = op3XNN, [OP_4XNN] = op4XNN, [OP_5XY0] = op5XY0, [OP_9XY0] = op9XY0, \
+    [OP_EX9E] = opEX9E, [OP_EXA1] = opEXA1
+
+// plain CHIP-8: the extended instructions keep their CHIP-8 meaning (ignored 0NNN, DXY0 draws nothing, 5XYN is 5XY0)
+#define NO_EXTENSIONS \
+    [OP_00CN] = opNOP, [OP_00FB] = opNOP, [OP_00FC] = opNOP, [OP_00FD] = opNOP, [OP_00FE] = opNOP, [OP_00FF] = opNOP, \
+    [OP_DXY0] = opDXYN, [OP_FX30] = opNOP, [OP_FX75] = opNOP, [OP_FX85] = opNOP, \
+    [OP_00DN] = opNOP, [OP_5XY2] = op5XY0, [OP_5XY3] = op5XY0, [OP_F000] = opNOP, [OP_FN01] = opNOP, \
+    [OP_F002] = opNOP, [OP_FX3A] = opNOP
+
+// shared by SUPER-CHIP and XO-CHIP
+#define SCHIP_EXTENSIONS \
+    [OP_00CN] = op00CN, [OP_00FB] = op00FB, [OP_00FC] = op00FC, [OP_00FD] = op00FD, [OP_00FE] = op00FE, [OP_00FF] = op00FF, \
+    [OP_FX30] = opFX30, [OP_FX75] = opFX75, [OP_FX85] = opFX85
+
+static const PROFILE profiles[] = {
+    // COSMAC VIP (the default)
+    {"vip", {.vf_reset = true, .shift_vy = true, .increment_idx = true, .jump_vx = false, .wrap_sprites = false}, MEMORY_SIZE, {
+        COMMON_HANDLERS, CLASSIC_SKIPS, NO_EXTENSIONS,
+        [OP_8XY1] = op8XY1ResetVF, [OP_8XY2] = op8XY2ResetVF, [OP_8XY3] = op8XY3ResetVF,
+        [OP_8XY6] = op8XY6, [OP_8XYE] = op8XYE,
+        [OP_BNNN] = opBNNN, [OP_DXYN] = opDXYN,
+        [OP_FX1E] = opFX1E, [OP_FX55] = opFX55, [OP_FX65] = opFX65
+    }},
+
+    // SUPER-CHIP 1.1
+    {"schip", {.vf_reset = false, .shift_vy = false, .increment_idx = false, .jump_vx = true, .wrap_sprites = false}, MEMORY_SIZE, {
+        COMMON_HANDLERS, CLASSIC_SKIPS, SCHIP_EXTENSIONS,
+        [OP_8XY1] = op8XY1, [OP_8XY2] = op8XY2, [OP_8XY3] = op8XY3,
+        [OP_8XY6] = op8XY6InPlace, [OP_8XYE] = op8XYEInPlace,
+        [OP_BNNN] = opBXNN, [OP_DXYN] = opDXYN, [OP_DXY0] = opDXY0,
+        [OP_FX1E] = opFX1E, [OP_FX55] = opFX55KeepIdx, [OP_FX65] = opFX65KeepIdx,
+        [OP_00DN] = opNOP, [OP_5XY2] = op5XY0, [OP_5XY3] = op5XY0, [OP_F000] = opNOP, [OP_FN01] = opNOP,
+        [OP_F002] = opNOP, [OP_FX3A] = opNOP
+    }},
+
+    // XO-CHIP (Octo)
+    {"xo-chip", {.vf_reset = false, .shift_vy = true, .increment_idx = true, .jump_vx = false, .wrap_sprites = true}, MAX_MEMORY_SIZE, {
+        COMMON_HANDLERS, SCHIP_EXTENSIONS,
+        [OP_3XNN] = op3XNNLong, [OP_4XNN] = op4XNNLong, [OP_5XY0] = op5XY0Long, [OP_9XY0] = op9XY0Long,
+        [OP_EX9E] = opEX9ELong, [OP_EXA1] = opEXA1Long,
+        [OP_8XY1] = op8XY1, [OP_8XY2] = op8XY2, [OP_8XY3] = op8XY3,
+        [OP_8XY6] = op8XY6, [OP_8XYE] = op8XYE,
+        [OP_BNNN] = opBNNN, [OP_DXYN] = opDXYNWrap, [OP_DXY0] = opDXY0Wrap,
+        [OP_FX1E] = opFX1EKeepVF, [OP_FX55] = opFX55, [OP_FX65] = opFX65,
+        [OP_00DN] = op00DN, [OP_5XY2] = op5XY2, [OP_5XY3] = op5XY3, [OP_F000] = opF000, [OP_FN01] = opFN01,
+        [OP_F002] = opF002, [OP_FX3A] = opFX3A
+    }},
+
+    // what most modern ROMs and test suites expect
+    {"modern", {.vf_reset = false, .shift_vy = false, .increment_idx = false, .jump_vx = false, .wrap_sprites = false}, MEMORY_SIZE, {
+        COMMON_HANDLERS, CLASSIC_SKIPS, NO_EXTENSIONS,
+        [OP_8XY1] = op8XY1, [OP_8XY2] = op8XY2, [OP_8XY3] = op8XY3,
+        [OP_8XY6] = op8XY6InPlace, [OP_8XYE] = op8XYEInPlace,
+        [OP_BNNN] = opBNNN, [OP_DXYN] = opDXYN,
+        [OP_FX1E] = opFX1E, [OP_FX55] = opFX55KeepIdx, [OP_FX65] = opFX65KeepIdx
+    }}
+};
 
-                for(int k = 7; k >= 0; k--) {
-                    if (sprite&(1<<k)) {
-                        // TURN OFF pixel color
-                        if (getPixelColor(chip8->display, x_coord, y_coord)) {
-                            changePixelColor(chip8->display, x_coord, y_coord, 0);
-                            chip8->v[15] = 1;
-                        } else { // TURN ON
-                            changePixelColor(chip8->display, x_coord, y_coord, 1);
-                        }
-                    }
+#define PROFILE_COUNT ((int) (sizeof(profiles)/sizeof(profiles[0])))
 
-                    x_coord++;
-                    if (x_coord >= DISPLAY_WIDTH) break;
-                }
+const PROFILE* getProfile(int i) {
+    return i >= 0 && i < PROFILE_COUNT ? &profiles[i] : NULL;
+}
 
-                // return to the beginning of the line
-                x_coord = chip8->v[x] & (DISPLAY_WIDTH-1);
+// memory keeps its contents (XO-CHIP's extra 60kb start zeroed), the decode cache is reallocated with it
+bool applyProfile(CHIP8* chip8, const PROFILE* profile) {
+    if (chip8->profile == profile) return true;
+
+    uint32_t old_size = chip8->profile != NULL ? chip8->memory_mask + 1 : 0;
+    if (profile->memory_size != old_size) {
+        DECODED* cache = (DECODED*) calloc(profile->memory_size, sizeof(DECODED));
+        uint8_t* memory = cache != NULL ? (uint8_t*) realloc(chip8->memory, profile->memory_size) : NULL;
+        if (memory == NULL) {
+            free(cache);
+            return false;
+        }
+        if (profile->memory_size > old_size) memset(&memory[old_size], 0, profile->memory_size - old_size);
 
-                y_coord++;
-                if (y_coord >= DISPLAY_HEIGHT) break;
-            }
-            
-            chip8->needs_to_draw = true;
+        free(chip8->decode_cache);
+        chip8->decode_cache = cache;
+        chip8->cache_generation = 0; // the flush below makes it 1
+        chip8->memory = memory;
+        chip8->memory_mask = profile->memory_size - 1;
+    }
 
-            break;
-        
-        case 0xE:
-            const uint8_t *keystate = SDL_GetKeyboardState(NULL);
-            switch(nn) {
-                case 0x9E:
-                    // EX9E - skips one instruction if the key corresponding to the value in v[X] is pressed
-                    if (keystate[commands[chip8->v[x]]]) chip8->pc += 2;
-                    break;
+    chip8->profile = profile;
+    // instructions decoded / compiled for the old profile are stale
+    flushDecodeCache(chip8);
+    return true;
+}
 
-                case 0xA1:
-                    // EXA1 - skips one instruction if the key corresponding to the value in v[X] is NOT pressed
-                    if (!keystate[commands[chip8->v[x]]]) chip8->pc += 2;
-                    break;
+// selects the quirk profile by name (returns false if there is no such profile or no memory for it)
+bool setQuirkProfile(CHIP8* chip8, const char* name) {
+    for(int i = 0; i < PROFILE_COUNT; i++) {
+        if (strcmp(profiles[i].name, name) == 0) return applyProfile(chip8, &profiles[i]);
+    }
+    return false;
+}
 
-                default:
-                    break;
-            }
+const char* getQuirkProfile(CHIP8* chip8) {
+    return chip8->profile->name;
+}
+
+// name of the i-th profile (NULL past the last one)
+const char* getQuirkProfileName(int i) {
+    return i >= 0 && i < PROFILE_COUNT ? profiles[i].name : NULL;
+}
+
+/*
+    IDLE LOOPS
+ busy waits like "FX07, 3X00, 1NNN" (or a jump to itself) only read the timers, keys and registers,
+ and only write registers with values that can't change before the next timer tick or key change:
+ once a pass leaves the registers as it found them, every further pass is the same until the run ends
+*/
+
+// simulates the instruction at *pc on a copy of the registers (false if it's not allowed in an idle loop)
+static bool idleStep(CHIP8* chip8, uint8_t* v, uint16_t* pc) {
+    uint16_t addr = *pc & chip8->memory_mask;
+    uint16_t inst = (chip8->memory[addr] << 8)|(chip8->memory[(addr+1) & chip8->memory_mask]);
+    uint8_t x = (inst >> 8) & 0xf;
+    uint8_t y = (inst >> 4) & 0xf;
+    uint8_t nn = inst & 0xff;
+    bool skip = false;
+
+    switch (inst >> 12) {
+        case 0x3: skip = v[x] == nn; break;
+        case 0x4: skip = v[x] != nn; break;
+        case 0x5:
+            if ((inst & 0xf) != 0) return false;
+            skip = v[x] == v[y];
+            break;
+        case 0x6: v[x] = nn; break;
+        case 0x9:
+            if ((inst & 0xf) != 0) return false;
+            skip = v[x] != v[y];
+            break;
+        case 0xE:
+            if (nn == 0x9E) skip = chip8->keys & (1 << (v[x] & 0xf));
+            else if (nn == 0xA1) skip = !(chip8->keys & (1 << (v[x] & 0xf)));
+            else return false;
             break;
-            
         case 0xF:
-            switch(nn) {
-                case 0x07:
-                    // FX07 - sets v[X] to the current value of the delay timer
-                    chip8->v[x] = chip8->delay_timer;
-                    break;
+            if (nn != 0x07) return false;
+            v[x] = chip8->delay_timer;
+            break;
+        default:
+            return false;
+    }
 
-                case 0x15:
-                    // FX15 - sets the delay timer to the value in v[X]
-                    chip8->delay_timer = chip8->v[x];
-                    break;
+    *pc += skip ? 4 : 2;
+    return true;
+}
 
-                case 0x18:
-                    // FX18 - sets the sound timer to the value in v[X]
-                    chip8->sound_timer = chip8->v[x];
-                    break;
+// called after a short jump back (PC is the jump target): if the loop is idle, skips as many whole passes
+// as fit in n, leaving the machine exactly where running them would have; returns the cycles left to run
+static uint32_t skipIdleLoop(CHIP8* chip8, uint32_t n) {
+    if (n == 0) return 0;
 
-                case 0x1E:
-                    // FX1E - sets idx = v[X] + idx (flag is set to 1 if idx overflows (> 0x0FFF) - this is ambiguous)
-                    chip8->idx += chip8->v[x];
-                    if (chip8->idx > 0x0FFF) chip8->v[15] = 1;
-                    break;
+    uint16_t start = chip8->pc;
+    uint16_t pc = start;
+    uint8_t v[16];
+    memcpy(v, chip8->v, sizeof(v));
+
+    // one pass, up to the jump back to start
+    uint32_t length = 1;
+    while (true) {
+        uint16_t addr = pc & chip8->memory_mask;
+        uint16_t inst = (chip8->memory[addr] << 8)|(chip8->memory[(addr+1) & chip8->memory_mask]);
+        if (inst == (0x1000 | start)) break;
+
+        if ((uint16_t) (pc - start) >= IDLE_LOOP_BYTES || !idleStep(chip8, v, &pc)) {
+            // the loop does real work: its jump stops asking until the code is decoded again
+            // (if the loop is later rewritten without invalidating the jump, only the skipping is lost)
+            DECODED* jump = &chip8->decode_cache[chip8->loop_jump & chip8->memory_mask];
+            if (jump->handler == op1NNN) jump->handler = op1NNNBusy;
+            return n;
+        }
+        length++;
+    }
 
-                case 0x0A:
-                    // FX0A - blocking instruction until a key is pressed - sets v[X] to its hex value
-
-                    chip8->waiting_key = true;
-                    chip8->key_register = x;
-
-                    SDL_Event event;
-                    while(true) {
-                        if (SDL_WaitEvent(&event)) {
-                            if (event.type == SDL_QUIT) {
-                                SDL_PushEvent(&event);
-                                break;
-                            } else if (event.type == SDL_KEYDOWN) {
-                                SDL_Scancode sc = event.key.keysym.scancode;
-                                //printf("Scancode: %d (%s)\n", sc, SDL_GetScancodeName(sc));
-                                for(int i = 0; i < 16; i++) {
-                                    if (commands[i] == sc) {
-                                        chip8->v[x] = i;
-                                        break;
-                                    }
-                                }
-                                break;
-                            }
-                        }
-                    }
-                    break;
+    // not settled yet (e.g. the first pass after entering the loop): the next jump back checks again
+    if (memcmp(v, chip8->v, sizeof(v)) != 0) return n;
 
-                case 0x29:
-                    // FX29 - sets idx to the address of the hexadecimal character in v[X]
-                    uint8_t hex_value = chip8->v[x];
-                    chip8->idx = hex_value*5;
-                    break;
-                
-                case 0x33:
-                    // FX33 - takes the number in v[X] (decimal) and places its digits in idx, idx+1, ...
-                    uint8_t decimal_value = chip8->v[x];
-                    uint8_t digits[3] = {0, 0, 0}; int k = 0;
-
-                    while(decimal_value > 0) {
-                        uint8_t d = decimal_value%10;
-                        decimal_value /= 10;
-                        digits[k] = d;
-                        k += 1; 
-                    }
-
-                    int aux = 0;
-                    for(int i = 2; i >= 0; i--) {
-                        chip8->memory[chip8->idx+aux] = digits[i];
-                        aux++;
-                    }
+    uint32_t skipped = n / length * length;
+    if (skipped == 0) return n;
 
-                    break;
-                
-                case 0x55:
-                    // FX55 - stores [v0, v1, ..., vx] in idx, idx+1, ..., idx+x (DONT UPDATE IDX - MODERN WAY)
-                    for(int i = 0; i <= x; i++) {
-                        chip8->memory[chip8->idx+i] = chip8->v[i];
-                    }
-                    if (IDX_MODE == 0) chip8->idx += x+1;
-                    break;
-                
-                case 0x65:
-                    // FX65 - takes the values stored in idx, idx+1, ... , idx+x and stores in v0, v1, ..., vx (DONT UPDATE IDX - MODERN WAY)
-                    for(int i = 0; i <= x; i++) {
-                        chip8->v[i] = chip8->memory[chip8->idx+i];
-                    }
-                    if (IDX_MODE == 0) chip8->idx += x+1;
-                    break;
+    chip8->cycles += skipped;
+    chip8->events |= EVENT_IDLE;
+    return n - skipped;
+}
 
-                default:
-                    break;
-            }
-            break;  
-        
-        default:
-            break;
+void processNextInstruction(CHIP8* chip8) {
+    // FX0A is still waiting for a key (the frontend resolves it through setKeyState)
+    if (chip8->waiting_key || chip8->ended) return;
+
+    chip8->events = 0;
+    if (chip8->debugger != NULL) runDebugged(chip8, 1, EVENT_NONE);
+    else if (chip8->profiler != NULL) runProfiled(chip8, 1, EVENT_NONE);
+    else executeInstruction(chip8);
+}
+
+// tight loop: executes up to n instructions, stopping early on the events in stop_on
+// (a key wait or the end of the program always stop the run)
+uint8_t runCycles(CHIP8* chip8, uint32_t n, uint8_t stop_on) {
+    chip8->events = 0;
+    if (chip8->ended) return EVENT_HALT;
+    if (chip8->waiting_key) return EVENT_KEY_WAIT;
+
+    if (chip8->debugger != NULL) return runDebugged(chip8, n, stop_on);
+    if (chip8->profiler != NULL) return runProfiled(chip8, n, stop_on);
+
+    // the recompiler's tables cover 4kb (XO-CHIP always runs on the interpreter)
+    if (chip8->jit != NULL && chip8->memory_mask == MEMORY_SIZE-1) return runJit(chip8, n, stop_on);
+
+    stop_on |= EVENT_KEY_WAIT | EVENT_HALT | EVENT_LOOP;
+    while (n > 0) {
+        executeInstruction(chip8);
+        n--;
+        if (chip8->events & stop_on) {
+            if (!(chip8->events & EVENT_LOOP)) break;
+
+            chip8->events &= ~EVENT_LOOP;
+            n = skipIdleLoop(chip8, n);
+            if (chip8->events & stop_on) break;
+        }
     }
+
+    return chip8->events;
 }
 
+// same as runCycles, but also stops (with EVENT_PREDICATE) as soon as predicate returns true
+uint8_t runUntil(CHIP8* chip8, STOP_PREDICATE predicate, void* data, uint32_t max_cycles, uint8_t stop_on) {
+    chip8->events = 0;
+    if (chip8->ended) return EVENT_HALT;
+    if (chip8->waiting_key) return EVENT_KEY_WAIT;
+
+    stop_on |= EVENT_KEY_WAIT | EVENT_HALT;
+    while (max_cycles > 0) {
+        executeInstruction(chip8);
+        max_cycles--;
+        if (chip8->events & stop_on) break;
+        if (predicate(chip8, data)) {
+            chip8->events |= EVENT_PREDICATE;
+            break;
+        }
+    }
+
+    // the predicate must see every instruction, so idle loops are never skipped here
+    return chip8->events & ~EVENT_LOOP;
+}
 
 void setDefaultFont(CHIP8* chip8);
 
-CHIP8* setupInterpreter(char* file_path) {
-    FILE* f = fopen(file_path, "rb");
-    if (f == NULL) {
-        fprintf(stderr, "ERROR: %s\n", strerror(errno));
-        exit(1);  
-    }
+CHIP8* createInterpreter() {
+    CHIP8* chip8 = (CHIP8*) calloc(1, sizeof(CHIP8));
+    if (chip8 == NULL) return NULL;
 
-    CHIP8* chip8 = (CHIP8*) malloc(sizeof(CHIP8));
-    
-    // create the display
-    chip8->display = createDisplay();
+    // memory and decode cache are sized by the profile
+    if (!applyProfile(chip8, &profiles[0])) {
+        free(chip8);
+        return NULL;
+    }
 
     // write a font for hex values into the beginning of the chip8 memory
     setDefaultFont(chip8);
@@ -439,21 +1002,78 @@ CHIP8* setupInterpreter(char* file_path) {
     // inicialize timers
     chip8->delay_timer = chip8->sound_timer = 0;
 
+    chip8->waiting_key = chip8->needs_to_draw = chip8->ended = false;
 
-    chip8->waiting_key = chip8->needs_to_draw = false;
+    setResolution(&chip8->framebuffer, false);
+    chip8->planes = 1;
 
-    // write the game file into chip8 memory
-    for(int i = 0x200; i < MEMORY_SIZE; i++) {
-        uint8_t data;
-        if (fread(&data, sizeof(uint8_t), 1, f) == 0) {
-            // there's no more data in the file
-            fclose(f);
-            return chip8;
-        }
-        chip8->memory[i] = data;
-    }
+    // until F002 loads a pattern the buzzer is a 500 Hz square wave
+    memset(chip8->audio_pattern, 0xF0, AUDIO_PATTERN_SIZE);
+    chip8->pitch = DEFAULT_PITCH;
+
+    seedRandom(chip8, 0);
 
+    return chip8;
+}
+
+uint64_t randomState(uint64_t seed) {
+    // splitmix64 spreads small seeds over the whole state (and never yields 0 here)
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return z != 0 ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+void seedRandom(CHIP8* chip8, uint64_t seed) {
+    chip8->rng = randomState(seed);
+}
+
+// copies a program image into memory starting at 0x200
+bool loadProgram(CHIP8* chip8, const uint8_t* data, size_t size) {
+    if (size > chip8->memory_mask + 1 - 0x200) return false;
+
+    memcpy(&chip8->memory[0x200], data, size);
+    flushDecodeCache(chip8);
+    return true;
+}
+
+// reads a game file into memory (returns false and keeps errno on failure)
+bool loadRom(CHIP8* chip8, const char* file_path) {
+    FILE* f = fopen(file_path, "rb");
+    if (f == NULL) return false;
+
+    uint8_t* data = (uint8_t*) malloc(MAX_MEMORY_SIZE);
+    if (data == NULL) {
+        fclose(f);
+        return false;
+    }
+    size_t size = fread(data, sizeof(uint8_t), chip8->memory_mask + 1 - 0x200, f);
     fclose(f);
+
+    bool loaded = loadProgram(chip8, data, size);
+    free(data);
+    return loaded;
+}
+
+CHIP8* setupInterpreter(char* file_path, const char* quirks) {
+    CHIP8* chip8 = createInterpreter();
+    if (chip8 == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+
+    // the profile goes first, so XO-CHIP ROMs are loaded into their 64 KB
+    if (quirks != NULL && !setQuirkProfile(chip8, quirks)) {
+        fprintf(stderr, "ERROR: unknown quirk profile \"%s\"\n", quirks);
+        exit(1);
+    }
+
+    if (!loadRom(chip8, file_path)) {
+        fprintf(stderr, "ERROR: %s\n", strerror(errno));
+        exit(1);  
+    }
+
     return chip8;
 }
 
@@ -477,9 +1097,28 @@ void setDefaultFont(CHIP8* chip8) {
         0xF0, 0x80, 0xF0, 0x80, 0x80  // F
     };
 
-    for(int i = 0; i < 80; i++) {
-        chip8->memory[i] = font[i];
-    }
+    // SUPER-CHIP / XO-CHIP 8x10 digits (FX30)
+    uint8_t big_font[160] = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+
+    memcpy(&chip8->memory[FONT_ADDR], font, sizeof(font));
+    memcpy(&chip8->memory[BIG_FONT_ADDR], big_font, sizeof(big_font));
 }
 
 void updateTimers(CHIP8* chip8) {
@@ -493,7 +1132,11 @@ void updateTimers(CHIP8* chip8) {
 }
 
 void freeInterpreter(CHIP8* chip8) {
-    freeDisplay(chip8->display);
+    if (chip8->jit != NULL) freeJit(chip8->jit);
+    if (chip8->profiler != NULL) freeProfiler(chip8->profiler);
+    if (chip8->debugger != NULL) freeDebugger(chip8->debugger);
+    free(chip8->decode_cache);
+    free(chip8->memory);
     free(chip8);
     return;
 }
@@ -503,7 +1146,7 @@ void freeInterpreter(CHIP8* chip8) {
 */
 
 void printMemory(CHIP8* chip8) {
-    for(int i = 0; i < MEMORY_SIZE; i++) {
-        printf("%d: %02X\n", i, chip8->memory[i]);
+    for(uint32_t i = 0; i <= chip8->memory_mask; i++) {
+        printf("%u: %02X\n", i, chip8->memory[i]);
     }
 }
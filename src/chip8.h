@@ -3,21 +3,78 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
-#include <SDL2/SDL.h>
+#include "framebuffer.h"
 
 typedef struct chip8_ CHIP8;
+typedef struct snapshot_ SNAPSHOT;
 
-CHIP8* setupInterpreter(char* file_path);
+// events reported by runCycles / runUntil (bit flags)
+#define EVENT_NONE      0x00
+#define EVENT_DRAW      0x01 // 00E0 or DXYN changed the framebuffer
+#define EVENT_SOUND     0x02 // FX18 started the sound timer
+#define EVENT_KEY_WAIT  0x04 // FX0A is waiting for a key
+#define EVENT_HALT      0x08 // the program has ended
+#define EVENT_PREDICATE 0x10 // the runUntil predicate returned true
+#define EVENT_IDLE      0x20 // runCycles skipped the iterations of an idle loop (nothing changes until a timer tick or key change)
+#define EVENT_BREAK     0x40 // an attached debugger stopped the machine (breakpoint, watchpoint, step or stopMachine)
+
+typedef bool (*STOP_PREDICATE)(CHIP8* chip8, void* data);
+
+// copy of the CPU registers (for dumps and inspection)
+typedef struct registers_ {
+    uint8_t v[16];
+    uint16_t pc, idx;
+    uint8_t sp;
+    uint8_t delay_timer, sound_timer;
+} REGISTERS;
+
+// headless core: no window, no SDL (frontends only read the framebuffer and inject keys)
+CHIP8* createInterpreter();
+bool loadProgram(CHIP8* chip8, const uint8_t* data, size_t size);
+bool loadRom(CHIP8* chip8, const char* file_path);
+CHIP8* setupInterpreter(char* file_path, const char* quirks); // quirks: NULL for the default profile
 void processNextInstruction(CHIP8* chip8);
+uint8_t runCycles(CHIP8* chip8, uint32_t n, uint8_t stop_on);
+uint8_t runUntil(CHIP8* chip8, STOP_PREDICATE predicate, void* data, uint32_t max_cycles, uint8_t stop_on);
+uint64_t getCycleCount(CHIP8* chip8);
+void getRegisters(CHIP8* chip8, REGISTERS* regs);
 void updateTimers(CHIP8* chip8);
 void freeInterpreter(CHIP8* chip8);
 
-void drawDisplay(CHIP8* chip8);
+// quirk profiles: "vip" (default), "schip", "xo-chip", "modern" (returns false for unknown names)
+bool setQuirkProfile(CHIP8* chip8, const char* name);
+const char* getQuirkProfile(CHIP8* chip8);
+const char* getQuirkProfileName(int i);
+
+// CXNN draws from a per-instance generator: the same seed, ROM and input give the same run
+void seedRandom(CHIP8* chip8, uint64_t seed);
+
+// in-memory snapshots: createSnapshot allocates once, take / restore only copy (a few KB)
+SNAPSHOT* createSnapshot();
+void takeSnapshot(CHIP8* chip8, SNAPSHOT* snapshot);
+bool restoreSnapshot(CHIP8* chip8, const SNAPSHOT* snapshot); // false if out of memory
+void freeSnapshot(SNAPSHOT* snapshot);
+
+// save states: versioned little-endian binary format of getStateSize() bytes
+size_t getStateSize(CHIP8* chip8);
+void writeState(CHIP8* chip8, uint8_t* buffer);
+bool readState(CHIP8* chip8, const uint8_t* buffer, size_t size);
+bool saveState(CHIP8* chip8, const char* file_path);
+bool loadState(CHIP8* chip8, const char* file_path);
+
+const FRAMEBUFFER* getFramebuffer(CHIP8* chip8);
 bool needsToDraw(CHIP8* chip8);
+void markDrawn(CHIP8* chip8);
 bool waitingForKey(CHIP8* chip8);
-void handleKeyPressed(CHIP8* chip8, SDL_Event* event);
+bool hasEnded(CHIP8* chip8);
+
+// keypad (key is the hex value 0x0 - 0xF, bit k of the mask is key k)
+void setKeyState(CHIP8* chip8, uint8_t key, bool pressed);
+void setKeys(CHIP8* chip8, uint16_t mask);
+uint16_t getKeys(CHIP8* chip8);
 
 void printMemory(CHIP8* chip8);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,211 @@
+#ifndef CHIP8_INTERNAL_H
+#define CHIP8_INTERNAL_H
+
+// machine layout shared by the core modules (not part of the public API)
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "chip8.h"
+
+#define MEMORY_SIZE 4096 // classic CHIP-8 / SUPER-CHIP memory
+#define MAX_MEMORY_SIZE 65536 // XO-CHIP memory
+#define STACK_SIZE 32 // POWER OF TWO
+
+#define FONT_ADDR 0x00
+#define BIG_FONT_ADDR 0x50 // SUPER-CHIP / XO-CHIP 8x10 digits
+#define RPL_FLAGS 16 // FX75 / FX85 user flags
+#define AUDIO_PATTERN_SIZE 16 // XO-CHIP 1-bit audio pattern (128 samples)
+#define DEFAULT_PITCH 64 // FX3A value that plays the pattern at 4000 samples per second
+
+// internal event: a short backward jump may have closed an idle loop (never returned to clients)
+#define EVENT_LOOP 0x80
+#define IDLE_LOOP_BYTES 16 // longest loop (closing jump included) checked for idling
+
+typedef struct decoded_ DECODED;
+typedef void (*HANDLER)(CHIP8* chip8, const DECODED* op);
+
+// instruction kinds found by the decoder (index into the handler table of a profile)
+typedef enum instruction_ {
+    OP_NOP, OP_HALT,
+    OP_00E0, OP_00EE, OP_1NNN, OP_2NNN, OP_3XNN, OP_4XNN, OP_5XY0, OP_6XNN, OP_7XNN,
+    OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4, OP_8XY5, OP_8XY6, OP_8XY7, OP_8XYE,
+    OP_9XY0, OP_ANNN, OP_BNNN, OP_CXNN, OP_DXYN, OP_EX9E, OP_EXA1,
+    OP_FX07, OP_FX0A, OP_FX15, OP_FX18, OP_FX1E, OP_FX29, OP_FX33, OP_FX55, OP_FX65,
+    // SUPER-CHIP
+    OP_00CN, OP_00FB, OP_00FC, OP_00FD, OP_00FE, OP_00FF, OP_DXY0, OP_FX30, OP_FX75, OP_FX85,
+    // XO-CHIP
+    OP_00DN, OP_5XY2, OP_5XY3, OP_F000, OP_FN01, OP_F002, OP_FX3A,
+    OP_COUNT
+} INSTRUCTION;
+
+/*
+ THIS IS RELATED TO SOME AMBIGUOUS INSTRUCTIONS (QUIRKS)
+ every profile has its own handler table, so the choice is made once per decoded instruction
+*/
+typedef struct quirks_ {
+    bool vf_reset;       // 8XY1 / 8XY2 / 8XY3 clear v[F]
+    bool shift_vy;       // 8XY6 / 8XYE shift v[Y] into v[X] (otherwise v[X] in place)
+    bool increment_idx;  // FX55 / FX65 leave idx past the last register
+    bool jump_vx;        // BNNN jumps to XNN + v[X] (otherwise NNN + v[0])
+    bool wrap_sprites;   // DXYN wraps sprites around the edges (otherwise clips them)
+} QUIRKS;
+
+// profiles without an extension map its instructions to the same handlers as before (mostly opNOP)
+typedef struct profile_ {
+    const char* name;
+    QUIRKS quirks;
+    uint32_t memory_size; // POWER OF TWO
+    HANDLER handlers[OP_COUNT];
+} PROFILE;
+
+typedef struct jit_ JIT;
+typedef struct profiler_ PROFILER;
+typedef struct debugger_ DEBUGGER;
+
+// predecoded instruction: handler and operands already extracted
+struct decoded_ {
+    HANDLER handler;
+    uint16_t nnn;
+    uint8_t x, y, n, nn;
+    uint16_t generation; // the entry is valid while it matches cache_generation
+};
+
+struct chip8_ {
+    // 4kb memory (64kb for XO-CHIP), addresses are masked with memory_mask
+    uint8_t* memory;
+    uint32_t memory_mask;
+
+    // stack (64 bytes)
+    uint16_t stack[STACK_SIZE];
+
+    // display (64 x 32 or 128 x 64) and the XO-CHIP planes drawn to by 00E0 / DXYN / scrolls
+    FRAMEBUFFER framebuffer;
+    uint8_t planes;
+
+    // SUPER-CHIP / XO-CHIP user flags (FX75 / FX85)
+    uint8_t rpl[RPL_FLAGS];
+
+    // tone played while the sound timer runs: XO-CHIP pattern (F002) and pitch (FX3A), a square wave otherwise
+    uint8_t audio_pattern[AUDIO_PATTERN_SIZE];
+    uint8_t pitch;
+    
+    // special registers
+    uint16_t pc, idx;
+    uint8_t sp; // points to a position in the stack array
+    uint8_t delay_timer, sound_timer;
+
+    // general-purpose registers (v[15] is the flag register)
+    uint8_t v[16];
+ 
+    // per-instance random generator state (xorshift64*, never 0)
+    uint64_t rng;
+
+    // keypad state injected by the frontend (bit k set -> key k is pressed)
+    uint16_t keys;
+
+    bool waiting_key, needs_to_draw, ended; 
+    uint8_t key_register;
+
+    // instructions executed so far and events raised by the current run (EVENT_*)
+    uint64_t cycles;
+    uint8_t events;
+    uint16_t loop_jump; // address of the jump that raised EVENT_LOOP
+
+    // quirk profile: selects the handlers of new decode cache entries
+    const PROFILE* profile;
+
+    // decode cache indexed by PC (one entry per memory address)
+    DECODED* decode_cache;
+    uint16_t cache_generation;
+
+    // optional recompiler, profiler and debugger (NULL when disabled)
+    JIT* jit;
+    PROFILER* profiler;
+    DEBUGGER* debugger;
+};
+
+// copy of the machine state (no caches): what takeSnapshot / restoreSnapshot move around
+// (memory comes last: only the first profile->memory_size bytes of it are used, see snapshotSize)
+struct snapshot_ {
+    const PROFILE* profile;
+
+    uint16_t stack[STACK_SIZE];
+    FRAMEBUFFER framebuffer;
+    uint8_t planes;
+    uint8_t rpl[RPL_FLAGS];
+    uint8_t audio_pattern[AUDIO_PATTERN_SIZE];
+    uint8_t pitch;
+
+    uint16_t pc, idx;
+    uint8_t sp, delay_timer, sound_timer;
+    uint8_t v[16];
+    uint64_t rng;
+
+    uint16_t keys;
+    bool waiting_key, needs_to_draw, ended;
+    uint8_t key_register;
+
+    uint64_t cycles;
+
+    uint8_t memory[MAX_MEMORY_SIZE];
+};
+
+static inline size_t snapshotSize(const SNAPSHOT* snapshot) {
+    return offsetof(SNAPSHOT, memory) + snapshot->profile->memory_size;
+}
+
+// switches profile, resizing memory and the decode cache when needed (false if out of memory)
+bool applyProfile(CHIP8* chip8, const PROFILE* profile);
+const PROFILE* getProfile(int i);
+
+// xorshift64* state for a seed (what seedRandom sets)
+uint64_t randomState(uint64_t seed);
+
+INSTRUCTION decodeInstruction(const PROFILE* profile, uint16_t inst, DECODED* op);
+void invalidateDecodeCache(CHIP8* chip8, uint16_t addr, uint16_t len);
+void flushDecodeCache(CHIP8* chip8);
+
+// returns the decoded instruction at PC, decoding it on a cache miss
+static inline const DECODED* fetchInstruction(CHIP8* chip8) {
+    uint16_t pc = chip8->pc & chip8->memory_mask;
+    DECODED* op = &chip8->decode_cache[pc];
+
+    if (op->generation != chip8->cache_generation) {
+        // get the instrucion pointed by PC
+        uint16_t inst = (chip8->memory[pc] << 8)|(chip8->memory[(pc+1) & chip8->memory_mask]);
+        decodeInstruction(chip8->profile, inst, op);
+        op->generation = chip8->cache_generation;
+    }
+
+    return op;
+}
+
+// executes the instruction pointed by PC (the caller checks waiting_key / ended)
+static inline void executeInstruction(CHIP8* chip8) {
+    const DECODED* op = fetchInstruction(chip8);
+
+    //printf("pc: %d; handler: %p\n", chip8->pc, (void*) op->handler);
+    chip8->pc += 2; // update PC
+    chip8->cycles++;
+
+    op->handler(chip8, op);
+}
+
+// profiler hooks (profiler.c)
+uint8_t runProfiled(CHIP8* chip8, uint32_t n, uint8_t stop_on);
+void freeProfiler(PROFILER* profiler);
+
+// debugger hooks (debugger.c)
+uint8_t runDebugged(CHIP8* chip8, uint32_t n, uint8_t stop_on);
+void freeDebugger(DEBUGGER* debugger);
+
+// recompiler hooks (jit.c)
+uint8_t runJit(CHIP8* chip8, uint32_t n, uint8_t stop_on);
+void invalidateJit(JIT* jit, uint16_t addr, uint16_t len);
+void prewarmJit(JIT* jit, CHIP8* chip8, uint16_t pc);
+void flushJit(JIT* jit);
+void freeJit(JIT* jit);
+
+#endif
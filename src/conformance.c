@@ -0,0 +1,503 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "chip8.h"
+#include "jit.h"
+#include "lockstep.h"
+#include "threadpool.h"
+
+/*
+ chip8-test: conformance run of test ROMs and games against stored golden results
+
+ every ROM runs headlessly under every quirk profile for a fixed cycle budget (fixed seed, scripted input),
+ with the interpreter and, where available, the recompiler; the final registers and packed framebuffer
+ must match the line of the ROM in <golden dir>/<profile>.txt, and the recompiler must match the interpreter
+
+ under the 4 KB profiles the ROM also runs in the lockstep engine, LOCKSTEP_LANES lanes with their own seed and
+ input next to one interpreter each; after every tick each lane must match its interpreter (registers, cycle count,
+ state, draw flag and framebuffer) until it stops at an instruction the engine doesn't handle
+
+ golden line (hex):
+   <rom> <width>x<height> <pc> <idx> <sp> <delay timer> <sound timer> <v0 ... vF> <framebuffer>
+ the framebuffer is every word of the rows of the current resolution, plane 0 then plane 1 (MSB = x 0)
+
+ with -u the golden files are rewritten from the ROMs given instead
+*/
+
+#define DEFAULT_CYCLES 60000
+#define CYCLES_PER_TICK 12
+#define MAX_PROFILES 8
+#define LINE_SIZE (2*DISPLAY_PLANES*DISPLAY_HEIGHT*ROW_WORDS*16 + 512)
+
+// scripted input: every INPUT_PERIOD ticks the next key is held for INPUT_HOLD ticks (as chip8-bench)
+#define INPUT_PERIOD 30
+#define INPUT_HOLD 10
+
+#define LOCKSTEP_LANES 40 // more than one block of 32 lanes, so the last block is padded
+#define MAX_ROM_SIZE 0x1000 // the lockstep engine only runs 4 KB profiles
+#define ERROR_SIZE 128
+
+typedef struct run_ {
+    REGISTERS regs;
+    FRAMEBUFFER fb;
+} RUN;
+
+typedef struct job_result_ {
+    bool loaded;
+    bool jit_checked, jit_matches;
+    bool lockstep_checked;
+    char lockstep_error[ERROR_SIZE]; // the first difference from the interpreter (empty when there was none)
+    RUN run;
+} JOB_RESULT;
+
+typedef struct suite_ {
+    char** roms;
+    int rom_count;
+    int profile_count;
+    uint64_t cycles;
+    JOB_RESULT* results; // rom * profile_count + profile
+} SUITE;
+
+typedef struct golden_ {
+    char** lines; // one per ROM, the name first
+    int count;
+} GOLDEN;
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static const char* romName(const char* path) {
+    const char* name = strrchr(path, '/');
+    return name != NULL ? name + 1 : path;
+}
+
+static uint16_t scriptedKeys(uint64_t tick) {
+    if (tick % INPUT_PERIOD >= INPUT_HOLD) return 0;
+    return 1 << ((tick / INPUT_PERIOD) % 16);
+}
+
+/*
+    RUNS
+*/
+
+// NULL if the ROM can't be loaded
+static CHIP8* startRom(const char* path, const char* profile, uint64_t seed) {
+    // the profile goes first, so XO-CHIP ROMs have their 64 KB
+    CHIP8* chip8 = createInterpreter();
+    if (chip8 == NULL || !setQuirkProfile(chip8, profile) || !loadRom(chip8, path)) {
+        if (chip8 != NULL) freeInterpreter(chip8);
+        return NULL;
+    }
+    seedRandom(chip8, seed);
+    return chip8;
+}
+
+// runs a ROM for the cycle budget (false if it can't be loaded, or the recompiler isn't available)
+static bool runRom(const char* path, const char* profile, int jit_mode, uint64_t cycles, RUN* run) {
+    CHIP8* chip8 = startRom(path, profile, 0);
+    if (chip8 == NULL) return false;
+    if (jit_mode != JIT_OFF && !enableJit(chip8, jit_mode)) {
+        freeInterpreter(chip8);
+        return false;
+    }
+
+    uint64_t ticks = cycles / CYCLES_PER_TICK;
+    for(uint64_t tick = 0; tick < ticks; tick++) {
+        setKeys(chip8, scriptedKeys(tick));
+        uint8_t events = runCycles(chip8, CYCLES_PER_TICK, EVENT_NONE);
+        updateTimers(chip8);
+        if (events & EVENT_HALT) break;
+    }
+
+    getRegisters(chip8, &run->regs);
+    run->fb = *getFramebuffer(chip8);
+    freeInterpreter(chip8);
+    return true;
+}
+
+static bool sameRun(const RUN* a, const RUN* b) {
+    return memcmp(&a->regs, &b->regs, sizeof(REGISTERS)) == 0 &&
+        a->fb.width == b->fb.width && a->fb.height == b->fb.height &&
+        hashFramebuffer(&a->fb) == hashFramebuffer(&b->fb);
+}
+
+static int interpreterState(CHIP8* chip8) {
+    if (hasEnded(chip8)) return LANE_ENDED;
+    return waitingForKey(chip8) ? LANE_WAITING : LANE_RUNNING;
+}
+
+// what differs between a lane and its interpreter (NULL if nothing)
+static const char* compareLane(LOCKSTEP* lockstep, int lane, CHIP8* chip8) {
+    REGISTERS lane_regs, regs;
+    getLaneRegisters(lockstep, lane, &lane_regs);
+    getRegisters(chip8, &regs);
+    if (memcmp(&lane_regs, &regs, sizeof(REGISTERS)) != 0) return "registers";
+    if (getLaneCycles(lockstep, lane) != getCycleCount(chip8)) return "cycle count";
+    if (getLaneState(lockstep, lane) != interpreterState(chip8)) return "state";
+
+    bool draw = needsToDraw(chip8);
+    markDrawn(chip8);
+    if (laneNeedsToDraw(lockstep, lane) != draw) return "draw flag";
+
+    FRAMEBUFFER fb;
+    getLaneFramebuffer(lockstep, lane, &fb);
+    const FRAMEBUFFER* expected = getFramebuffer(chip8);
+    if (fb.width != expected->width || fb.height != expected->height || hashFramebuffer(&fb) != hashFramebuffer(expected)) return "framebuffer";
+    return NULL;
+}
+
+// runs the ROM in the lockstep engine next to one interpreter per lane, with the lane as seed and input delay (as chip8-bench)
+// false if the engine can't run it (a 64 KB profile); the first difference goes to error (empty if none)
+static bool checkLockstep(const char* path, const char* profile, uint64_t cycles, char* error) {
+    error[0] = '\0';
+
+    uint8_t rom[MAX_ROM_SIZE];
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) return false;
+    size_t size = fread(rom, 1, sizeof(rom), f);
+    fclose(f);
+
+    LOCKSTEP* lockstep = createLockstep(LOCKSTEP_LANES, rom, size, profile);
+    if (lockstep == NULL) return false;
+
+    CHIP8* machines[LOCKSTEP_LANES];
+    bool checking[LOCKSTEP_LANES];
+    int started = 0;
+    for(; started < LOCKSTEP_LANES; started++) {
+        machines[started] = startRom(path, profile, started);
+        if (machines[started] == NULL) break;
+        seedLane(lockstep, started, started);
+        checking[started] = true;
+    }
+
+    uint64_t ticks = cycles / CYCLES_PER_TICK;
+    for(uint64_t tick = 0; started == LOCKSTEP_LANES && tick < ticks && error[0] == '\0'; tick++) {
+        for(int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+            setLaneKeys(lockstep, lane, scriptedKeys(tick + lane));
+            setKeys(machines[lane], scriptedKeys(tick + lane));
+        }
+        runLockstep(lockstep, CYCLES_PER_TICK);
+        tickLockstep(lockstep);
+
+        for(int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+            if (!checking[lane]) continue;
+            runCycles(machines[lane], CYCLES_PER_TICK, EVENT_NONE);
+            updateTimers(machines[lane]);
+
+            // past an instruction the engine doesn't handle, the lane is left behind
+            if (getLaneState(lockstep, lane) == LANE_UNSUPPORTED) {
+                checking[lane] = false;
+                continue;
+            }
+            const char* difference = compareLane(lockstep, lane, machines[lane]);
+            if (difference != NULL) {
+                snprintf(error, ERROR_SIZE, "lane %d, tick %llu: %s", lane, (unsigned long long) tick, difference);
+                break;
+            }
+        }
+    }
+
+    for(int lane = 0; lane < started; lane++) freeInterpreter(machines[lane]);
+    freeLockstep(lockstep);
+    return started == LOCKSTEP_LANES;
+}
+
+void runJob(int index, void* data) {
+    SUITE* suite = (SUITE*) data;
+    JOB_RESULT* result = &suite->results[index];
+    const char* rom = suite->roms[index / suite->profile_count];
+    const char* profile = getQuirkProfileName(index % suite->profile_count);
+
+    result->loaded = runRom(rom, profile, JIT_OFF, suite->cycles, &result->run);
+    if (!result->loaded) return;
+
+    RUN jit_run;
+    result->jit_checked = runRom(rom, profile, JIT_ON, suite->cycles, &jit_run);
+    result->jit_matches = !result->jit_checked || sameRun(&result->run, &jit_run);
+
+    result->lockstep_checked = checkLockstep(rom, profile, suite->cycles, result->lockstep_error);
+}
+
+/*
+    GOLDEN FILES
+*/
+
+// a golden line without the trailing newline
+static void formatRun(char* out, const char* name, const RUN* run) {
+    const REGISTERS* r = &run->regs;
+    out += sprintf(out, "%s %ux%u %04x %04x %02x %02x %02x ", name, run->fb.width, run->fb.height,
+                   r->pc, r->idx, r->sp, r->delay_timer, r->sound_timer);
+    for(int i = 0; i < 16; i++) out += sprintf(out, "%02x", r->v[i]);
+    *out++ = ' ';
+
+    int words = run->fb.width / 64;
+    for(int p = 0; p < DISPLAY_PLANES; p++) {
+        for(int y = 0; y < run->fb.height; y++) {
+            for(int w = 0; w < words; w++) out += sprintf(out, "%016llx", (unsigned long long) run->fb.rows[p][y][w]);
+        }
+    }
+}
+
+// the inverse of formatRun (false if the line is malformed)
+static bool parseRun(const char* line, RUN* run) {
+    memset(run, 0, sizeof(RUN));
+
+    unsigned int width, height, pc, idx, sp, dt, st;
+    int used;
+    const char* fields = strchr(line, ' ');
+    if (fields == NULL || sscanf(fields, " %ux%u %x %x %x %x %x %n", &width, &height, &pc, &idx, &sp, &dt, &st, &used) != 7) return false;
+    if (!((width == LORES_WIDTH && height == LORES_HEIGHT) || (width == DISPLAY_WIDTH && height == DISPLAY_HEIGHT))) return false;
+
+    run->regs.pc = pc;
+    run->regs.idx = idx;
+    run->regs.sp = sp;
+    run->regs.delay_timer = dt;
+    run->regs.sound_timer = st;
+    run->fb.width = width;
+    run->fb.height = height;
+
+    const char* c = fields + used;
+    for(int i = 0; i < 16; i++) {
+        unsigned int v;
+        if (sscanf(c, "%2x", &v) != 1) return false;
+        run->regs.v[i] = v;
+        c += 2;
+    }
+    if (*c++ != ' ') return false;
+
+    int words = width / 64;
+    char word[17] = {0};
+    for(int p = 0; p < DISPLAY_PLANES; p++) {
+        for(int y = 0; y < (int) height; y++) {
+            for(int w = 0; w < words; w++) {
+                if (strlen(c) < 16) return false;
+                memcpy(word, c, 16);
+                run->fb.rows[p][y][w] = strtoull(word, NULL, 16);
+                c += 16;
+            }
+        }
+    }
+    return *c == '\0';
+}
+
+// a missing file is an empty golden set
+static void loadGolden(GOLDEN* golden, const char* path) {
+    memset(golden, 0, sizeof(GOLDEN));
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        if (errno != ENOENT) fprintf(stderr, "WARNING: %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    int capacity = 64;
+    golden->lines = (char**) malloc(capacity * sizeof(char*));
+
+    char* buffer = (char*) malloc(LINE_SIZE);
+    while (fgets(buffer, LINE_SIZE, f) != NULL) {
+        buffer[strcspn(buffer, "\r\n")] = '\0';
+        if (buffer[0] == '\0' || buffer[0] == '#') continue;
+
+        if (golden->count == capacity) {
+            capacity *= 2;
+            golden->lines = (char**) realloc(golden->lines, capacity * sizeof(char*));
+        }
+        golden->lines[golden->count++] = strdup(buffer);
+    }
+
+    free(buffer);
+    fclose(f);
+}
+
+static const char* findGolden(const GOLDEN* golden, const char* name) {
+    size_t length = strlen(name);
+    for(int i = 0; i < golden->count; i++) {
+        if (strncmp(golden->lines[i], name, length) == 0 && golden->lines[i][length] == ' ') return golden->lines[i];
+    }
+    return NULL;
+}
+
+static void freeGolden(GOLDEN* golden) {
+    for(int i = 0; i < golden->count; i++) free(golden->lines[i]);
+    free(golden->lines);
+}
+
+static bool writeGolden(const char* path, SUITE* suite, int profile) {
+    FILE* f = fopen(path, "w");
+    if (f == NULL) return false;
+
+    char* line = (char*) malloc(LINE_SIZE);
+    fprintf(f, "# chip8-test golden results (%s): rom, resolution, pc, idx, sp, dt, st, v0-vF, framebuffer\n",
+            getQuirkProfileName(profile));
+    for(int i = 0; i < suite->rom_count; i++) {
+        JOB_RESULT* result = &suite->results[i * suite->profile_count + profile];
+        if (!result->loaded) continue;
+        formatRun(line, romName(suite->roms[i]), &result->run);
+        fprintf(f, "%s\n", line);
+    }
+    free(line);
+
+    return fclose(f) == 0;
+}
+
+/*
+    REPORT
+*/
+
+// what differs between the golden run and this one
+static void describeMismatch(const RUN* expected, const RUN* actual) {
+    const REGISTERS* e = &expected->regs;
+    const REGISTERS* a = &actual->regs;
+
+    if (e->pc != a->pc) printf("    pc: expected %04x, got %04x\n", e->pc, a->pc);
+    if (e->idx != a->idx) printf("    idx: expected %04x, got %04x\n", e->idx, a->idx);
+    if (e->sp != a->sp) printf("    sp: expected %02x, got %02x\n", e->sp, a->sp);
+    if (e->delay_timer != a->delay_timer) printf("    dt: expected %02x, got %02x\n", e->delay_timer, a->delay_timer);
+    if (e->sound_timer != a->sound_timer) printf("    st: expected %02x, got %02x\n", e->sound_timer, a->sound_timer);
+    for(int i = 0; i < 16; i++) {
+        if (e->v[i] != a->v[i]) printf("    v%X: expected %02x, got %02x\n", i, e->v[i], a->v[i]);
+    }
+
+    if (expected->fb.width != actual->fb.width) {
+        printf("    resolution: expected %ux%u, got %ux%u\n", expected->fb.width, expected->fb.height,
+               actual->fb.width, actual->fb.height);
+        return;
+    }
+
+    int pixels = 0, first_x = -1, first_y = -1;
+    for(int y = 0; y < actual->fb.height; y++) {
+        for(int x = 0; x < actual->fb.width; x++) {
+            if (getPixelColor(&expected->fb, x, y) == getPixelColor(&actual->fb, x, y)) continue;
+            if (pixels++ == 0) {
+                first_x = x;
+                first_y = y;
+            }
+        }
+    }
+    if (pixels > 0) printf("    framebuffer: %d pixels differ (first at %d, %d)\n", pixels, first_x, first_y);
+}
+
+void printUsage(char* program) {
+    fprintf(stderr, "usage: %s [-g golden-dir] [-c cycles] [-j threads] [-u] rom ...\n", program);
+}
+
+int main(int argc, char* argv[]) {
+    const char* golden_dir = "tests/golden";
+    uint64_t cycles = DEFAULT_CYCLES;
+    int threads = getCpuCount();
+    bool update = false;
+
+    char** roms = (char**) malloc(argc * sizeof(char*));
+    int rom_count = 0;
+
+    for(int i = 1; i < argc; i++) {
+        bool has_value = i+1 < argc;
+
+        if (strcmp(argv[i], "-g") == 0 && has_value) golden_dir = argv[++i];
+        else if (strcmp(argv[i], "-c") == 0 && has_value) cycles = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-j") == 0 && has_value) threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-u") == 0) update = true;
+        else if (argv[i][0] != '-') roms[rom_count++] = argv[i];
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (rom_count == 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    SUITE suite;
+    suite.roms = roms;
+    suite.rom_count = rom_count;
+    suite.cycles = cycles;
+    suite.profile_count = 0;
+    while (suite.profile_count < MAX_PROFILES && getQuirkProfileName(suite.profile_count) != NULL) suite.profile_count++;
+    suite.results = (JOB_RESULT*) calloc(rom_count * suite.profile_count, sizeof(JOB_RESULT));
+
+    double start = now();
+    runParallel(threads, rom_count * suite.profile_count, runJob, &suite);
+    double elapsed = now() - start;
+
+    int passed = 0, failed = 0, skipped = 0, jit_checked = 0, lockstep_checked = 0;
+    char* line = (char*) malloc(LINE_SIZE);
+
+    for(int p = 0; p < suite.profile_count; p++) {
+        const char* profile = getQuirkProfileName(p);
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s.txt", golden_dir, profile);
+
+        if (update) {
+            if (!writeGolden(path, &suite, p)) {
+                fprintf(stderr, "ERROR: %s: %s\n", path, strerror(errno));
+                return 1;
+            }
+        }
+
+        GOLDEN golden;
+        loadGolden(&golden, path);
+
+        for(int i = 0; i < rom_count; i++) {
+            JOB_RESULT* result = &suite.results[i * suite.profile_count + p];
+            const char* name = romName(roms[i]);
+
+            // a ROM too big for the profile's memory
+            if (!result->loaded) {
+                skipped++;
+                continue;
+            }
+
+            if (result->jit_checked) jit_checked++;
+            if (result->lockstep_checked) lockstep_checked++;
+
+            bool ok = true;
+            formatRun(line, name, &result->run);
+            const char* expected_line = findGolden(&golden, name);
+            RUN expected;
+
+            if (expected_line == NULL) {
+                printf("FAIL %s %s: no golden result\n", profile, name);
+                ok = false;
+            } else if (strcmp(expected_line, line) != 0) {
+                printf("FAIL %s %s: differs from the golden result\n", profile, name);
+                if (parseRun(expected_line, &expected)) describeMismatch(&expected, &result->run);
+                else printf("    malformed golden line\n");
+                ok = false;
+            }
+            if (!result->jit_matches) {
+                printf("FAIL %s %s: the recompiler differs from the interpreter\n", profile, name);
+                ok = false;
+            }
+            if (result->lockstep_error[0] != '\0') {
+                printf("FAIL %s %s: the lockstep engine differs from the interpreter (%s)\n", profile, name, result->lockstep_error);
+                ok = false;
+            }
+
+            if (ok) passed++;
+            else failed++;
+        }
+
+        freeGolden(&golden);
+    }
+
+    printf("%d passed, %d failed, %d skipped (%d ROMs x %d profiles, %d also with the recompiler, %d with the lockstep engine) in %.2f s on %d threads%s\n",
+           passed, failed, skipped, rom_count, suite.profile_count, jit_checked, lockstep_checked, elapsed, threads,
+           update ? ", golden results updated" : "");
+
+    free(line);
+    free(suite.results);
+    free(roms);
+
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,174 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debugger.h"
+#include "chip8_internal.h"
+
+struct debugger_ {
+    uint8_t breakpoints[MAX_MEMORY_SIZE]; // 1 where set
+    uint8_t watch[MAX_MEMORY_SIZE]; // WATCH_* flags
+    uint32_t watched; // addresses with a watchpoint (no access checks while 0)
+
+    bool stopped;
+    bool resuming; // the breakpoint at PC is ignored until the next instruction has run
+    int reason;
+    uint16_t address;
+    uint8_t access;
+};
+
+bool attachDebugger(CHIP8* chip8) {
+    if (chip8->debugger == NULL) {
+        chip8->debugger = (DEBUGGER*) calloc(1, sizeof(DEBUGGER));
+        if (chip8->debugger == NULL) return false;
+    }
+    stopMachine(chip8);
+    return true;
+}
+
+void detachDebugger(CHIP8* chip8) {
+    freeDebugger(chip8->debugger);
+    chip8->debugger = NULL;
+}
+
+void freeDebugger(DEBUGGER* debugger) {
+    free(debugger);
+}
+
+void setBreakpoint(CHIP8* chip8, uint16_t addr, bool set) {
+    chip8->debugger->breakpoints[addr & chip8->memory_mask] = set;
+}
+
+void setWatchpoint(CHIP8* chip8, uint16_t addr, uint16_t len, uint8_t access, bool set) {
+    DEBUGGER* d = chip8->debugger;
+    for(uint32_t i = 0; i < len; i++) {
+        uint8_t* flags = &d->watch[(addr + i) & chip8->memory_mask];
+        uint8_t old = *flags;
+        *flags = set ? old | access : old & ~access;
+
+        if (old == 0 && *flags != 0) d->watched++;
+        if (old != 0 && *flags == 0) d->watched--;
+    }
+}
+
+static void stopDebugger(DEBUGGER* d, int reason, uint16_t addr, uint8_t access) {
+    d->stopped = true;
+    d->reason = reason;
+    d->address = addr;
+    d->access = access;
+}
+
+int getStopReason(CHIP8* chip8, uint16_t* addr, uint8_t* access) {
+    DEBUGGER* d = chip8->debugger;
+    if (d == NULL || !d->stopped) return STOP_NONE;
+
+    if (addr != NULL) *addr = d->address;
+    if (access != NULL) *access = d->access;
+    return d->reason;
+}
+
+void stopMachine(CHIP8* chip8) {
+    if (!chip8->debugger->stopped) stopDebugger(chip8->debugger, STOP_INTERRUPT, chip8->pc, 0);
+}
+
+void resumeMachine(CHIP8* chip8) {
+    chip8->debugger->stopped = false;
+    chip8->debugger->resuming = true;
+}
+
+uint8_t stepInstruction(CHIP8* chip8) {
+    resumeMachine(chip8);
+    uint8_t events = runCycles(chip8, 1, EVENT_NONE);
+
+    // a watchpoint hit is the more precise reason (it already stopped the machine)
+    if (!chip8->debugger->stopped) stopDebugger(chip8->debugger, STOP_STEP, chip8->pc, 0);
+    return events;
+}
+
+/*
+    DEBUGGED RUNS
+*/
+
+// the memory the instruction at PC accesses (returns its WATCH_* kind, 0 if none)
+static uint8_t memoryAccess(CHIP8* chip8, uint16_t* addr, uint32_t* len) {
+    uint16_t pc = chip8->pc & chip8->memory_mask;
+    uint16_t inst = (chip8->memory[pc] << 8)|(chip8->memory[(pc+1) & chip8->memory_mask]);
+    DECODED op;
+    INSTRUCTION kind = decodeInstruction(chip8->profile, inst, &op);
+
+    // profiles without an extension map it to another kind's handler (the first kind with that handler is the one run)
+    for(int k = 0; k < kind; k++) {
+        if (chip8->profile->handlers[k] == op.handler) {
+            kind = k;
+            break;
+        }
+    }
+
+    int planes = 0;
+    for(int p = 0; p < DISPLAY_PLANES; p++) planes += (chip8->planes >> p) & 1;
+
+    *addr = chip8->idx;
+    switch (kind) {
+        case OP_FX33: *len = 3; return WATCH_WRITE;
+        case OP_FX55: *len = op.x + 1; return WATCH_WRITE;
+        case OP_5XY2: *len = abs(op.y - op.x) + 1; return WATCH_WRITE;
+        case OP_FX65: *len = op.x + 1; return WATCH_READ;
+        case OP_5XY3: *len = abs(op.y - op.x) + 1; return WATCH_READ;
+        case OP_F002: *len = AUDIO_PATTERN_SIZE; return WATCH_READ;
+        case OP_DXYN: *len = op.n * planes; return WATCH_READ;
+        case OP_DXY0: *len = 32 * planes; return WATCH_READ;
+        default: return 0;
+    }
+}
+
+// the first watched address the instruction at PC accesses (returns the access, 0 if it touches none)
+static uint8_t watchedAccess(CHIP8* chip8, uint16_t* watched) {
+    uint16_t addr;
+    uint32_t len;
+    uint8_t access = memoryAccess(chip8, &addr, &len);
+    if (access == 0) return 0;
+
+    for(uint32_t i = 0; i < len; i++) {
+        uint16_t a = (addr + i) & chip8->memory_mask;
+        if (chip8->debugger->watch[a] & access) {
+            *watched = a;
+            return access;
+        }
+    }
+    return 0;
+}
+
+// runCycles while a debugger is attached: stops before a breakpoint and after an access to a watchpoint
+uint8_t runDebugged(CHIP8* chip8, uint32_t n, uint8_t stop_on) {
+    DEBUGGER* d = chip8->debugger;
+    if (d->stopped) {
+        chip8->events = EVENT_BREAK;
+        return EVENT_BREAK;
+    }
+
+    stop_on |= EVENT_KEY_WAIT | EVENT_HALT | EVENT_BREAK;
+    while (n > 0) {
+        uint16_t pc = chip8->pc & chip8->memory_mask;
+        if (d->breakpoints[pc] && !d->resuming) {
+            stopDebugger(d, STOP_BREAKPOINT, pc, 0);
+            chip8->events |= EVENT_BREAK;
+            break;
+        }
+        d->resuming = false;
+
+        // checked before running it (FX55 / FX65 may move idx)
+        uint16_t watched;
+        uint8_t access = d->watched > 0 ? watchedAccess(chip8, &watched) : 0;
+
+        executeInstruction(chip8);
+        n--;
+
+        if (access != 0) {
+            stopDebugger(d, STOP_WATCHPOINT, watched, access);
+            chip8->events |= EVENT_BREAK;
+        }
+        if (chip8->events & stop_on) break;
+    }
+
+    return chip8->events & ~EVENT_LOOP;
+}
@@ -0,0 +1,52 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// optional debugger: while one is attached, runCycles goes through a separate loop that checks breakpoints and
+// watchpoints around every instruction (no recompiler, profiler or idle loop skipping there)
+// when detached the interpreter pays the same single pointer check per run as for the profiler
+bool attachDebugger(CHIP8* chip8); // the machine starts stopped (false if out of memory)
+void detachDebugger(CHIP8* chip8); // drops the breakpoints and watchpoints, the machine runs freely
+
+// watchpoint kinds (bit flags)
+#define WATCH_READ 1 // FX65, DXYN / DXY0, 5XY3, F002
+#define WATCH_WRITE 2 // FX33, FX55, 5XY2
+
+void setBreakpoint(CHIP8* chip8, uint16_t addr, bool set);
+void setWatchpoint(CHIP8* chip8, uint16_t addr, uint16_t len, uint8_t access, bool set);
+
+// why the machine is stopped
+#define STOP_NONE 0 // running
+#define STOP_INTERRUPT 1 // stopMachine (or just attached)
+#define STOP_STEP 2
+#define STOP_BREAKPOINT 3 // before the instruction at addr
+#define STOP_WATCHPOINT 4 // after an instruction accessed addr (access: WATCH_READ or WATCH_WRITE)
+
+int getStopReason(CHIP8* chip8, uint16_t* addr, uint8_t* access);
+
+// runCycles does nothing while stopped (it returns EVENT_BREAK, as when a breakpoint or watchpoint stops a run)
+void stopMachine(CHIP8* chip8);
+void resumeMachine(CHIP8* chip8); // a breakpoint at PC doesn't fire again right away
+uint8_t stepInstruction(CHIP8* chip8); // runs one instruction and stops again (returns its events)
+
+/*
+ debug server: GDB remote protocol ($packet#checksum) on a Unix socket, or on stdin / stdout for "-"
+ registers are v0 - vF, I, PC, SP, DT, ST (big-endian); the queries qChip8.stack, qChip8.fb and qChip8.info
+ return the stack, the framebuffer and the machine's settings
+*/
+typedef struct debug_server_ DEBUG_SERVER;
+
+// returns NULL (with errno set) if the socket can't be created
+DEBUG_SERVER* createDebugServer(CHIP8* chip8, const char* path);
+
+// answers the pending requests without waiting (the debugger is attached while a client is connected)
+// returns false while the client holds the machine stopped
+bool serveDebugger(DEBUG_SERVER* server);
+
+void freeDebugServer(DEBUG_SERVER* server);
+
+#endif
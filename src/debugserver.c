@@ -0,0 +1,481 @@
+/*
+ debug server: the GDB remote serial protocol over a Unix socket (or stdin / stdout), answered from the frame loop
+
+ packets are $<data>#<checksum> and get a '+' acknowledgment (until QStartNoAckMode), a 0x03 byte stops the machine
+ supported: ? g G p P m M c s Z0-Z4 z0-z4 D k qSupported QStartNoAckMode and the CHIP-8 queries
+   qChip8.stack      stack entries from the most recent call down (4 hex digits each)
+   qChip8.fb         <width>,<height>; then the rows of plane 0 and plane 1, left pixel in the top bit of each byte
+   qChip8.info       profile, cycle count, keys, waiting and ended flags
+ registers (g / G / p / P): v0 - vF (0 - 15), I (16), PC (17), SP (18), DT (19), ST (20), 16-bit ones big-endian
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "debugger.h"
+#include "chip8_internal.h"
+
+#define PACKET_SIZE 0x4000 // largest packet accepted or sent (data plus framing)
+#define REGISTER_COUNT 21
+
+struct debug_server_ {
+    CHIP8* chip8;
+    int listen_fd; // -1 on stdin / stdout
+    int in, out; // client (-1 when none)
+    char* path; // socket file, removed on free
+
+    char input[PACKET_SIZE];
+    size_t used;
+    bool ack; // '+' after each packet (until QStartNoAckMode)
+    bool waiting; // the client continued: a stop reply is due once the machine stops
+};
+
+DEBUG_SERVER* createDebugServer(CHIP8* chip8, const char* path) {
+    DEBUG_SERVER* server = (DEBUG_SERVER*) calloc(1, sizeof(DEBUG_SERVER));
+    if (server == NULL) return NULL;
+    server->chip8 = chip8;
+    server->listen_fd = server->in = server->out = -1;
+
+    // stdin / stdout: the client is already there
+    if (strcmp(path, "-") == 0) {
+        if (!attachDebugger(chip8)) {
+            free(server);
+            errno = ENOMEM;
+            return NULL;
+        }
+        // a client that closed stdout makes write fail with EPIPE (and drops it) instead of killing the emulator
+        signal(SIGPIPE, SIG_IGN);
+        server->in = STDIN_FILENO;
+        server->out = STDOUT_FILENO;
+        server->ack = true;
+        return server;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        free(server);
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    // only a socket file (left by a previous run, it would make bind fail) gets replaced, anything else is kept
+    struct stat existing;
+    if (lstat(path, &existing) == 0 && !S_ISSOCK(existing.st_mode)) {
+        free(server);
+        errno = EADDRINUSE;
+        return NULL;
+    }
+
+    server->path = strdup(path);
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->path == NULL || server->listen_fd < 0) {
+        freeDebugServer(server);
+        return NULL;
+    }
+
+    unlink(path);
+    if (bind(server->listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(server->listen_fd, 1) != 0) {
+        int error = errno;
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        free(server->path);
+        server->path = NULL;
+        freeDebugServer(server);
+        errno = error;
+        return NULL;
+    }
+    return server;
+}
+
+static bool readable(int fd) {
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+    return poll(&p, 1, 0) > 0;
+}
+
+static void dropClient(DEBUG_SERVER* server) {
+    if (server->listen_fd >= 0 && server->in >= 0) close(server->in);
+    server->in = server->out = -1;
+    server->used = 0;
+    server->waiting = false;
+    detachDebugger(server->chip8);
+}
+
+/*
+    PACKETS
+*/
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// a client that went away is dropped (MSG_NOSIGNAL on a socket, SIGPIPE ignored on stdout)
+static void sendRaw(DEBUG_SERVER* server, const char* data, size_t len) {
+    while (len > 0 && server->out >= 0) {
+        ssize_t n = server->listen_fd >= 0 ? send(server->out, data, len, MSG_NOSIGNAL) : write(server->out, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            dropClient(server);
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static void sendPacket(DEBUG_SERVER* server, const char* data) {
+    static char packet[PACKET_SIZE + 4];
+    size_t len = strlen(data);
+    uint8_t checksum = 0;
+
+    packet[0] = '$';
+    for(size_t i = 0; i < len; i++) {
+        packet[1+i] = data[i];
+        checksum += (uint8_t) data[i];
+    }
+    packet[1+len] = '#';
+    packet[2+len] = hex_digits[checksum >> 4];
+    packet[3+len] = hex_digits[checksum & 0xF];
+    sendRaw(server, packet, len + 4);
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// parses a hex number ending at one of the stop characters (or the end), advances *s past it
+static bool parseHex(const char** s, const char* stops, uint32_t* value) {
+    const char* p = *s;
+    *value = 0;
+    while (*p != '\0' && strchr(stops, *p) == NULL) {
+        int d = hexValue(*p++);
+        if (d < 0 || *value > 0xFFFFFF) return false;
+        *value = (*value << 4) | d;
+    }
+    if (p == *s) return false;
+    *s = p;
+    return true;
+}
+
+static char* putHex(char* out, uint32_t value, int digits) {
+    for(int i = digits-1; i >= 0; i--) *out++ = hex_digits[(value >> (4*i)) & 0xF];
+    *out = '\0';
+    return out;
+}
+
+static uint32_t getRegister(CHIP8* chip8, int reg, int* digits) {
+    *digits = reg == 16 || reg == 17 ? 4 : 2;
+    if (reg < 16) return chip8->v[reg];
+    switch (reg) {
+        case 16: return chip8->idx;
+        case 17: return chip8->pc;
+        case 18: return chip8->sp;
+        case 19: return chip8->delay_timer;
+        default: return chip8->sound_timer;
+    }
+}
+
+static void setRegister(CHIP8* chip8, int reg, uint32_t value) {
+    if (reg < 16) chip8->v[reg] = value;
+    switch (reg) {
+        case 16: chip8->idx = value; break;
+        case 17: chip8->pc = value & chip8->memory_mask; break;
+        case 18: chip8->sp = value; break;
+        case 19: chip8->delay_timer = value; break;
+        case 20: chip8->sound_timer = value; break;
+    }
+}
+
+// stop reply for the current state of the machine
+static void sendStopReply(DEBUG_SERVER* server) {
+    char reply[32];
+    uint16_t addr;
+    uint8_t access;
+
+    if (hasEnded(server->chip8)) {
+        sendPacket(server, "W00");
+        return;
+    }
+    switch (getStopReason(server->chip8, &addr, &access)) {
+        case STOP_BREAKPOINT: sendPacket(server, "T05swbreak:;"); break;
+        case STOP_WATCHPOINT:
+            snprintf(reply, sizeof(reply), "T05%s:%x;", access == WATCH_WRITE ? "watch" : "rwatch", addr);
+            sendPacket(server, reply);
+            break;
+        case STOP_INTERRUPT: sendPacket(server, "S02"); break;
+        default: sendPacket(server, "S05"); break;
+    }
+}
+
+// Z / z: type,addr,kind
+static void handleBreakpoint(DEBUG_SERVER* server, const char* packet, bool set) {
+    CHIP8* chip8 = server->chip8;
+    const char* p = packet + 1;
+    uint32_t type, addr, len;
+    if (!parseHex(&p, ",", &type) || *p++ != ',' || !parseHex(&p, ",;", &addr) || *p++ != ',' || !parseHex(&p, ";", &len)) {
+        sendPacket(server, "E01");
+        return;
+    }
+
+    // 0 / 1: software / hardware breakpoint, 2 / 3 / 4: write / read / access watchpoint
+    static const uint8_t watch_kinds[] = { 0, 0, WATCH_WRITE, WATCH_READ, WATCH_READ|WATCH_WRITE };
+    if (type <= 1) setBreakpoint(chip8, addr, set);
+    else if (type <= 4) setWatchpoint(chip8, addr, len > chip8->memory_mask ? chip8->memory_mask+1 : len, watch_kinds[type], set);
+    else {
+        sendPacket(server, "");
+        return;
+    }
+    sendPacket(server, "OK");
+}
+
+static void handleQuery(DEBUG_SERVER* server, const char* packet, char* reply) {
+    CHIP8* chip8 = server->chip8;
+
+    if (strncmp(packet, "qSupported", 10) == 0) {
+        snprintf(reply, PACKET_SIZE, "PacketSize=%x;QStartNoAckMode+;swbreak+", PACKET_SIZE);
+    } else if (strcmp(packet, "qAttached") == 0) {
+        strcpy(reply, "1");
+    } else if (strcmp(packet, "qC") == 0) {
+        strcpy(reply, "QC1");
+    } else if (strcmp(packet, "qfThreadInfo") == 0) {
+        strcpy(reply, "m1");
+    } else if (strcmp(packet, "qsThreadInfo") == 0) {
+        strcpy(reply, "l");
+    } else if (strcmp(packet, "qChip8.stack") == 0) {
+        // the stack grows down from STACK_SIZE
+        char* out = reply;
+        for(int i = chip8->sp; i < STACK_SIZE; i++) out = putHex(out, chip8->stack[i & (STACK_SIZE-1)], 4);
+    } else if (strcmp(packet, "qChip8.fb") == 0) {
+        const FRAMEBUFFER* fb = getFramebuffer(chip8);
+        char* out = reply + sprintf(reply, "%d,%d;", fb->width, fb->height);
+        for(int p = 0; p < DISPLAY_PLANES; p++) {
+            for(int y = 0; y < fb->height; y++) {
+                for(int x = 0; x < fb->width; x += 8) {
+                    out = putHex(out, (fb->rows[p][y][x/64] >> (56 - x%64)) & 0xFF, 2);
+                }
+            }
+        }
+    } else if (strcmp(packet, "qChip8.info") == 0) {
+        snprintf(reply, PACKET_SIZE, "profile:%s;cycles:%llx;keys:%x;waiting:%d;ended:%d", getQuirkProfile(chip8),
+            (unsigned long long) chip8->cycles, chip8->keys, chip8->waiting_key, chip8->ended);
+    } else {
+        reply[0] = '\0';
+    }
+}
+
+static void handlePacket(DEBUG_SERVER* server, const char* packet) {
+    static char reply[PACKET_SIZE];
+    CHIP8* chip8 = server->chip8;
+    const char* p = packet + 1;
+    uint32_t addr, len, value;
+    int digits;
+    reply[0] = '\0';
+
+    switch (packet[0]) {
+        case '?':
+            sendStopReply(server);
+            return;
+
+        case 'g': {
+            char* out = reply;
+            for(int r = 0; r < REGISTER_COUNT; r++) {
+                value = getRegister(chip8, r, &digits);
+                out = putHex(out, value, digits);
+            }
+            break;
+        }
+        case 'G':
+            for(int r = 0; r < REGISTER_COUNT; r++) {
+                getRegister(chip8, r, &digits);
+                value = 0;
+                for(int i = 0; i < digits; i++) {
+                    int d = hexValue(*p++);
+                    if (d < 0) {
+                        sendPacket(server, "E01");
+                        return;
+                    }
+                    value = (value << 4) | d;
+                }
+                setRegister(chip8, r, value);
+            }
+            strcpy(reply, "OK");
+            break;
+        case 'p':
+            if (!parseHex(&p, "", &addr) || addr >= REGISTER_COUNT) strcpy(reply, "E01");
+            else {
+                value = getRegister(chip8, addr, &digits);
+                putHex(reply, value, digits);
+            }
+            break;
+        case 'P':
+            if (!parseHex(&p, "=", &addr) || addr >= REGISTER_COUNT || *p++ != '=' || !parseHex(&p, "", &value)) strcpy(reply, "E01");
+            else {
+                setRegister(chip8, addr, value);
+                strcpy(reply, "OK");
+            }
+            break;
+
+        // memory addresses wrap around like the interpreter's
+        case 'm':
+            if (!parseHex(&p, ",", &addr) || *p++ != ',' || !parseHex(&p, "", &len)) strcpy(reply, "E01");
+            else {
+                if (len > (PACKET_SIZE - 8) / 2) len = (PACKET_SIZE - 8) / 2;
+                char* out = reply;
+                for(uint32_t i = 0; i < len; i++) out = putHex(out, chip8->memory[(addr + i) & chip8->memory_mask], 2);
+            }
+            break;
+        case 'M':
+            if (!parseHex(&p, ",", &addr) || *p++ != ',' || !parseHex(&p, ":", &len) || *p++ != ':' || strlen(p) < 2*len) {
+                strcpy(reply, "E01");
+                break;
+            }
+            for(uint32_t i = 0; i < len; i++) {
+                int hi = hexValue(p[2*i]), lo = hexValue(p[2*i+1]);
+                if (hi < 0 || lo < 0) {
+                    sendPacket(server, "E01");
+                    return;
+                }
+                uint16_t a = (addr + i) & chip8->memory_mask;
+                chip8->memory[a] = (hi << 4) | lo;
+                invalidateDecodeCache(chip8, a, 1);
+            }
+            strcpy(reply, "OK");
+            break;
+
+        // c / s [addr]: the reply comes when the machine stops (right away for a step)
+        case 'c':
+        case 's':
+            if (parseHex(&p, "", &addr)) chip8->pc = addr & chip8->memory_mask;
+            if (packet[0] == 's') {
+                stepInstruction(chip8);
+                sendStopReply(server);
+            } else {
+                resumeMachine(chip8);
+                server->waiting = true;
+            }
+            return;
+
+        case 'Z':
+        case 'z':
+            handleBreakpoint(server, packet, packet[0] == 'Z');
+            return;
+
+        case 'H':
+            strcpy(reply, "OK");
+            break;
+        case 'q':
+            handleQuery(server, packet, reply);
+            break;
+        case 'Q':
+            if (strcmp(packet, "QStartNoAckMode") == 0) {
+                sendPacket(server, "OK");
+                server->ack = false;
+                return;
+            }
+            break;
+
+        case 'D':
+            sendPacket(server, "OK");
+            dropClient(server);
+            return;
+        case 'k':
+            dropClient(server);
+            return;
+    }
+
+    sendPacket(server, reply);
+}
+
+// handles the complete packets in the input buffer, keeps a partial one for the next read
+static void handleInput(DEBUG_SERVER* server) {
+    size_t start = 0;
+    while (start < server->used && server->in >= 0) {
+        char c = server->input[start];
+        if (c == 0x03) {
+            stopMachine(server->chip8);
+            start++;
+            continue;
+        }
+        if (c != '$') {
+            start++; // acknowledgments and noise
+            continue;
+        }
+
+        char* end = memchr(server->input + start, '#', server->used - start);
+        if (end == NULL || end + 2 >= server->input + server->used) break;
+
+        uint8_t checksum = 0;
+        for(char* q = server->input + start + 1; q < end; q++) checksum += (uint8_t) *q;
+        bool valid = hexValue(end[1]) >= 0 && hexValue(end[2]) >= 0 && checksum == ((hexValue(end[1]) << 4) | hexValue(end[2]));
+
+        const char* packet = server->input + start + 1;
+        *end = '\0';
+        start = end + 3 - server->input;
+        if (server->ack) sendRaw(server, valid ? "+" : "-", 1);
+        if (valid) handlePacket(server, packet);
+    }
+
+    if (server->in < 0) return;
+    memmove(server->input, server->input + start, server->used - start);
+    server->used -= start;
+
+    // no room for the rest of an oversized packet
+    if (server->used == sizeof(server->input)) server->used = 0;
+}
+
+bool serveDebugger(DEBUG_SERVER* server) {
+    // a new client attaches the debugger (and finds the machine stopped)
+    if (server->in < 0) {
+        if (server->listen_fd < 0 || !readable(server->listen_fd)) return true;
+
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) return true;
+        if (!attachDebugger(server->chip8)) {
+            close(fd);
+            return true;
+        }
+        server->in = server->out = fd;
+        server->ack = true;
+    }
+
+    while (server->in >= 0 && readable(server->in)) {
+        ssize_t n = read(server->in, server->input + server->used, sizeof(server->input) - server->used);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            dropClient(server);
+            return true;
+        }
+        server->used += n;
+        handleInput(server);
+    }
+    if (server->in < 0) return true;
+
+    // a breakpoint, watchpoint, interrupt or the end of the program stopped a continue
+    if (server->waiting && (getStopReason(server->chip8, NULL, NULL) != STOP_NONE || hasEnded(server->chip8))) {
+        server->waiting = false;
+        sendStopReply(server);
+    }
+    return getStopReason(server->chip8, NULL, NULL) == STOP_NONE;
+}
+
+void freeDebugServer(DEBUG_SERVER* server) {
+    if (server->in >= 0) dropClient(server);
+    if (server->listen_fd >= 0) close(server->listen_fd);
+    if (server->path != NULL) {
+        unlink(server->path);
+        free(server->path);
+    }
+    free(server);
+}
@@ -0,0 +1,296 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "analysis.h"
+#include "chip8.h"
+
+/*
+ chip8-disasm: disassembly listing of a ROM with its basic blocks, calls, jump tables, data and self-modifying stores
+   chip8-disasm [-q quirks] [-j analysis.json] rom
+
+ the listing goes to stdout; -j also writes the analysis as JSON (blocks with their successors, functions, calls,
+ jump tables, data ranges and stores) for other tools
+*/
+
+#define PROGRAM_START 0x200
+#define MAX_ROM_SIZE 0x10000
+#define DATA_LINE 8 // bytes per data line
+
+static const char* exit_names[] = { "fallthrough", "jump", "call", "return", "skip", "table", "halt" };
+
+static bool isCode(uint8_t flags) {
+    return flags & (ADDR_CODE | ADDR_OPERAND);
+}
+
+static const char* baseName(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+/*
+    LISTING
+*/
+
+static void printSummary(FILE* out, const ANALYSIS* a, const char* name, const char* quirks, size_t size) {
+    int functions = 0, tables = 0, code = 0, data = 0, read = 0, modified = 0;
+    for(int b = 0; b < getBlockCount(a); b++) {
+        uint8_t flags = getAddressFlags(a, getBlocks(a)[b].start);
+        if (flags & ADDR_FUNCTION) functions++;
+        if (flags & ADDR_JUMP_TABLE) tables++;
+    }
+    for(uint32_t addr = PROGRAM_START; addr < PROGRAM_START + size; addr++) {
+        uint8_t flags = getAddressFlags(a, addr);
+        if (isCode(flags)) code++;
+        else data++;
+        if (!isCode(flags) && (flags & ADDR_READ)) read++;
+        if (flags & ADDR_SELF_MODIFIED) modified++;
+    }
+
+    int into_code = 0, unknown = 0;
+    for(int i = 0; i < getStoreCount(a); i++) {
+        if (getStores(a)[i].into_code) into_code++;
+        if (getStores(a)[i].addr < 0) unknown++;
+    }
+
+    fprintf(out, "; %s: %zu bytes, %s quirks\n", name, size, quirks);
+    fprintf(out, "; %d blocks, %d functions, %d calls, %d jump table entries\n", getBlockCount(a), functions,
+            getCallCount(a), tables);
+    fprintf(out, "; %d code bytes, %d data bytes (%d read through a known I)\n", code, data, read);
+    fprintf(out, "; %d stores: %d into code (%d code bytes modified), %d through an unknown I\n", getStoreCount(a),
+            into_code, modified, unknown);
+
+    for(int i = 0; i < getStoreCount(a); i++) {
+        const STORE_SITE* s = &getStores(a)[i];
+        if (s->into_code) fprintf(out, ";   self-modifying store at 0x%03X into 0x%03X-0x%03X\n", s->site, s->addr, s->addr + s->len - 1);
+    }
+}
+
+static void printCalls(FILE* out, const ANALYSIS* a) {
+    const CALL_EDGE* calls = getCalls(a);
+    for(int i = 0; i < getCallCount(a); i++) {
+        if (i == 0 || calls[i].caller != calls[i-1].caller) fprintf(out, "%s; sub_%03X calls", i > 0 ? "\n" : "", calls[i].caller);
+        fprintf(out, " sub_%03X", calls[i].callee);
+    }
+    if (getCallCount(a) > 0) fprintf(out, "\n");
+}
+
+static void printLabel(FILE* out, const ANALYSIS* a, uint16_t addr) {
+    uint8_t flags = getAddressFlags(a, addr);
+    if (flags & ADDR_FUNCTION) fprintf(out, "\nsub_%03X:\n", addr);
+    else if (flags & ADDR_BLOCK) fprintf(out, "L_%03X:%s\n", addr, flags & ADDR_JUMP_TABLE ? "  ; jump table entry" : "");
+}
+
+// the successors of the block ending at end (empty if no block ends there)
+static void describeSuccessors(const ANALYSIS* a, uint16_t end, char* out, size_t size) {
+    const CODE_BLOCK* blocks = getBlocks(a);
+    for(int b = 0; b < getBlockCount(a); b++) {
+        if (blocks[b].end != end || blocks[b].successor_count == 0) continue;
+
+        size_t used = snprintf(out, size, "%s ->", exit_names[blocks[b].exit]);
+        for(int s = 0; s < blocks[b].successor_count && used < size; s++) {
+            used += snprintf(out + used, size - used, " 0x%03X", blocks[b].successors[s]);
+        }
+        return;
+    }
+}
+
+static void printListing(FILE* out, const ANALYSIS* a, const uint8_t* rom, size_t size) {
+    uint32_t addr = PROGRAM_START;
+    uint32_t end = PROGRAM_START + size;
+
+    while (addr < end) {
+        uint8_t flags = getAddressFlags(a, addr);
+
+        if (flags & ADDR_CODE) {
+            char text[64];
+            printLabel(out, a, addr);
+            int length = disassembleInstruction(a, addr, text, sizeof(text));
+
+            fprintf(out, "  %03X  ", addr);
+            for(int i = 0; i < 4; i++) {
+                if (i < length && addr + i < end) fprintf(out, "%02X", rom[addr + i - PROGRAM_START]);
+                else fprintf(out, "  ");
+            }
+            char successors[1024] = "";
+            describeSuccessors(a, (addr + length) & 0xFFFF, successors, sizeof(successors));
+            bool modified = false;
+            for(int i = 0; i < length; i++) modified |= (getAddressFlags(a, addr + i) & ADDR_SELF_MODIFIED) != 0;
+
+            if (modified) fprintf(out, "  %-20s  ; modified at run time%s%s\n", text, successors[0] ? ", " : "", successors);
+            else if (successors[0]) fprintf(out, "  %-20s  ; %s\n", text, successors);
+            else fprintf(out, "  %s\n", text);
+
+            addr += length;
+            continue;
+        }
+
+        // data: up to DATA_LINE bytes with the same flags
+        uint32_t start = addr;
+        fprintf(out, "  %03X ", addr);
+        while (addr < end && addr - start < DATA_LINE && !(getAddressFlags(a, addr) & ADDR_CODE) &&
+               (getAddressFlags(a, addr) & (ADDR_READ | ADDR_WRITTEN)) == (flags & (ADDR_READ | ADDR_WRITTEN))) {
+            fprintf(out, " %02X", rom[addr - PROGRAM_START]);
+            addr++;
+        }
+
+        const char* use = "";
+        if ((flags & ADDR_READ) && (flags & ADDR_WRITTEN)) use = "  ; read and written";
+        else if (flags & ADDR_READ) use = "  ; read";
+        else if (flags & ADDR_WRITTEN) use = "  ; written";
+        else if (flags & ADDR_OPERAND) use = "  ; operand";
+        if (use[0]) fprintf(out, "%*s%s\n", (int) (DATA_LINE - (addr - start)) * 3, "", use);
+        else fprintf(out, "\n");
+    }
+}
+
+/*
+    JSON EXPORT
+*/
+
+// ranges [start, end) of the program where (flags & mask) is set, or clear with negate
+static void writeRanges(FILE* out, const ANALYSIS* a, size_t size, uint8_t mask, bool negate) {
+    bool first = true;
+    uint32_t addr = PROGRAM_START;
+    while (addr < PROGRAM_START + size) {
+        if (((getAddressFlags(a, addr) & mask) != 0) == negate) {
+            addr++;
+            continue;
+        }
+        uint32_t start = addr;
+        while (addr < PROGRAM_START + size && ((getAddressFlags(a, addr) & mask) != 0) != negate) addr++;
+        fprintf(out, "%s[%u, %u]", first ? "" : ", ", start, addr);
+        first = false;
+    }
+}
+
+static void writeJson(FILE* out, const ANALYSIS* a, const char* name, const char* quirks, size_t size) {
+    fprintf(out, "{\"rom\": \"%s\", \"quirks\": \"%s\", \"start\": %d, \"size\": %zu,\n", name, quirks, PROGRAM_START, size);
+
+    fprintf(out, " \"blocks\": [");
+    const CODE_BLOCK* blocks = getBlocks(a);
+    for(int b = 0; b < getBlockCount(a); b++) {
+        fprintf(out, "%s\n  {\"start\": %u, \"end\": %u, \"exit\": \"%s\", \"successors\": [", b > 0 ? "," : "",
+                blocks[b].start, blocks[b].end, exit_names[blocks[b].exit]);
+        for(int s = 0; s < blocks[b].successor_count; s++) fprintf(out, "%s%u", s > 0 ? ", " : "", blocks[b].successors[s]);
+        fprintf(out, "]}");
+    }
+
+    bool first = true;
+    fprintf(out, "],\n \"functions\": [");
+    for(int b = 0; b < getBlockCount(a); b++) {
+        if (!(getAddressFlags(a, blocks[b].start) & ADDR_FUNCTION)) continue;
+        fprintf(out, "%s%u", first ? "" : ", ", blocks[b].start);
+        first = false;
+    }
+
+    first = true;
+    fprintf(out, "],\n \"jump_tables\": [");
+    for(int b = 0; b < getBlockCount(a); b++) {
+        if (!(getAddressFlags(a, blocks[b].start) & ADDR_JUMP_TABLE)) continue;
+        fprintf(out, "%s%u", first ? "" : ", ", blocks[b].start);
+        first = false;
+    }
+
+    fprintf(out, "],\n \"calls\": [");
+    const CALL_EDGE* calls = getCalls(a);
+    for(int i = 0; i < getCallCount(a); i++) {
+        fprintf(out, "%s{\"caller\": %u, \"site\": %u, \"callee\": %u}", i > 0 ? ", " : "", calls[i].caller, calls[i].site, calls[i].callee);
+    }
+
+    fprintf(out, "],\n \"stores\": [");
+    const STORE_SITE* stores = getStores(a);
+    for(int i = 0; i < getStoreCount(a); i++) {
+        fprintf(out, "%s{\"site\": %u, ", i > 0 ? ", " : "", stores[i].site);
+        if (stores[i].addr >= 0) fprintf(out, "\"addr\": %d, ", stores[i].addr);
+        else fprintf(out, "\"addr\": null, ");
+        fprintf(out, "\"len\": %u, \"into_code\": %s}", stores[i].len, stores[i].into_code ? "true" : "false");
+    }
+
+    // data: the bytes of the program no reachable instruction covers
+    fprintf(out, "],\n \"data\": [");
+    writeRanges(out, a, size, ADDR_CODE | ADDR_OPERAND, true);
+    fprintf(out, "],\n \"self_modified\": [");
+    writeRanges(out, a, size, ADDR_SELF_MODIFIED, false);
+    fprintf(out, "]}\n");
+}
+
+void printUsage(char* program) {
+    fprintf(stderr, "usage: %s [-q quirks] [-j analysis.json] <rom>\n", program);
+}
+
+int main(int argc, char* argv[]) {
+    const char* quirks = getQuirkProfileName(0);
+    const char* json_path = NULL;
+    const char* rom_path = NULL;
+
+    for(int i = 1; i < argc; i++) {
+        bool has_value = i+1 < argc;
+
+        if (strcmp(argv[i], "-q") == 0 && has_value) quirks = argv[++i];
+        else if (strcmp(argv[i], "-j") == 0 && has_value) json_path = argv[++i];
+        else if (argv[i][0] != '-' && rom_path == NULL) rom_path = argv[i];
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (rom_path == NULL) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    CHIP8* chip8 = createInterpreter();
+    if (chip8 == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return 1;
+    }
+    if (!setQuirkProfile(chip8, quirks)) {
+        fprintf(stderr, "ERROR: unknown quirk profile \"%s\"\n", quirks);
+        return 1;
+    }
+
+    // the quirk profile decides how much memory a ROM can fill
+    uint8_t* rom = (uint8_t*) malloc(MAX_ROM_SIZE);
+    FILE* f = fopen(rom_path, "rb");
+    if (rom == NULL || f == NULL) {
+        fprintf(stderr, "ERROR: %s: %s\n", rom_path, strerror(errno));
+        return 1;
+    }
+    size_t size = fread(rom, 1, MAX_ROM_SIZE, f);
+    fclose(f);
+    if (!loadProgram(chip8, rom, size)) {
+        fprintf(stderr, "ERROR: %s doesn't fit in memory with the %s quirks\n", rom_path, quirks);
+        return 1;
+    }
+
+    ANALYSIS* analysis = analyzeProgram(chip8);
+    if (analysis == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return 1;
+    }
+
+    const char* name = baseName(rom_path);
+    printSummary(stdout, analysis, name, quirks, size);
+    printCalls(stdout, analysis);
+    printListing(stdout, analysis, rom, size);
+
+    int status = 0;
+    if (json_path != NULL) {
+        FILE* out = fopen(json_path, "w");
+        if (out == NULL) {
+            fprintf(stderr, "ERROR: %s: %s\n", json_path, strerror(errno));
+            status = 1;
+        } else {
+            writeJson(out, analysis, name, quirks, size);
+            fclose(out);
+        }
+    }
+
+    freeAnalysis(analysis);
+    freeInterpreter(chip8);
+    free(rom);
+    return status;
+}
@@ -5,55 +5,50 @@
 #include <stdio.h>
 #include <SDL2/SDL.h>
 
-#define SCALE 20
+#define SCALE 10 // window pixels per hi-res pixel (a lo-res pixel is 2 x 2 hi-res ones)
+
+// colors indexed by the set of planes a pixel is on in (plane 0 alone is the classic white)
+static const uint32_t palette[1 << DISPLAY_PLANES] = {
+    0xFF000000, 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555
+};
 
 struct display_ {
-    bool pixels[DISPLAY_HEIGHT][DISPLAY_WIDTH];
     SDL_Window* window;
     SDL_Renderer* renderer;
+
+    // DISPLAY_WIDTH x DISPLAY_HEIGHT streaming texture, stretched to the window by the renderer
+    SDL_Texture* texture;
+
+    // hash of the last presented framebuffer (nothing is presented if it didn't change)
+    uint64_t last_hash;
+    bool presented;
 };  
 
-// turn pixel at (x,y) on if c true
-void changePixelColor(DISPLAY* display, int x, int y, bool c) {
-    if (c) {
-        display->pixels[y][x] = 1;
-    } else {
-        display->pixels[y][x] = 0;
+// upload the framebuffer to the texture and display it
+void updateDisplay(DISPLAY* display, const FRAMEBUFFER* fb) {
+    uint64_t hash = hashFramebuffer(fb);
+    if (display->presented && hash == display->last_hash) return;
+
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(display->texture, NULL, &pixels, &pitch) < 0) {
+        printf("Couldn't lock texture: %s\n", SDL_GetError());
+        return;
     }
-}
 
-bool getPixelColor(DISPLAY* display, int x, int y) {
-    return display->pixels[y][x];
-}
+    // lo-res frames are doubled in both directions, so the texture is always DISPLAY_WIDTH x DISPLAY_HEIGHT
+    renderFramebuffer(fb, (uint32_t*) pixels, pitch, palette);
 
-// update de renderer and display it
-void updateDisplay(DISPLAY* display) {
-    SDL_SetRenderDrawColor(display->renderer, 0, 0, 0, 255);
-    SDL_RenderClear(display->renderer);
-
-    SDL_SetRenderDrawColor(display->renderer, 255, 255, 255, 255);
-    for (int y = 0; y < DISPLAY_HEIGHT; y++) {
-        for (int x = 0; x < DISPLAY_WIDTH; x++) {
-            if (display->pixels[y][x]) {
-                SDL_Rect r = { x * SCALE, y * SCALE, SCALE, SCALE };
-                SDL_RenderFillRect(display->renderer, &r);
-            }
-        }
-    }
+    SDL_UnlockTexture(display->texture);
 
+    SDL_RenderCopy(display->renderer, display->texture, NULL, NULL);
     SDL_RenderPresent(display->renderer);
-}
 
-// sets all to 0
-void cleanDisplay(DISPLAY* display) {
-    for(int i = 0; i < DISPLAY_HEIGHT; i++) {
-        for(int j = 0; j < DISPLAY_WIDTH; j++) {
-            display->pixels[i][j] = 0;
-        }
-    }
+    display->last_hash = hash;
+    display->presented = true;
 }
 
-DISPLAY* createDisplay() {
+DISPLAY* createDisplay(bool vsync) {
     DISPLAY* display = (DISPLAY *) malloc(sizeof(DISPLAY));
 
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0){
@@ -68,9 +63,24 @@ DISPLAY* createDisplay() {
         exit(1);
     }
 
-    display->renderer = SDL_CreateRenderer(display->window, -1, 0);
-    
-    cleanDisplay(display);
+    // nearest-neighbour scaling keeps the pixels sharp
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+
+    display->renderer = SDL_CreateRenderer(display->window, -1, vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
+    if (!display->renderer){
+        printf("Couldn't create renderer: %s\n", SDL_GetError());
+        exit(1);
+    }
+
+    display->texture = SDL_CreateTexture(display->renderer, SDL_PIXELFORMAT_ARGB8888,
+                        SDL_TEXTUREACCESS_STREAMING, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    if (!display->texture){
+        printf("Couldn't create texture: %s\n", SDL_GetError());
+        exit(1);
+    }
+
+    display->last_hash = 0;
+    display->presented = false;
 
     return display;
 }
@@ -78,25 +88,10 @@ DISPLAY* createDisplay() {
 
 
 void freeDisplay(DISPLAY* display) {
-    SDL_DestroyWindow(display->window);
+    SDL_DestroyTexture(display->texture);
     SDL_DestroyRenderer(display->renderer);
+    SDL_DestroyWindow(display->window);
 
     free(display);
     return;
 }
-
-/*
-    DEBUG
-*/
-
-void printDisplay(DISPLAY* display) {
-    for(int i = 0; i < DISPLAY_HEIGHT; i++) {
-        for (int j = 0; j < DISPLAY_WIDTH; j++) {
-            if (display->pixels[i][j])
-                printf("*");
-            else 
-                printf("-");
-        }
-        printf("\n");
-    }
-}
\ No newline at end of file
@@ -3,19 +3,14 @@
 
 #include <stdbool.h>
 
-#define DISPLAY_WIDTH 64 // POWERS OF TWO
-#define DISPLAY_HEIGHT 32
+#include "framebuffer.h"
 
+// SDL window that presents the interpreter framebuffer
 typedef struct display_ DISPLAY;
 
-DISPLAY* createDisplay();
-void updateDisplay(DISPLAY* display);
-void cleanDisplay(DISPLAY* display);
+DISPLAY* createDisplay(bool vsync);
+void updateDisplay(DISPLAY* display, const FRAMEBUFFER* fb);
 
 void freeDisplay(DISPLAY* display);
-void changePixelColor(DISPLAY* display, int x, int y, bool c);
-bool getPixelColor(DISPLAY* display, int x, int y);
 
-void printDisplay(DISPLAY* display);
-
-#endif
\ No newline at end of file
+#endif
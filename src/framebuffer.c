@@ -0,0 +1,157 @@
+#include "framebuffer.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PIXEL_BIT(x) ((uint64_t) 1 << (63 - ((x) & 63)))
+
+// turn pixel at (x,y) on if c true (plane 0)
+void changePixelColor(FRAMEBUFFER* fb, int x, int y, bool c) {
+    if (c) {
+        fb->rows[0][y][x >> 6] |= PIXEL_BIT(x);
+    } else {
+        fb->rows[0][y][x >> 6] &= ~PIXEL_BIT(x);
+    }
+}
+
+uint8_t getPixelColor(const FRAMEBUFFER* fb, int x, int y) {
+    uint8_t color = 0;
+    for(int p = 0; p < DISPLAY_PLANES; p++) {
+        if (fb->rows[p][y][x >> 6] & PIXEL_BIT(x)) color |= 1 << p;
+    }
+    return color;
+}
+
+// sets all to 0 (the resolution is kept)
+void cleanFramebuffer(FRAMEBUFFER* fb) {
+    memset(fb->rows, 0, sizeof(fb->rows));
+}
+
+void clearPlanes(FRAMEBUFFER* fb, uint8_t planes) {
+    for(int p = 0; p < DISPLAY_PLANES; p++) {
+        if (planes & (1 << p)) memset(fb->rows[p], 0, sizeof(fb->rows[p]));
+    }
+}
+
+// switches between 64 x 32 and 128 x 64 (clears the screen)
+void setResolution(FRAMEBUFFER* fb, bool hires) {
+    fb->width = hires ? DISPLAY_WIDTH : LORES_WIDTH;
+    fb->height = hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+    cleanFramebuffer(fb);
+}
+
+/*
+    SCROLLING (whole packed rows: a memmove per plane vertically, two shifts per row horizontally)
+*/
+
+void scrollDown(FRAMEBUFFER* fb, uint8_t planes, int n) {
+    if (n > fb->height) n = fb->height;
+
+    for(int p = 0; p < DISPLAY_PLANES; p++) {
+        if (!(planes & (1 << p))) continue;
+        memmove(fb->rows[p][n], fb->rows[p][0], (fb->height - n) * sizeof(fb->rows[p][0]));
+        memset(fb->rows[p][0], 0, n * sizeof(fb->rows[p][0]));
+    }
+}
+
+void scrollUp(FRAMEBUFFER* fb, uint8_t planes, int n) {
+    if (n > fb->height) n = fb->height;
+
+    for(int p = 0; p < DISPLAY_PLANES; p++) {
+        if (!(planes & (1 << p))) continue;
+        memmove(fb->rows[p][0], fb->rows[p][n], (fb->height - n) * sizeof(fb->rows[p][0]));
+        memset(fb->rows[p][fb->height - n], 0, n * sizeof(fb->rows[p][0]));
+    }
+}
+
+void scrollLeft(FRAMEBUFFER* fb, uint8_t planes, int n) {
+    if (n <= 0) return;
+    if (n >= 64) n = 63;
+
+    for(int p = 0; p < DISPLAY_PLANES; p++) {
+        if (!(planes & (1 << p))) continue;
+        for(int y = 0; y < fb->height; y++) {
+            uint64_t* row = fb->rows[p][y];
+            row[0] = (row[0] << n) | (row[1] >> (64 - n));
+            row[1] <<= n;
+        }
+    }
+}
+
+void scrollRight(FRAMEBUFFER* fb, uint8_t planes, int n) {
+    if (n <= 0) return;
+    if (n >= 64) n = 63;
+    bool hires = fb->width == DISPLAY_WIDTH;
+
+    for(int p = 0; p < DISPLAY_PLANES; p++) {
+        if (!(planes & (1 << p))) continue;
+        for(int y = 0; y < fb->height; y++) {
+            uint64_t* row = fb->rows[p][y];
+            // in lo-res the bits shifted out of word 0 leave the screen
+            if (hires) row[1] = (row[1] >> n) | (row[0] << (64 - n));
+            row[0] >>= n;
+        }
+    }
+}
+
+void renderFramebuffer(const FRAMEBUFFER* fb, uint32_t* pixels, int pitch, const uint32_t* palette) {
+    int scale = DISPLAY_WIDTH / fb->width;
+    for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+        uint32_t* line = (uint32_t*) ((uint8_t*) pixels + y*pitch);
+        const uint64_t* plane0 = fb->rows[0][y / scale];
+        const uint64_t* plane1 = fb->rows[1][y / scale];
+        for (int x = 0; x < DISPLAY_WIDTH; x++) {
+            int fx = x / scale;
+            int bit = 63 - (fx & 63);
+            int color = ((plane0[fx >> 6] >> bit) & 1) | (((plane1[fx >> 6] >> bit) & 1) << 1);
+            line[x] = palette[color];
+        }
+    }
+}
+
+// FNV-1a over whole rows (with an extra shift so high bits reach the low ones)
+// a monochrome lo-res screen hashes only its 32 words, so its hash doesn't depend on the unused area
+uint64_t hashFramebuffer(const FRAMEBUFFER* fb) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    int words = fb->width / 64;
+
+    for(int p = 0; p < DISPLAY_PLANES; p++) {
+        if (p > 0) {
+            // planes above 0 are mixed in only when they have something on
+            bool empty = true;
+            for(int i = 0; i < fb->height && empty; i++)
+                for(int w = 0; w < words; w++) if (fb->rows[p][i][w] != 0) empty = false;
+            if (empty) continue;
+            hash ^= p;
+        }
+
+        for(int i = 0; i < fb->height; i++) {
+            for(int w = 0; w < words; w++) {
+                hash ^= fb->rows[p][i][w];
+                hash *= 0x100000001b3ULL;
+                hash ^= hash >> 29;
+            }
+        }
+    }
+
+    if (fb->width == DISPLAY_WIDTH) hash ^= 0x9E3779B97F4A7C15ULL;
+    return hash;
+}
+
+/*
+    DEBUG
+*/
+
+void printFramebuffer(const FRAMEBUFFER* fb) {
+    for(int i = 0; i < fb->height; i++) {
+        for (int j = 0; j < fb->width; j++) {
+            uint8_t c = getPixelColor(fb, j, i);
+            if (c)
+                printf("%c", c == 1 ? '*' : (c == 2 ? '+' : '#'));
+            else
+                printf("-");
+        }
+        printf("\n");
+    }
+}
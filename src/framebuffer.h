@@ -0,0 +1,77 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DISPLAY_WIDTH 128 // hi-res size (lo-res uses the top-left 64 x 32)
+#define DISPLAY_HEIGHT 64
+#define LORES_WIDTH 64
+#define LORES_HEIGHT 32
+#define DISPLAY_PLANES 2 // XO-CHIP bit planes (a pixel's color is the set of planes where it is on)
+#define ROW_WORDS (DISPLAY_WIDTH/64)
+
+// plain framebuffer (no SDL), owned by the interpreter core
+// bit-packed: each row of a plane is ROW_WORDS uint64_t, the most significant bit of word 0 is x = 0
+// (bits outside the current resolution are always 0)
+typedef struct framebuffer_ {
+    uint64_t rows[DISPLAY_PLANES][DISPLAY_HEIGHT][ROW_WORDS];
+    uint8_t width, height; // current resolution: 64 x 32 or 128 x 64
+} FRAMEBUFFER;
+
+void cleanFramebuffer(FRAMEBUFFER* fb);
+void clearPlanes(FRAMEBUFFER* fb, uint8_t planes);
+void setResolution(FRAMEBUFFER* fb, bool hires);
+void changePixelColor(FRAMEBUFFER* fb, int x, int y, bool c);
+uint8_t getPixelColor(const FRAMEBUFFER* fb, int x, int y); // bit p set -> on in plane p
+
+// whole-row scrolls of the planes in the mask (n pixels of the current resolution)
+void scrollDown(FRAMEBUFFER* fb, uint8_t planes, int n);
+void scrollUp(FRAMEBUFFER* fb, uint8_t planes, int n);
+void scrollLeft(FRAMEBUFFER* fb, uint8_t planes, int n);
+void scrollRight(FRAMEBUFFER* fb, uint8_t planes, int n);
+
+// XORs a sprite row (width 8 or 16, most significant bit first) at (x, y) of one plane
+// pixels past the right edge are clipped, or wrapped around to the left when wrap is set
+// returns true if some pixel was turned off (collision)
+static inline bool xorSpriteRow(FRAMEBUFFER* fb, int plane, int x, int y, uint16_t sprite, int sprite_width, bool wrap) {
+    uint64_t bits = (uint64_t) sprite << (64 - sprite_width);
+    uint64_t* row = fb->rows[plane][y];
+
+    if (fb->width == LORES_WIDTH) {
+        uint64_t w0 = bits >> x;
+        if (wrap && x != 0) w0 |= bits << (64 - x);
+
+        bool collision = (row[0] & w0) != 0;
+        row[0] ^= w0;
+        return collision;
+    }
+
+    uint64_t w0, w1, spill;
+    if (x < 64) {
+        w0 = bits >> x;
+        w1 = x != 0 ? bits << (64 - x) : 0;
+        spill = 0;
+    } else {
+        w0 = 0;
+        w1 = bits >> (x - 64);
+        spill = x != 64 ? bits << (128 - x) : 0;
+    }
+    if (wrap) w0 |= spill;
+
+    bool collision = ((row[0] & w0) | (row[1] & w1)) != 0;
+    row[0] ^= w0;
+    row[1] ^= w1;
+    return collision;
+}
+
+// expands the framebuffer to DISPLAY_WIDTH x DISPLAY_HEIGHT 32-bit pixels (pitch in bytes), lo-res doubled in both directions
+// palette is indexed by the set of planes a pixel is on in
+void renderFramebuffer(const FRAMEBUFFER* fb, uint32_t* pixels, int pitch, const uint32_t* palette);
+
+// 64-bit content hash (equal framebuffers always hash equal)
+uint64_t hashFramebuffer(const FRAMEBUFFER* fb);
+
+void printFramebuffer(const FRAMEBUFFER* fb);
+
+#endif
@@ -0,0 +1,533 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "jit.h"
+#include "chip8_internal.h"
+
+/*
+ BASIC-BLOCK RECOMPILER (x86-64)
+
+ A block is a run of straight-line instructions starting at some PC. It ends
+ at 1NNN/2NNN/00EE/BNNN or a skip (all compiled), or right before an
+ instruction the recompiler leaves to the interpreter (DXYN, FX0A, timers/keys
+ with side effects, stores to memory, ...). Generated code follows the SysV
+ ABI: void block(CHIP8* chip8), with chip8 in rdi, and keeps every CHIP-8
+ register in memory, so leaving a block needs no state write-back.
+*/
+
+#if defined(__x86_64__) && !defined(NO_JIT)
+
+#include <sys/mman.h>
+
+#define CODE_SIZE (1 << 20)
+#define MAX_BLOCK_LENGTH 64
+
+#define NO_BLOCK -1 // not compiled yet
+#define NOT_COMPILABLE -2 // the first instruction is left to the interpreter
+
+typedef void (*BLOCK_ENTRY)(CHIP8* chip8);
+
+typedef struct block_ {
+    BLOCK_ENTRY entry;
+    uint16_t start, end; // [start, end) bytes of CHIP-8 code
+    uint16_t length; // number of CHIP-8 instructions
+} BLOCK;
+
+struct jit_ {
+    int mode;
+
+    // executable code buffer
+    uint8_t* code;
+    size_t code_used;
+
+    BLOCK blocks[MEMORY_SIZE];
+    int block_count;
+    int16_t block_at[MEMORY_SIZE]; // block index starting at each address (or NO_BLOCK / NOT_COMPILABLE)
+
+    bool covered[MEMORY_SIZE]; // bytes read by some compiled block
+    bool written[MEMORY_SIZE]; // bytes stored to at runtime (never compiled again)
+
+    // interpreter copy used by JIT_CROSSCHECK
+    CHIP8* shadow;
+};
+
+/*
+    EMITTER
+*/
+
+// register numbers used in ModRM
+#define AL 0
+#define CL 1
+
+#define V_OFF(r) ((int32_t) (offsetof(CHIP8, v) + (r)))
+#define PC_OFF ((int32_t) offsetof(CHIP8, pc))
+#define IDX_OFF ((int32_t) offsetof(CHIP8, idx))
+#define SP_OFF ((int32_t) offsetof(CHIP8, sp))
+#define DT_OFF ((int32_t) offsetof(CHIP8, delay_timer))
+#define STACK_OFF ((int32_t) offsetof(CHIP8, stack))
+
+static void emit8(JIT* jit, uint8_t b) {
+    jit->code[jit->code_used++] = b;
+}
+
+static void emit16(JIT* jit, uint16_t w) {
+    emit8(jit, w & 0xff);
+    emit8(jit, w >> 8);
+}
+
+static void emit32(JIT* jit, uint32_t d) {
+    emit16(jit, d & 0xffff);
+    emit16(jit, d >> 16);
+}
+
+// <opcode> with a [rdi + disp32] operand (mod=10, rm=rdi) and reg field r
+static void emitMem(JIT* jit, uint8_t opcode, int r, int32_t disp) {
+    emit8(jit, opcode);
+    emit8(jit, 0x80 | (r << 3) | 7);
+    emit32(jit, disp);
+}
+
+// mov byte [m], imm8
+static void emitStoreImm8(JIT* jit, int32_t disp, uint8_t imm) {
+    emitMem(jit, 0xC6, 0, disp);
+    emit8(jit, imm);
+}
+
+// mov word [m], imm16 (9 bytes)
+static void emitStoreImm16(JIT* jit, int32_t disp, uint16_t imm) {
+    emit8(jit, 0x66);
+    emitMem(jit, 0xC7, 0, disp);
+    emit16(jit, imm);
+}
+
+// movzx eax, byte [m]
+static void emitLoadZx(JIT* jit, int32_t disp) {
+    emit8(jit, 0x0F);
+    emitMem(jit, 0xB6, AL, disp);
+}
+
+// mov word [pc], next; ret
+static void emitExit(JIT* jit, uint16_t next) {
+    emitStoreImm16(jit, PC_OFF, next);
+    emit8(jit, 0xC3);
+}
+
+// pc = next, or next+2 when the condition flags say "skip" (jcc_no_skip is the inverse condition)
+static void emitSkip(JIT* jit, uint8_t jcc_no_skip, uint16_t next) {
+    emit8(jit, jcc_no_skip);
+    emit8(jit, 10); // size of mov word [pc], imm16 (9) + ret (1)
+    emitExit(jit, next+2);
+    emitExit(jit, next);
+}
+
+/*
+    TRANSLATOR
+*/
+
+// emits inst (at address pc) and returns false if it has to be left to the interpreter;
+// *ends_block is set when the instruction transfers control
+static bool translate(JIT* jit, const QUIRKS* quirks, uint16_t inst, uint16_t pc, bool* ends_block) {
+    uint8_t x = (inst >> 8) & 0xf;
+    uint8_t y = (inst >> 4) & 0xf;
+    uint8_t n = inst & 0xf;
+    uint8_t nn = inst & 0xff;
+    uint16_t nnn = inst & 0xfff;
+    uint16_t next = pc + 2;
+
+    *ends_block = false;
+
+    switch (inst >> 12) {
+        case 0x0:
+            if (nnn == 0x0EE) {
+                // 00EE: pc = stack[sp % STACK_SIZE]; sp++
+                emitLoadZx(jit, SP_OFF);
+                emitMem(jit, 0xFE, 0, SP_OFF); // inc byte [sp]
+                emit8(jit, 0x83); emit8(jit, 0xE0); emit8(jit, STACK_SIZE-1); // and eax, STACK_SIZE-1
+                emit8(jit, 0x0F); emit8(jit, 0xB7); emit8(jit, 0x8C); emit8(jit, 0x47); emit32(jit, STACK_OFF); // movzx ecx, word [rdi+rax*2+stack]
+                emit8(jit, 0x66); emitMem(jit, 0x89, CL, PC_OFF); // mov [pc], cx
+                emit8(jit, 0xC3);
+                *ends_block = true;
+                return true;
+            }
+            // 0000 ends the program, 00E0 draws, SUPER-CHIP 00CN / 00FB - 00FF scroll, exit or switch resolution
+            if (inst == 0 || nnn == 0x0E0 || (nnn & 0xFF0) == 0x0C0 || nnn >= 0x0FB) return false;
+            // other 0NNN are ignored by the interpreter
+            return true;
+
+        case 0x1:
+            emitExit(jit, nnn);
+            *ends_block = true;
+            return true;
+
+        case 0x2:
+            // sp--; stack[sp % STACK_SIZE] = next; pc = nnn
+            emitMem(jit, 0xFE, 1, SP_OFF); // dec byte [sp]
+            emitLoadZx(jit, SP_OFF);
+            emit8(jit, 0x83); emit8(jit, 0xE0); emit8(jit, STACK_SIZE-1); // and eax, STACK_SIZE-1
+            emit8(jit, 0x66); emit8(jit, 0xC7); emit8(jit, 0x84); emit8(jit, 0x47); emit32(jit, STACK_OFF); emit16(jit, next); // mov word [rdi+rax*2+stack], next
+            emitExit(jit, nnn);
+            *ends_block = true;
+            return true;
+
+        case 0x3:
+        case 0x4:
+            emitMem(jit, 0x80, 7, V_OFF(x)); emit8(jit, nn); // cmp byte [vx], nn
+            emitSkip(jit, (inst >> 12) == 0x3 ? 0x75 : 0x74, next); // jne / je
+            *ends_block = true;
+            return true;
+
+        case 0x5:
+        case 0x9:
+            emitMem(jit, 0x8A, AL, V_OFF(x)); // mov al, [vx]
+            emitMem(jit, 0x3A, AL, V_OFF(y)); // cmp al, [vy]
+            emitSkip(jit, (inst >> 12) == 0x5 ? 0x75 : 0x74, next);
+            *ends_block = true;
+            return true;
+
+        case 0x6:
+            emitStoreImm8(jit, V_OFF(x), nn);
+            return true;
+
+        case 0x7:
+            emitMem(jit, 0x80, 0, V_OFF(x)); emit8(jit, nn); // add byte [vx], nn
+            return true;
+
+        case 0x8:
+            switch (n) {
+                case 0x0:
+                    emitMem(jit, 0x8A, AL, V_OFF(y));
+                    emitMem(jit, 0x88, AL, V_OFF(x));
+                    return true;
+
+                case 0x1:
+                case 0x2:
+                case 0x3:
+                    emitMem(jit, 0x8A, AL, V_OFF(y));
+                    emitMem(jit, n == 0x1 ? 0x08 : (n == 0x2 ? 0x20 : 0x30), AL, V_OFF(x)); // or / and / xor [vx], al
+                    if (quirks->vf_reset) emitStoreImm8(jit, V_OFF(15), 0);
+                    return true;
+
+                case 0x4:
+                    emitMem(jit, 0x8A, AL, V_OFF(x));
+                    emitMem(jit, 0x02, AL, V_OFF(y)); // add al, [vy]
+                    emit8(jit, 0x0F); emit8(jit, 0x92); emit8(jit, 0xC1); // setc cl
+                    emitMem(jit, 0x88, AL, V_OFF(x));
+                    emitMem(jit, 0x88, CL, V_OFF(15));
+                    return true;
+
+                case 0x5:
+                case 0x7:
+                    emitMem(jit, 0x8A, AL, V_OFF(n == 0x5 ? x : y));
+                    emitMem(jit, 0x2A, AL, V_OFF(n == 0x5 ? y : x)); // sub al, [..]
+                    emit8(jit, 0x0F); emit8(jit, 0x93); emit8(jit, 0xC1); // setnc cl
+                    emitMem(jit, 0x88, AL, V_OFF(x));
+                    emitMem(jit, 0x88, CL, V_OFF(15));
+                    return true;
+
+                case 0x6:
+                case 0xE:
+                    emitMem(jit, 0x8A, AL, V_OFF(quirks->shift_vy ? y : x));
+                    emit8(jit, 0x88); emit8(jit, 0xC1); // mov cl, al
+                    if (n == 0x6) {
+                        emit8(jit, 0x80); emit8(jit, 0xE1); emit8(jit, 0x01); // and cl, 1
+                        emit8(jit, 0xD0); emit8(jit, 0xE8); // shr al, 1
+                    } else {
+                        emit8(jit, 0xC0); emit8(jit, 0xE9); emit8(jit, 0x07); // shr cl, 7
+                        emit8(jit, 0xD0); emit8(jit, 0xE0); // shl al, 1
+                    }
+                    if (x != 15) emitMem(jit, 0x88, AL, V_OFF(x));
+                    emitMem(jit, 0x88, CL, V_OFF(15));
+                    return true;
+
+                default:
+                    return true; // ignored by the interpreter
+            }
+
+        case 0xA:
+            emitStoreImm16(jit, IDX_OFF, nnn);
+            return true;
+
+        case 0xB:
+            // BNNN adds v[0], BXNN (schip) adds v[X]
+            emitLoadZx(jit, V_OFF(quirks->jump_vx ? x : 0));
+            emit8(jit, 0x05); emit32(jit, nnn); // add eax, nnn
+            emit8(jit, 0x66); emitMem(jit, 0x89, AL, PC_OFF); // mov [pc], ax
+            emit8(jit, 0xC3);
+            *ends_block = true;
+            return true;
+
+        case 0xF:
+            switch (nn) {
+                case 0x07:
+                    emitMem(jit, 0x8A, AL, DT_OFF);
+                    emitMem(jit, 0x88, AL, V_OFF(x));
+                    return true;
+
+                case 0x15:
+                    emitMem(jit, 0x8A, AL, V_OFF(x));
+                    emitMem(jit, 0x88, AL, DT_OFF);
+                    return true;
+
+                case 0x1E:
+                    emitLoadZx(jit, V_OFF(x));
+                    emit8(jit, 0x66); emitMem(jit, 0x03, AL, IDX_OFF); // add ax, [idx]
+                    emit8(jit, 0x66); emitMem(jit, 0x89, AL, IDX_OFF); // mov [idx], ax
+                    emit8(jit, 0x66); emit8(jit, 0x3D); emit16(jit, 0x0FFF); // cmp ax, 0x0FFF
+                    emit8(jit, 0x76); emit8(jit, 7); // jbe over the flag store
+                    emitStoreImm8(jit, V_OFF(15), 1);
+                    return true;
+
+                case 0x29:
+                    emitLoadZx(jit, V_OFF(x));
+                    emit8(jit, 0x8D); emit8(jit, 0x04); emit8(jit, 0x80); // lea eax, [rax+rax*4]
+                    emit8(jit, 0x66); emitMem(jit, 0x89, AL, IDX_OFF);
+                    return true;
+
+                default:
+                    // FX0A, FX18 (sound event), FX33/FX55 (stores), FX65 and unknown
+                    return false;
+            }
+
+        default:
+            // CXNN (random), DXYN (draw), EX9E/EXA1 (keys)
+            return false;
+    }
+}
+
+// compiles the block starting at pc (returns its index or NOT_COMPILABLE)
+static int compileBlock(JIT* jit, CHIP8* chip8, uint16_t pc) {
+    // worst case: MAX_BLOCK_LENGTH instructions of at most 40 bytes each + exit
+    if (jit->code_used + MAX_BLOCK_LENGTH*40 + 16 > CODE_SIZE || jit->block_count == MEMORY_SIZE) {
+        flushJit(jit);
+    }
+
+    size_t start_used = jit->code_used;
+    uint16_t addr = pc;
+    uint16_t length = 0;
+    bool ends_block = false;
+
+    while (length < MAX_BLOCK_LENGTH && addr + 1 < MEMORY_SIZE) {
+        // self-modified code stays in the interpreter
+        if (jit->written[addr] || jit->written[addr+1]) break;
+
+        uint16_t inst = (chip8->memory[addr] << 8)|chip8->memory[addr+1];
+        size_t before = jit->code_used;
+        if (!translate(jit, &chip8->profile->quirks, inst, addr, &ends_block)) {
+            jit->code_used = before;
+            break;
+        }
+
+        addr += 2;
+        length++;
+        if (ends_block) break;
+    }
+
+    if (length == 0) {
+        jit->code_used = start_used;
+        jit->block_at[pc] = NOT_COMPILABLE;
+        return NOT_COMPILABLE;
+    }
+
+    if (!ends_block) emitExit(jit, addr);
+
+    BLOCK* block = &jit->blocks[jit->block_count];
+    block->entry = (BLOCK_ENTRY) (void*) (jit->code + start_used);
+    block->start = pc;
+    block->end = addr;
+    block->length = length;
+
+    for(int i = pc; i < addr; i++) jit->covered[i] = true;
+
+    jit->block_at[pc] = jit->block_count;
+    return jit->block_count++;
+}
+
+static const BLOCK* lookupBlock(JIT* jit, CHIP8* chip8) {
+    uint16_t pc = chip8->pc;
+    if (pc >= MEMORY_SIZE - 1) return NULL;
+
+    int index = jit->block_at[pc];
+    if (index == NO_BLOCK) index = compileBlock(jit, chip8, pc);
+    if (index == NOT_COMPILABLE) return NULL;
+
+    return &jit->blocks[index];
+}
+
+/*
+    CROSS-CHECK
+*/
+
+static void reportMismatch(const char* what, const BLOCK* block, CHIP8* jit_state, CHIP8* interp_state) {
+    fprintf(stderr, "JIT MISMATCH (%s) in block %03X-%03X (%d instructions)\n", what, block->start, block->end, block->length);
+    fprintf(stderr, "  jit:    pc=%03X idx=%03X sp=%d dt=%d", jit_state->pc, jit_state->idx, jit_state->sp, jit_state->delay_timer);
+    for(int i = 0; i < 16; i++) fprintf(stderr, " v%X=%02X", i, jit_state->v[i]);
+    fprintf(stderr, "\n  interp: pc=%03X idx=%03X sp=%d dt=%d", interp_state->pc, interp_state->idx, interp_state->sp, interp_state->delay_timer);
+    for(int i = 0; i < 16; i++) fprintf(stderr, " v%X=%02X", i, interp_state->v[i]);
+    fprintf(stderr, "\n");
+    abort();
+}
+
+// runs the block natively and the same instructions through the interpreter on a copy
+static void runCrossChecked(JIT* jit, const BLOCK* block, CHIP8* chip8) {
+    CHIP8* shadow = jit->shadow;
+    DECODED* shadow_cache = shadow->decode_cache;
+    uint16_t shadow_generation = shadow->cache_generation;
+    uint8_t* shadow_memory = shadow->memory; // 4kb: the recompiler only runs 4kb profiles
+
+    *shadow = *chip8;
+    shadow->memory = shadow_memory;
+    memcpy(shadow->memory, chip8->memory, MEMORY_SIZE);
+    shadow->decode_cache = shadow_cache;
+    shadow->cache_generation = shadow_generation + 1; // the copied memory may differ from the cached one
+    if (shadow->cache_generation == 0) {
+        memset(shadow_cache, 0, MEMORY_SIZE*sizeof(DECODED));
+        shadow->cache_generation = 1;
+    }
+    shadow->jit = NULL;
+    shadow->profiler = NULL;
+
+    for(int i = 0; i < block->length; i++) executeInstruction(shadow);
+    block->entry(chip8);
+    chip8->cycles += block->length;
+
+    if (chip8->pc != shadow->pc) reportMismatch("pc", block, chip8, shadow);
+    if (chip8->idx != shadow->idx) reportMismatch("idx", block, chip8, shadow);
+    if (chip8->sp != shadow->sp) reportMismatch("sp", block, chip8, shadow);
+    if (chip8->delay_timer != shadow->delay_timer) reportMismatch("delay timer", block, chip8, shadow);
+    if (memcmp(chip8->v, shadow->v, sizeof(chip8->v)) != 0) reportMismatch("registers", block, chip8, shadow);
+    if (memcmp(chip8->stack, shadow->stack, sizeof(chip8->stack)) != 0) reportMismatch("stack", block, chip8, shadow);
+    if (memcmp(chip8->memory, shadow->memory, MEMORY_SIZE) != 0) reportMismatch("memory", block, chip8, shadow);
+    // (compiled jumps don't flag idle loop candidates, only the interpreter skips idle loops)
+    if ((shadow->events & ~EVENT_LOOP) != (chip8->events & ~EVENT_LOOP)) reportMismatch("events", block, chip8, shadow);
+}
+
+/*
+    RUN LOOP
+*/
+
+// runCycles with compiled blocks (a block only runs if it fits in the remaining budget)
+uint8_t runJit(CHIP8* chip8, uint32_t n, uint8_t stop_on) {
+    JIT* jit = chip8->jit;
+
+    stop_on |= EVENT_KEY_WAIT | EVENT_HALT;
+    while (n > 0) {
+        const BLOCK* block = lookupBlock(jit, chip8);
+
+        if (block != NULL && block->length <= n) {
+            // compiled code raises no events
+            if (jit->mode == JIT_CROSSCHECK) {
+                runCrossChecked(jit, block, chip8);
+            } else {
+                block->entry(chip8);
+                chip8->cycles += block->length;
+            }
+            n -= block->length;
+            continue;
+        }
+
+        executeInstruction(chip8);
+        n--;
+        if (chip8->events & stop_on) break;
+    }
+
+    return chip8->events & ~EVENT_LOOP;
+}
+
+bool enableJit(CHIP8* chip8, int mode) {
+    if (mode == JIT_OFF) {
+        if (chip8->jit != NULL) freeJit(chip8->jit);
+        chip8->jit = NULL;
+        return true;
+    }
+
+    if (chip8->jit != NULL) {
+        chip8->jit->mode = mode;
+        return true;
+    }
+
+    JIT* jit = (JIT*) calloc(1, sizeof(JIT));
+    if (jit == NULL) return false;
+
+    jit->code = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        free(jit);
+        return false;
+    }
+
+    jit->shadow = createInterpreter();
+    if (jit->shadow == NULL) {
+        munmap(jit->code, CODE_SIZE);
+        free(jit);
+        return false;
+    }
+
+    jit->mode = mode;
+    flushJit(jit);
+
+    chip8->jit = jit;
+    return true;
+}
+
+// compiles the block at pc ahead of its first run (prewarmInterpreter)
+void prewarmJit(JIT* jit, CHIP8* chip8, uint16_t pc) {
+    if (chip8->memory_mask != MEMORY_SIZE-1 || pc >= MEMORY_SIZE - 1) return;
+    if (jit->block_at[pc] == NO_BLOCK) compileBlock(jit, chip8, pc);
+}
+
+// drops every compiled block
+void flushJit(JIT* jit) {
+    jit->code_used = 0;
+    jit->block_count = 0;
+    for(int i = 0; i < MEMORY_SIZE; i++) jit->block_at[i] = NO_BLOCK;
+    memset(jit->covered, 0, sizeof(jit->covered));
+}
+
+// a store hit [addr, addr+len): those bytes are never compiled again, and blocks reading them are dropped
+void invalidateJit(JIT* jit, uint16_t addr, uint16_t len) {
+    bool hit = false;
+
+    for(int i = 0; i < len; i++) {
+        uint16_t a = (addr+i) & (MEMORY_SIZE-1);
+        jit->written[a] = true;
+        if (jit->covered[a]) hit = true;
+    }
+
+    if (hit) flushJit(jit);
+}
+
+void freeJit(JIT* jit) {
+    munmap(jit->code, CODE_SIZE);
+    freeInterpreter(jit->shadow);
+    free(jit);
+}
+
+#else
+
+// no recompiler for this architecture: everything runs in the interpreter
+
+bool enableJit(CHIP8* chip8, int mode) {
+    return mode == JIT_OFF;
+}
+
+uint8_t runJit(CHIP8* chip8, uint32_t n, uint8_t stop_on) {
+    return EVENT_NONE;
+}
+
+void invalidateJit(JIT* jit, uint16_t addr, uint16_t len) {
+}
+
+void prewarmJit(JIT* jit, CHIP8* chip8, uint16_t pc) {
+}
+
+void flushJit(JIT* jit) {
+}
+
+void freeJit(JIT* jit) {
+}
+
+#endif
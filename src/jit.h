@@ -0,0 +1,16 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+
+#include "chip8.h"
+
+// optional x86-64 basic-block recompiler for runCycles
+#define JIT_OFF 0
+#define JIT_ON 1
+#define JIT_CROSSCHECK 2 // every block is also run through the interpreter and compared (aborts on mismatch)
+
+// returns false if the recompiler is not available (other architectures / no executable memory)
+bool enableJit(CHIP8* chip8, int mode);
+
+#endif
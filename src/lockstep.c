@@ -0,0 +1,662 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lockstep.h"
+#include "chip8_internal.h"
+
+/*
+ LOCKSTEP ENGINE
+ the machines (lanes) live in slots of struct-of-arrays: element r of slot s is at [r*capacity + s]
+ slots are stepped in blocks of LANE_BLOCK: the lanes of a block that fetched the same opcode form a group,
+ decoded once and run over the whole block with the other lanes masked off
+ (the block loops are branch-free selects, so the compiler turns them into vector code)
+ lanes that diverge split their block into more groups: every REGROUP_STEPS steps the slots are sorted by PC
+ so that lanes running the same code share blocks again (memory stays put, indexed by lane)
+*/
+
+#define LANE_BLOCK 32 // slots per block: one AVX2 register of 8-bit registers
+#define REGROUP_STEPS 256
+#define MAX_LANE_ARRAYS 32
+#define ADDRESS_MASK (MEMORY_SIZE-1)
+
+// the kernels are built for AVX2 and for the baseline, the loader picks the one the CPU runs
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define LANE_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define LANE_KERNEL
+#endif
+
+// slot arrays: rows of capacity elements, moved along with the lanes when they are regrouped (if moves is set)
+typedef struct lane_array_ {
+    void* data;
+    size_t element_size;
+    int rows;
+    bool moves;
+} LANE_ARRAY;
+
+struct lockstep_ {
+    const PROFILE* profile;
+    int lanes, capacity; // capacity is lanes rounded up to whole blocks (the padding slots never run)
+
+    // machine state by slot
+    uint8_t* v; // [16][capacity]
+    uint16_t *pc, *idx;
+    uint16_t* stack; // [STACK_SIZE][capacity]
+    uint8_t *sp, *dt, *st;
+    uint16_t* keys;
+    uint64_t* rng;
+    uint64_t* fb; // [LORES_HEIGHT][capacity] packed lo-res rows (like FRAMEBUFFER's plane 0)
+    uint8_t *state, *key_register, *drawn;
+    uint64_t* cycles;
+    uint32_t* lane; // lane held by the slot
+
+    // memory by lane (4 KB each) and slot of every lane
+    uint8_t* memory;
+    uint32_t* slot;
+
+    // instructions of the loaded image, decoded once: used while no lane has written to their addresses
+    DECODED* code;
+    uint8_t* code_kind;
+    uint8_t* written;
+
+    // regrouping scratch
+    uint64_t* order;
+    uint8_t* moved;
+
+    LANE_ARRAY arrays[MAX_LANE_ARRAYS];
+    int array_count;
+    bool out_of_memory;
+
+    // groups run and block steps taken (in total and when the slots were last regrouped)
+    uint64_t groups, block_steps;
+    uint64_t regroup_groups, regroup_block_steps;
+    uint32_t since_regroup;
+};
+
+static inline uint8_t* laneMemory(LOCKSTEP* ls, uint32_t lane) {
+    return ls->memory + (size_t) lane * MEMORY_SIZE;
+}
+
+static void* addLaneArray(LOCKSTEP* ls, size_t element_size, int rows, bool moves) {
+    void* data = calloc((size_t) rows * ls->capacity, element_size);
+    if (data == NULL) {
+        ls->out_of_memory = true;
+        return NULL;
+    }
+
+    ls->arrays[ls->array_count++] = (LANE_ARRAY) {data, element_size, rows, moves};
+    return data;
+}
+
+// the instruction the engine runs for kind, OP_COUNT if it doesn't handle it
+// (extended instructions that keep a CHIP-8 meaning in the profile run as that: ignored 0NNN, DXY0 as DXYN...)
+static INSTRUCTION laneKind(const PROFILE* profile, INSTRUCTION kind) {
+    if (kind <= OP_FX65) return kind;
+
+    for(int k = OP_NOP; k <= OP_FX65; k++) {
+        if (profile->handlers[k] == profile->handlers[kind]) return k;
+    }
+    return OP_COUNT;
+}
+
+LOCKSTEP* createLockstep(int lanes, const uint8_t* rom, size_t size, const char* quirks) {
+    if (lanes <= 0) return NULL;
+
+    // every lane starts from the memory of a freshly loaded machine (font and ROM)
+    CHIP8* chip8 = createInterpreter();
+    if (chip8 == NULL) return NULL;
+    if (!setQuirkProfile(chip8, quirks) || chip8->profile->memory_size != MEMORY_SIZE || !loadProgram(chip8, rom, size)) {
+        freeInterpreter(chip8);
+        return NULL;
+    }
+
+    LOCKSTEP* ls = (LOCKSTEP*) calloc(1, sizeof(LOCKSTEP));
+    if (ls == NULL) {
+        freeInterpreter(chip8);
+        return NULL;
+    }
+
+    ls->profile = chip8->profile;
+    ls->lanes = lanes;
+    ls->capacity = (lanes + LANE_BLOCK-1) / LANE_BLOCK * LANE_BLOCK;
+
+    ls->v = (uint8_t*) addLaneArray(ls, sizeof(uint8_t), 16, true);
+    ls->pc = (uint16_t*) addLaneArray(ls, sizeof(uint16_t), 1, true);
+    ls->idx = (uint16_t*) addLaneArray(ls, sizeof(uint16_t), 1, true);
+    ls->stack = (uint16_t*) addLaneArray(ls, sizeof(uint16_t), STACK_SIZE, true);
+    ls->sp = (uint8_t*) addLaneArray(ls, sizeof(uint8_t), 1, true);
+    ls->dt = (uint8_t*) addLaneArray(ls, sizeof(uint8_t), 1, true);
+    ls->st = (uint8_t*) addLaneArray(ls, sizeof(uint8_t), 1, true);
+    ls->keys = (uint16_t*) addLaneArray(ls, sizeof(uint16_t), 1, true);
+    ls->rng = (uint64_t*) addLaneArray(ls, sizeof(uint64_t), 1, true);
+    ls->fb = (uint64_t*) addLaneArray(ls, sizeof(uint64_t), LORES_HEIGHT, true);
+    ls->state = (uint8_t*) addLaneArray(ls, sizeof(uint8_t), 1, true);
+    ls->key_register = (uint8_t*) addLaneArray(ls, sizeof(uint8_t), 1, true);
+    ls->drawn = (uint8_t*) addLaneArray(ls, sizeof(uint8_t), 1, true);
+    ls->cycles = (uint64_t*) addLaneArray(ls, sizeof(uint64_t), 1, true);
+    ls->lane = (uint32_t*) addLaneArray(ls, sizeof(uint32_t), 1, true);
+
+    ls->slot = (uint32_t*) addLaneArray(ls, sizeof(uint32_t), 1, false);
+    ls->order = (uint64_t*) addLaneArray(ls, sizeof(uint64_t), 1, false);
+    ls->moved = (uint8_t*) addLaneArray(ls, sizeof(uint64_t), 1, false);
+
+    // (the padding slots get a memory too, blocks fetch for every slot)
+    ls->memory = (uint8_t*) calloc(ls->capacity, MEMORY_SIZE);
+    ls->code = (DECODED*) malloc(MEMORY_SIZE * sizeof(DECODED));
+    ls->code_kind = (uint8_t*) malloc(MEMORY_SIZE);
+    ls->written = (uint8_t*) calloc(MEMORY_SIZE, 1);
+    if (ls->memory == NULL || ls->code == NULL || ls->code_kind == NULL || ls->written == NULL || ls->out_of_memory) {
+        freeInterpreter(chip8);
+        freeLockstep(ls);
+        return NULL;
+    }
+
+    for(int s = 0; s < ls->capacity; s++) {
+        ls->pc[s] = chip8->pc;
+        ls->sp[s] = chip8->sp;
+        ls->rng[s] = chip8->rng;
+        ls->lane[s] = s;
+        ls->slot[s] = s;
+        ls->state[s] = s < lanes ? LANE_RUNNING : LANE_ENDED;
+    }
+    for(int lane = 0; lane < lanes; lane++) memcpy(laneMemory(ls, lane), chip8->memory, MEMORY_SIZE);
+
+    for(int addr = 0; addr < MEMORY_SIZE; addr++) {
+        uint16_t inst = (chip8->memory[addr] << 8) | chip8->memory[(addr+1) & ADDRESS_MASK];
+        ls->code_kind[addr] = laneKind(ls->profile, decodeInstruction(ls->profile, inst, &ls->code[addr]));
+    }
+
+    freeInterpreter(chip8);
+    return ls;
+}
+
+void seedLane(LOCKSTEP* ls, int lane, uint64_t seed) {
+    ls->rng[ls->slot[lane]] = randomState(seed);
+}
+
+// same as setKeys: FX0A finishes on the first key released
+void setLaneKeys(LOCKSTEP* ls, int lane, uint16_t mask) {
+    uint32_t s = ls->slot[lane];
+    uint16_t changed = ls->keys[s] ^ mask;
+
+    for(int i = 0; i < 16; i++) {
+        uint16_t bit = 1 << i;
+        if (!(changed & bit)) continue;
+
+        bool was_pressed = ls->keys[s] & bit;
+        ls->keys[s] ^= bit;
+        if (ls->state[s] == LANE_WAITING && was_pressed) {
+            ls->v[ls->key_register[s]*ls->capacity + s] = i;
+            ls->state[s] = LANE_RUNNING;
+        }
+    }
+}
+
+/*
+    GROUP KERNELS
+ one block at a time: the slot arrays are passed as restrict pointers to the block, so the LANE_BLOCK loops
+ vectorize without runtime alias checks (m[j] selects the lanes of the group)
+*/
+
+#define LANES(j) for(int j = 0; j < LANE_BLOCK; j++)
+
+static inline void select8(uint8_t* restrict dst, const uint8_t* restrict src, const uint8_t* restrict m) {
+    LANES(j) {
+        uint8_t value = src[j];
+        dst[j] = m[j] ? value : dst[j];
+    }
+}
+
+static inline void select16(uint16_t* restrict dst, const uint16_t* restrict src, const uint8_t* restrict m) {
+    LANES(j) {
+        uint16_t value = src[j];
+        dst[j] = m[j] ? value : dst[j];
+    }
+}
+
+// the fetch: pc += 2 and one more instruction executed
+static inline void advanceLanes(uint16_t* restrict pc, uint64_t* restrict cycles, const uint8_t* restrict m) {
+    LANES(j) {
+        pc[j] += m[j] ? 2 : 0;
+        cycles[j] += m[j];
+    }
+}
+
+// pc += 2 where the condition held
+static inline void skipLanes(uint16_t* restrict pc, const uint8_t* restrict skip, const uint8_t* restrict m) {
+    LANES(j) pc[j] += (m[j] & skip[j]) ? 2 : 0;
+}
+
+static inline void markDrawnLanes(uint8_t* restrict drawn, const uint8_t* restrict m) {
+    LANES(j) drawn[j] |= m[j];
+}
+
+static inline void clearLanes(uint64_t* restrict rows, const uint8_t* restrict m) {
+    LANES(j) rows[j] = m[j] ? 0 : rows[j];
+}
+
+// r = whether a skip instruction skips (a: v[X], b: v[Y])
+static inline void testLanes(INSTRUCTION kind, uint8_t* restrict r, const uint8_t* a, const uint8_t* b, const uint16_t* keys, uint8_t nn) {
+    switch (kind) {
+        case OP_3XNN: LANES(j) r[j] = a[j] == nn; break;
+        case OP_4XNN: LANES(j) r[j] = a[j] != nn; break;
+        case OP_5XY0: LANES(j) r[j] = a[j] == b[j]; break;
+        case OP_9XY0: LANES(j) r[j] = a[j] != b[j]; break;
+        case OP_EX9E: LANES(j) r[j] = (keys[j] >> (a[j] & 0xf)) & 1; break;
+        default: LANES(j) r[j] = !((keys[j] >> (a[j] & 0xf)) & 1); break; // OP_EXA1
+    }
+}
+
+// r = the value an ALU instruction leaves in v[X], f = the one it leaves in v[F]
+static inline void computeLanes(INSTRUCTION kind, const QUIRKS* quirks, uint8_t* restrict r, uint8_t* restrict f, const uint8_t* a, const uint8_t* b, uint8_t nn) {
+    const uint8_t* shifted = quirks->shift_vy ? b : a;
+    switch (kind) {
+        case OP_6XNN: LANES(j) r[j] = nn; break;
+        case OP_7XNN: LANES(j) r[j] = a[j] + nn; break;
+        case OP_8XY0: LANES(j) r[j] = b[j]; break;
+        case OP_8XY1: LANES(j) { r[j] = a[j] | b[j]; f[j] = 0; } break;
+        case OP_8XY2: LANES(j) { r[j] = a[j] & b[j]; f[j] = 0; } break;
+        case OP_8XY3: LANES(j) { r[j] = a[j] ^ b[j]; f[j] = 0; } break;
+        case OP_8XY4: LANES(j) { r[j] = a[j] + b[j]; f[j] = r[j] < a[j]; } break;
+        case OP_8XY5: LANES(j) { r[j] = a[j] - b[j]; f[j] = b[j] <= a[j]; } break;
+        case OP_8XY7: LANES(j) { r[j] = b[j] - a[j]; f[j] = a[j] <= b[j]; } break;
+        case OP_8XY6: LANES(j) { r[j] = shifted[j] >> 1; f[j] = shifted[j] & 1; } break;
+        default: LANES(j) { r[j] = shifted[j] << 1; f[j] = shifted[j] >> 7; } break; // OP_8XYE
+    }
+}
+
+static inline void jumpLanes(uint16_t* restrict target, const uint8_t* offset, uint16_t nnn) {
+    LANES(j) target[j] = nnn + offset[j];
+}
+
+// the new idx of ANNN / FX1E / FX29 (overflow: where FX1E sets the flag)
+static inline void indexLanes(INSTRUCTION kind, uint16_t* restrict idx, uint8_t* restrict overflow, const uint16_t* old, const uint8_t* a, uint16_t nnn) {
+    switch (kind) {
+        case OP_ANNN: LANES(j) idx[j] = nnn; break;
+        case OP_FX29: LANES(j) idx[j] = FONT_ADDR + a[j]*5; break;
+        default: LANES(j) { idx[j] = old[j] + a[j]; overflow[j] = idx[j] > 0x0FFF; } break; // OP_FX1E (4 KB profiles only: the flag is kept)
+    }
+}
+
+// per-lane xorshift64*, as in nextRandom (the generators of the lanes outside the group don't move)
+static inline void randomLanes(uint64_t* restrict rng, uint8_t* restrict r, const uint8_t* restrict m, uint8_t nn) {
+    LANES(j) {
+        uint64_t s = rng[j];
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        r[j] = nn & ((s * 0x2545F4914F6CDD1DULL) >> 56);
+        rng[j] = m[j] ? s : rng[j];
+    }
+}
+
+// XORs one sprite row into the rows of the block: shift, collision test and XOR run as vectors
+static inline void xorSpriteRows(uint64_t* restrict rows, uint64_t* restrict hit, const uint8_t* restrict sprite, const uint8_t* restrict x) {
+    LANES(j) {
+        uint64_t w = ((uint64_t) sprite[j] << 56) >> x[j];
+        hit[j] |= rows[j] & w;
+        rows[j] ^= w;
+    }
+}
+
+// DXYN: memory and rows differ per lane, so the sprite bytes and framebuffer rows are gathered / scattered per lane
+static inline void drawSprites(LOCKSTEP* ls, int base, const uint8_t* m, const DECODED* op) {
+    int capacity = ls->capacity;
+    const uint8_t* vx = &ls->v[op->x*capacity + base];
+    const uint8_t* vy = &ls->v[op->y*capacity + base];
+    uint8_t x[LANE_BLOCK], y[LANE_BLOCK], collision[LANE_BLOCK];
+    uint64_t hit[LANE_BLOCK];
+    LANES(j) {
+        x[j] = vx[j] & (LORES_WIDTH-1);
+        y[j] = vy[j] & (LORES_HEIGHT-1);
+        hit[j] = 0;
+    }
+
+    for(int i = 0; i < op->n; i++) {
+        uint64_t rows[LANE_BLOCK];
+        uint8_t sprite[LANE_BLOCK];
+
+        // rows past the bottom edge are clipped (drawn as 0)
+        LANES(j) {
+            bool on = m[j] && y[j] + i < LORES_HEIGHT;
+            rows[j] = on ? ls->fb[(y[j]+i)*capacity + base+j] : 0;
+            sprite[j] = on ? laneMemory(ls, ls->lane[base+j])[(ls->idx[base+j] + i) & ADDRESS_MASK] : 0;
+        }
+
+        xorSpriteRows(rows, hit, sprite, x);
+
+        LANES(j) {
+            if (m[j] && y[j] + i < LORES_HEIGHT) ls->fb[(y[j]+i)*capacity + base+j] = rows[j];
+        }
+    }
+
+    LANES(j) collision[j] = hit[j] != 0;
+    select8(&ls->v[15*capacity + base], collision, m);
+    markDrawnLanes(&ls->drawn[base], m);
+}
+
+// runs one decoded instruction on the lanes of a block selected by m
+static LANE_KERNEL void runGroup(LOCKSTEP* ls, INSTRUCTION kind, const DECODED* op, int base, const uint8_t* m) {
+    const QUIRKS* quirks = &ls->profile->quirks;
+    int capacity = ls->capacity;
+    uint8_t nn = op->nn;
+    uint16_t nnn = op->nnn;
+    uint8_t r[LANE_BLOCK], f[LANE_BLOCK];
+
+    // the end of the program (and instructions the engine doesn't run) stop the lanes where they are
+    if (kind == OP_HALT || kind == OP_COUNT) {
+        memset(r, kind == OP_HALT ? LANE_ENDED : LANE_UNSUPPORTED, sizeof(r));
+        select8(&ls->state[base], r, m);
+        return;
+    }
+
+    uint16_t* pc = &ls->pc[base];
+    advanceLanes(pc, &ls->cycles[base], m);
+
+    uint8_t* vx = &ls->v[op->x*capacity + base];
+    uint8_t* vf = &ls->v[15*capacity + base];
+    const uint8_t* vy = &ls->v[op->y*capacity + base];
+
+    switch (kind) {
+        case OP_00E0:
+            for(int y = 0; y < LORES_HEIGHT; y++) clearLanes(&ls->fb[y*capacity + base], m);
+            markDrawnLanes(&ls->drawn[base], m);
+            break;
+
+        case OP_00EE:
+            // the stack is circular, as in op00EE
+            LANES(j) {
+                int s = base + j;
+                if (!m[j]) continue;
+                ls->pc[s] = ls->stack[(ls->sp[s] & (STACK_SIZE-1))*capacity + s];
+                ls->sp[s]++;
+            }
+            break;
+
+        case OP_2NNN:
+            LANES(j) {
+                int s = base + j;
+                if (!m[j]) continue;
+                ls->sp[s]--;
+                ls->stack[(ls->sp[s] & (STACK_SIZE-1))*capacity + s] = ls->pc[s];
+                ls->pc[s] = nnn;
+            }
+            break;
+
+        case OP_1NNN:
+        case OP_BNNN: {
+            // BNNN adds v[0] (v[X] with the jump_vx quirk)
+            uint16_t target[LANE_BLOCK];
+            uint8_t zero[LANE_BLOCK] = {0};
+            const uint8_t* offset = kind == OP_1NNN ? zero : quirks->jump_vx ? vx : &ls->v[base];
+            jumpLanes(target, offset, nnn);
+            select16(pc, target, m);
+            break;
+        }
+
+        case OP_3XNN:
+        case OP_4XNN:
+        case OP_5XY0:
+        case OP_9XY0:
+        case OP_EX9E:
+        case OP_EXA1:
+            testLanes(kind, r, vx, vy, &ls->keys[base], nn);
+            skipLanes(pc, r, m);
+            break;
+
+        // ALU: v[X] first, then v[F] (the flag wins when X is F)
+        case OP_6XNN: case OP_7XNN: case OP_8XY0:
+        case OP_8XY1: case OP_8XY2: case OP_8XY3:
+        case OP_8XY4: case OP_8XY5: case OP_8XY6: case OP_8XY7: case OP_8XYE: {
+            bool flag = kind != OP_6XNN && kind != OP_7XNN && kind != OP_8XY0;
+            if (kind == OP_8XY1 || kind == OP_8XY2 || kind == OP_8XY3) flag = quirks->vf_reset;
+
+            computeLanes(kind, quirks, r, f, vx, vy, nn);
+            select8(vx, r, m);
+            if (flag) select8(vf, f, m);
+            break;
+        }
+
+        case OP_ANNN:
+        case OP_FX1E:
+        case OP_FX29: {
+            uint16_t idx[LANE_BLOCK];
+            indexLanes(kind, idx, r, &ls->idx[base], vx, nnn);
+            select16(&ls->idx[base], idx, m);
+
+            // FX1E only sets the flag on overflow
+            if (kind == OP_FX1E) {
+                LANES(j) {
+                    r[j] &= m[j];
+                    f[j] = 1;
+                }
+                select8(vf, f, r);
+            }
+            break;
+        }
+
+        case OP_CXNN:
+            randomLanes(&ls->rng[base], r, m, nn);
+            select8(vx, r, m);
+            break;
+
+        case OP_DXYN:
+            drawSprites(ls, base, m, op);
+            break;
+
+        case OP_FX07:
+            memcpy(r, &ls->dt[base], sizeof(r));
+            select8(vx, r, m);
+            break;
+
+        case OP_FX15:
+        case OP_FX18:
+            memcpy(r, vx, sizeof(r));
+            select8(kind == OP_FX15 ? &ls->dt[base] : &ls->st[base], r, m);
+            break;
+
+        case OP_FX0A:
+            LANES(j) {
+                if (!m[j]) continue;
+                ls->state[base+j] = LANE_WAITING;
+                ls->key_register[base+j] = op->x;
+            }
+            break;
+
+        case OP_FX33:
+        case OP_FX55:
+        case OP_FX65:
+            // memory is per lane: one lane at a time
+            LANES(j) {
+                int s = base + j;
+                if (!m[j]) continue;
+                uint8_t* memory = laneMemory(ls, ls->lane[s]);
+                uint16_t idx = ls->idx[s];
+
+                if (kind == OP_FX65) {
+                    for(int i = 0; i <= op->x; i++) ls->v[i*capacity + s] = memory[(idx+i) & ADDRESS_MASK];
+                } else if (kind == OP_FX55) {
+                    for(int i = 0; i <= op->x; i++) memory[(idx+i) & ADDRESS_MASK] = ls->v[i*capacity + s];
+                } else {
+                    uint8_t value = vx[j];
+                    memory[idx & ADDRESS_MASK] = value / 100;
+                    memory[(idx+1) & ADDRESS_MASK] = value / 10 % 10;
+                    memory[(idx+2) & ADDRESS_MASK] = value % 10;
+                }
+
+                // written instructions are fetched per lane from now on
+                if (kind != OP_FX65) {
+                    int length = kind == OP_FX55 ? op->x + 1 : 3;
+                    for(int i = 0; i < length; i++) ls->written[(idx+i) & ADDRESS_MASK] = 1;
+                }
+                if (kind != OP_FX33 && quirks->increment_idx) ls->idx[s] = idx + op->x + 1;
+            }
+            break;
+
+        default: // OP_NOP
+            break;
+    }
+}
+
+/*
+    STEPPING
+*/
+
+// one instruction on every running lane of the block: lanes that fetched the same opcode run it as one group
+// (returns false if no lane is running)
+static LANE_KERNEL bool stepBlock(LOCKSTEP* ls, int base) {
+    const uint8_t* state = &ls->state[base];
+    const uint16_t* pc = &ls->pc[base];
+    uint8_t pending[LANE_BLOCK];
+    uint8_t running = 0;
+    LANES(j) {
+        pending[j] = state[j] == LANE_RUNNING;
+        running |= pending[j];
+    }
+    if (!running) return false;
+    ls->block_steps++;
+
+    // usually every running lane is at the same instruction, still as loaded: it's decoded already
+    int first = 0;
+    while (!pending[first]) first++;
+    uint16_t addr = pc[first] & ADDRESS_MASK;
+    uint8_t same = !ls->written[addr] && !ls->written[(addr+1) & ADDRESS_MASK];
+    LANES(j) same &= !pending[j] | (pc[j] == pc[first]);
+
+    if (same) {
+        runGroup(ls, ls->code_kind[addr], &ls->code[addr], base, pending);
+        ls->groups++;
+        return true;
+    }
+
+    uint16_t inst[LANE_BLOCK];
+    LANES(j) {
+        const uint8_t* memory = laneMemory(ls, ls->lane[base+j]);
+        uint16_t lane_pc = pc[j] & ADDRESS_MASK;
+        inst[j] = (memory[lane_pc] << 8) | memory[(lane_pc+1) & ADDRESS_MASK];
+    }
+
+    for(int leader = first; leader < LANE_BLOCK; leader++) {
+        if (!pending[leader]) continue;
+
+        uint16_t opcode = inst[leader];
+        uint8_t m[LANE_BLOCK];
+        LANES(j) {
+            m[j] = pending[j] & (inst[j] == opcode);
+            pending[j] &= ~m[j];
+        }
+
+        DECODED op;
+        INSTRUCTION kind = laneKind(ls->profile, decodeInstruction(ls->profile, opcode, &op));
+        runGroup(ls, kind, &op, base, m);
+        ls->groups++;
+    }
+    return true;
+}
+
+static int compareOrder(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+// sorts the slots by PC (stopped lanes last), so that lanes running the same code fill the same blocks
+static void regroupLanes(LOCKSTEP* ls) {
+    int capacity = ls->capacity;
+    for(int s = 0; s < capacity; s++) {
+        uint64_t stopped = ls->state[s] == LANE_ENDED || ls->state[s] == LANE_UNSUPPORTED;
+        ls->order[s] = (stopped << 48) | ((uint64_t) ls->pc[s] << 32) | (uint32_t) s;
+    }
+    qsort(ls->order, capacity, sizeof(uint64_t), compareOrder);
+
+    for(int a = 0; a < ls->array_count; a++) {
+        LANE_ARRAY* array = &ls->arrays[a];
+        if (!array->moves) continue;
+
+        size_t size = array->element_size;
+        for(int r = 0; r < array->rows; r++) {
+            uint8_t* row = (uint8_t*) array->data + (size_t) r * capacity * size;
+            for(int s = 0; s < capacity; s++) {
+                memcpy(&ls->moved[s*size], &row[(uint32_t) ls->order[s] * size], size);
+            }
+            memcpy(row, ls->moved, capacity * size);
+        }
+    }
+
+    for(int s = 0; s < capacity; s++) ls->slot[ls->lane[s]] = s;
+}
+
+void runLockstep(LOCKSTEP* ls, uint32_t n) {
+    for(; n > 0; n--) {
+        bool running = false;
+        for(int base = 0; base < ls->capacity; base += LANE_BLOCK) running |= stepBlock(ls, base);
+        if (!running) break;
+
+        // regroup when the blocks have run more than one group per step since the last time
+        if (++ls->since_regroup == REGROUP_STEPS) {
+            if (ls->groups - ls->regroup_groups > ls->block_steps - ls->regroup_block_steps) regroupLanes(ls);
+            ls->since_regroup = 0;
+            ls->regroup_groups = ls->groups;
+            ls->regroup_block_steps = ls->block_steps;
+        }
+    }
+}
+
+static LANE_KERNEL void tickTimers(uint8_t* restrict timer, int capacity) {
+    for(int base = 0; base < capacity; base += LANE_BLOCK) {
+        LANES(j) timer[base+j] -= timer[base+j] > 0;
+    }
+}
+
+void tickLockstep(LOCKSTEP* ls) {
+    tickTimers(ls->dt, ls->capacity);
+    tickTimers(ls->st, ls->capacity);
+}
+
+/*
+    LANES
+*/
+
+int getLaneState(LOCKSTEP* ls, int lane) {
+    return ls->state[ls->slot[lane]];
+}
+
+uint64_t getLaneCycles(LOCKSTEP* ls, int lane) {
+    return ls->cycles[ls->slot[lane]];
+}
+
+void getLaneRegisters(LOCKSTEP* ls, int lane, REGISTERS* regs) {
+    uint32_t s = ls->slot[lane];
+    for(int i = 0; i < 16; i++) regs->v[i] = ls->v[i*ls->capacity + s];
+    regs->pc = ls->pc[s];
+    regs->idx = ls->idx[s];
+    regs->sp = ls->sp[s];
+    regs->delay_timer = ls->dt[s];
+    regs->sound_timer = ls->st[s];
+}
+
+void getLaneFramebuffer(LOCKSTEP* ls, int lane, FRAMEBUFFER* fb) {
+    uint32_t s = ls->slot[lane];
+    setResolution(fb, false);
+    for(int y = 0; y < LORES_HEIGHT; y++) fb->rows[0][y][0] = ls->fb[y*ls->capacity + s];
+}
+
+bool laneNeedsToDraw(LOCKSTEP* ls, int lane) {
+    uint32_t s = ls->slot[lane];
+    bool drawn = ls->drawn[s];
+    ls->drawn[s] = false;
+    return drawn;
+}
+
+double getLockstepDivergence(LOCKSTEP* ls) {
+    return ls->block_steps > 0 ? (double) ls->groups / ls->block_steps : 1.0;
+}
+
+void freeLockstep(LOCKSTEP* ls) {
+    for(int a = 0; a < ls->array_count; a++) free(ls->arrays[a].data);
+    free(ls->memory);
+    free(ls->code);
+    free(ls->code_kind);
+    free(ls->written);
+    free(ls);
+}
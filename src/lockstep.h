@@ -0,0 +1,43 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// many machines running the same ROM, stored as struct-of-arrays and stepped together
+// (lanes at the same instruction run it as one vector operation, with AVX2 when the CPU has it)
+// each lane behaves exactly like a CHIP8 given the same seed, keys, runCycles and updateTimers calls
+// only the CHIP-8 instruction set in lo-res is handled: a lane reaching a SUPER-CHIP / XO-CHIP instruction stops
+typedef struct lockstep_ LOCKSTEP;
+
+// lane states
+#define LANE_RUNNING 0
+#define LANE_WAITING 1 // FX0A
+#define LANE_ENDED 2
+#define LANE_UNSUPPORTED 3 // stopped at an instruction the engine doesn't handle
+
+// returns NULL if out of memory, the ROM doesn't fit or the profile isn't a 4 KB one (xo-chip)
+LOCKSTEP* createLockstep(int lanes, const uint8_t* rom, size_t size, const char* quirks);
+
+void seedLane(LOCKSTEP* lockstep, int lane, uint64_t seed);
+void setLaneKeys(LOCKSTEP* lockstep, int lane, uint16_t mask);
+
+// every running lane executes up to n instructions (like runCycles on each machine)
+void runLockstep(LOCKSTEP* lockstep, uint32_t n);
+void tickLockstep(LOCKSTEP* lockstep); // updateTimers on every lane
+
+int getLaneState(LOCKSTEP* lockstep, int lane);
+uint64_t getLaneCycles(LOCKSTEP* lockstep, int lane);
+void getLaneRegisters(LOCKSTEP* lockstep, int lane, REGISTERS* regs);
+void getLaneFramebuffer(LOCKSTEP* lockstep, int lane, FRAMEBUFFER* fb);
+bool laneNeedsToDraw(LOCKSTEP* lockstep, int lane); // and clears the flag
+
+// average number of instruction groups a block of lanes runs per step (1 when its lanes agree)
+double getLockstepDivergence(LOCKSTEP* lockstep);
+
+void freeLockstep(LOCKSTEP* lockstep);
+
+#endif
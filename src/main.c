@@ -1,73 +1,443 @@
+#include "analysis.h"
+#include "capture.h"
 #include "chip8.h"
+#include "debugger.h"
 #include "display.h"
+#include "jit.h"
+#include "movie.h"
+#include "pacer.h"
+#include "profiler.h"
+#include "rewind.h"
+#include "speaker.h"
+#include "triplebuffer.h"
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <SDL2/SDL.h>
 #include <time.h>
 
 #define CPU_HZ 700.0
-#define DISPLAY_HZ 60.0
-#define TIMERS_HZ 60.0
+#define FRAME_HZ 60.0 // display refresh and timer tick: the CPU runs CPU_HZ/FRAME_HZ instructions per frame
+#define MAX_CATCH_UP 4 // default for --catch-up
+#define PROFILE_HOT_ADDRESSES 32 // listed by --profile
+
+#define SAVE_STATE_KEY SDL_SCANCODE_F5
+#define LOAD_STATE_KEY SDL_SCANCODE_F9
+
+// held down, steps back one recorded frame per display frame
+#define REWIND_KEY SDL_SCANCODE_BACKSPACE
+#define REWIND_BYTES (4 << 20) // about 30 bytes per frame: hours of history for most games
+
+// requests from the input thread to the emulation thread (--threaded)
+#define COMMAND_NONE 0
+#define COMMAND_SAVE 1
+#define COMMAND_LOAD 2
+
+// keyboard key for each CHIP-8 key (index is the hex value)
+const int commands[16] = {SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A, SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z,SDL_SCANCODE_C, SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V};
+
+// everything the emulation side owns (the machine and what runs in lockstep with it)
+typedef struct emulation_ {
+    CHIP8* chip8;
+    REWIND* rewind;
+    SPEAKER* speaker; // NULL without audio
+    PACER* pacer;
+    MOVIE* movie; // being recorded or played (NULL without --record / --play)
+    CAPTURE* capture; // NULL without --capture
+    DEBUG_SERVER* debug; // NULL without --debug
+    const char* state_path;
+
+    double cycle_credit; // fraction of an instruction carried to the next frame
+    bool rewinding;
+} EMULATION;
+
+// shared by the input / render thread and the emulation thread in --threaded mode (accessed atomically)
+typedef struct shared_ {
+    EMULATION* emu;
+    TRIPLE_BUFFER* frames;
+    uint16_t keys;
+    int command;
+    bool rewinding;
+    bool running;
+} SHARED;
+
+// updates the mirror of the physical keypad, returns false if the event isn't for a CHIP-8 key
+bool handleKeyEvent(SDL_Event* event, uint16_t* held_keys) {
+    SDL_Scancode sc = (*event).key.keysym.scancode;
+    //printf("Scancode: %d (%s)\n", sc, SDL_GetScancodeName(sc));
+    for(int i = 0; i < 16; i++) {
+        if (commands[i] == sc) {
+            if ((*event).type == SDL_KEYDOWN) *held_keys |= 1 << i;
+            else *held_keys &= ~(1 << i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// presents a frame, timing it for the profiler (if enabled)
+void presentFrame(DISPLAY* display, CHIP8* chip8, const FRAMEBUFFER* fb) {
+    uint64_t start = SDL_GetPerformanceCounter();
+    updateDisplay(display, fb);
+    profileRender(chip8, (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency());
+}
+
+void saveMachine(EMULATION* emu) {
+    if (!saveState(emu->chip8, emu->state_path)) fprintf(stderr, "WARNING: couldn't save %s\n", emu->state_path);
+}
+
+bool loadMachine(EMULATION* emu) {
+    // a movie only replays from its start
+    if (emu->movie != NULL) {
+        fprintf(stderr, "WARNING: states can't be loaded while recording or playing a movie\n");
+        return false;
+    }
+    if (loadState(emu->chip8, emu->state_path)) return true;
+    fprintf(stderr, "WARNING: couldn't load %s\n", emu->state_path);
+    return false;
+}
+
+// live keys go through the movie, which logs them when recording and ignores them while playing
+void applyKeys(EMULATION* emu, uint16_t keys) {
+    if (emu->movie == NULL) setKeys(emu->chip8, keys);
+    else if (!recordKeys(emu->movie, emu->chip8, keys)) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+}
+
+void setRewinding(EMULATION* emu, bool rewinding, uint16_t held_keys) {
+    // no rewinding within a movie
+    if (emu->movie != NULL) rewinding = false;
+
+    // the restored keypad is the one of the past: go on with the keys held now
+    if (emu->rewinding && !rewinding) applyKeys(emu, held_keys);
+    emu->rewinding = rewinding;
+}
+
+// runs one 60 Hz frame: a batch of CPU_HZ/FRAME_HZ instructions, a timer tick, audio and the rewind history
+// returns true when the framebuffer has a new frame to present
+bool runFrame(EMULATION* emu) {
+    // DEBUGGER (answers the client's requests; while it holds the machine stopped, nothing runs or ticks)
+    if (emu->debug != NULL && !serveDebugger(emu->debug)) return false;
+
+    // AUDIO (keeps the device queue topped up with the tone of the current state, never waits)
+    if (emu->speaker != NULL) feedSpeaker(emu->speaker, emu->chip8);
+
+    // REWIND (the machine is stopped: one recorded frame back per frame)
+    if (emu->rewinding) {
+        bool new_frame = rewindFrame(emu->rewind, emu->chip8);
+        if (emu->capture != NULL) captureFrame(emu->capture, getFramebuffer(emu->chip8));
+        return new_frame;
+    }
+
+    // CPU (all the instructions of the frame run in one batch, split at the key changes of a movie being played)
+    if (emu->movie != NULL) {
+        bool was_playing = moviePlaying(emu->movie);
+        runMovieFrame(emu->movie, emu->chip8);
+        if (was_playing && !moviePlaying(emu->movie)) fprintf(stderr, "movie: playback finished, the keyboard is live\n");
+    } else {
+        emu->cycle_credit += CPU_HZ/FRAME_HZ;
+        uint32_t due_cycles = (uint32_t) emu->cycle_credit;
+        emu->cycle_credit -= due_cycles;
+        runCycles(emu->chip8, due_cycles, EVENT_NONE);
+    }
+
+    // DISPLAY (also records the frame for rewinding)
+    bool new_frame = needsToDraw(emu->chip8);
+    if (new_frame) markDrawn(emu->chip8);
+
+    // a breakpoint or watchpoint stopped the batch: what it drew is shown, but the frame isn't over
+    // (no rewind record, capture or timer tick until the machine runs again)
+    if (emu->debug != NULL && getStopReason(emu->chip8, NULL, NULL) != STOP_NONE) return new_frame;
+
+    recordFrame(emu->rewind, emu->chip8);
+    if (emu->capture != NULL) captureFrame(emu->capture, getFramebuffer(emu->chip8));
+
+    // TIMERS
+    updateTimers(emu->chip8);
+
+    return new_frame;
+}
+
+// --threaded: runs the machine on its own thread, completed frames go out through the triple buffer
+int emulationThread(void* data) {
+    SHARED* shared = (SHARED*) data;
+    EMULATION* emu = shared->emu;
+
+    while (__atomic_load_n(&shared->running, __ATOMIC_ACQUIRE)) {
+        int frames = waitFrames(emu->pacer);
+
+        uint16_t keys = __atomic_load_n(&shared->keys, __ATOMIC_ACQUIRE);
+        bool publish = false;
+
+        switch (__atomic_exchange_n(&shared->command, COMMAND_NONE, __ATOMIC_ACQ_REL)) {
+            case COMMAND_SAVE: saveMachine(emu); break;
+            case COMMAND_LOAD: publish = loadMachine(emu); break;
+            default: break;
+        }
+
+        setRewinding(emu, __atomic_load_n(&shared->rewinding, __ATOMIC_ACQUIRE), keys);
+        if (!emu->rewinding) applyKeys(emu, keys);
+
+        for(int i = 0; i < frames; i++) {
+            if (runFrame(emu)) publish = true;
+        }
+
+        if (publish) {
+            *getBackBuffer(shared->frames) = *getFramebuffer(emu->chip8);
+            publishFrame(shared->frames);
+        }
+
+        // program has ended
+        if (hasEnded(emu->chip8)) __atomic_store_n(&shared->running, false, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+void printUsage(char* program) {
+    fprintf(stderr, "usage: %s [options] <rom>\n", program);
+    fprintf(stderr, "  --jit          run with the x86-64 recompiler\n");
+    fprintf(stderr, "  --jit-check    run with the recompiler, checking every block against the interpreter\n");
+    fprintf(stderr, "  --vsync        synchronize presentation with the display refresh\n");
+    fprintf(stderr, "  --threaded     run the emulation on its own thread, apart from rendering and input\n");
+    fprintf(stderr, "  --catch-up N   frames run back to back after a stall before skipping ahead (default %d)\n", MAX_CATCH_UP);
+    fprintf(stderr, "  --profile      count executed instructions and print a report on exit\n");
+    fprintf(stderr, "  --record FILE  record the keys pressed into a movie file\n");
+    fprintf(stderr, "  --play FILE    replay a movie (ignores the keyboard until it ends)\n");
+    fprintf(stderr, "  --capture FILE write the displayed frames to FILE (.c8v stream, .gif, or numbered .png files)\n");
+    fprintf(stderr, "  --debug PATH   serve the GDB remote protocol on the Unix socket PATH (- for stdin / stdout)\n");
+    fprintf(stderr, "  --seed N       seed of the random generator (default: current time)\n");
+    fprintf(stderr, "  --quirks NAME  quirk profile: vip (default), schip, xo-chip, modern\n");
+}
 
 int main(int argc, char* argv[]) {
-    srand(time(NULL));
+    char* rom_path = NULL;
+    int jit_mode = JIT_OFF;
+    bool vsync = false;
+    bool threaded = false;
+    bool profile = false;
+    int catch_up = MAX_CATCH_UP;
+    uint64_t seed = time(NULL);
+    const char* quirks = NULL;
+    const char* record_path = NULL;
+    const char* play_path = NULL;
+    const char* capture_path = NULL;
+    const char* debug_path = NULL;
+
+    for(int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jit") == 0) jit_mode = JIT_ON;
+        else if (strcmp(argv[i], "--jit-check") == 0) jit_mode = JIT_CROSSCHECK;
+        else if (strcmp(argv[i], "--vsync") == 0) vsync = true;
+        else if (strcmp(argv[i], "--threaded") == 0) threaded = true;
+        else if (strcmp(argv[i], "--profile") == 0) profile = true;
+        else if (strcmp(argv[i], "--catch-up") == 0 && i+1 < argc) catch_up = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i+1 < argc) seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--quirks") == 0 && i+1 < argc) quirks = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && i+1 < argc) record_path = argv[++i];
+        else if (strcmp(argv[i], "--play") == 0 && i+1 < argc) play_path = argv[++i];
+        else if (strcmp(argv[i], "--capture") == 0 && i+1 < argc) capture_path = argv[++i];
+        else if (strcmp(argv[i], "--debug") == 0 && i+1 < argc) debug_path = argv[++i];
+        else if (argv[i][0] != '-' && rom_path == NULL) rom_path = argv[i];
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (rom_path == NULL || (record_path != NULL && play_path != NULL) ||
+        (capture_path != NULL && getCaptureFormat(capture_path) < 0) ||
+        (debug_path != NULL && (record_path != NULL || play_path != NULL))) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // save state next to the ROM
+    char state_path[4096];
+    snprintf(state_path, sizeof(state_path), "%s.state", rom_path);
+
+    // playback brings its own quirk profile (the ROM is loaded under it) and seed
+    MOVIE* movie = NULL;
+    if (play_path != NULL) {
+        movie = loadMovie(play_path);
+        if (movie == NULL) {
+            fprintf(stderr, "ERROR: couldn't load the movie %s\n", play_path);
+            exit(1);
+        }
+        quirks = getMovieQuirks(movie);
+    }
+
+    CHIP8* interpreter = setupInterpreter(rom_path, quirks);
+    seedRandom(interpreter, seed);
+
+    // a movie starts from the freshly loaded machine
+    if (play_path != NULL) {
+        if (!startPlayback(movie, interpreter)) {
+            fprintf(stderr, "ERROR: %s was recorded with another ROM\n", play_path);
+            exit(1);
+        }
+    } else if (record_path != NULL) {
+        movie = createMovie(interpreter, seed, (uint32_t) CPU_HZ, (uint32_t) FRAME_HZ);
+        if (movie == NULL) {
+            fprintf(stderr, "ERROR: out of memory\n");
+            exit(1);
+        }
+    }
+
+    if (jit_mode != JIT_OFF && !enableJit(interpreter, jit_mode))
+        fprintf(stderr, "WARNING: recompiler not available, using the interpreter\n");
+
+    // decodes (and compiles) the reachable code up front, so the first frames don't stall on it
+    ANALYSIS* analysis = analyzeProgram(interpreter);
+    if (analysis != NULL) {
+        prewarmInterpreter(interpreter, analysis);
+        freeAnalysis(analysis);
+    }
+
+    if (profile && !enableProfiler(interpreter)) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+    DISPLAY* display = createDisplay(vsync);
+
+    EMULATION emu = {0};
+    emu.chip8 = interpreter;
+    emu.speaker = createSpeaker();
+    emu.movie = movie;
+    emu.state_path = state_path;
+    emu.rewind = createRewind(REWIND_BYTES);
+    if (emu.rewind == NULL) {
+        fprintf(stderr, "ERROR: couldn't allocate the rewind buffer\n");
+        exit(1);
+    }
+    emu.pacer = createPacer(FRAME_HZ, catch_up);
+    if (emu.pacer == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+    // one frame per emulated frame, encoded and written on the capture's own thread (it drops frames rather than wait)
+    if (capture_path != NULL) {
+        emu.capture = createCapture(capture_path, getCaptureFormat(capture_path), (uint32_t) FRAME_HZ, NULL, false);
+        if (emu.capture == NULL) {
+            fprintf(stderr, "ERROR: %s: %s\n", capture_path, strerror(errno));
+            exit(1);
+        }
+    }
 
-    const double cpu_interval_ms = 1000.0/CPU_HZ;
-    const double display_interval_ms = 1000.0/DISPLAY_HZ;
-    const double timers_interval_ms = 1000.0/TIMERS_HZ;
+    // the client attaches when it connects (on stdin / stdout, right away)
+    if (debug_path != NULL) {
+        emu.debug = createDebugServer(interpreter, debug_path);
+        if (emu.debug == NULL) {
+            fprintf(stderr, "ERROR: %s: %s\n", debug_path, strerror(errno));
+            exit(1);
+        }
+    }
 
-    double cpu_accumulator, display_accumulator, timers_accumulator;
-    cpu_accumulator = display_accumulator = timers_accumulator = 0.0;
+    SHARED shared = {0};
+    SDL_Thread* thread = NULL;
+    // the render loop polls twice per emulated frame, so a frame is shown at most half a frame late
+    PACER* render_pacer = NULL;
+    if (threaded) {
+        render_pacer = createPacer(2*FRAME_HZ, 1);
+        shared.emu = &emu;
+        shared.frames = createTripleBuffer();
+        shared.running = true;
+        if (shared.frames == NULL || render_pacer == NULL) {
+            fprintf(stderr, "ERROR: out of memory\n");
+            exit(1);
+        }
+        thread = SDL_CreateThread(emulationThread, "emulation", &shared);
+        if (thread == NULL) {
+            fprintf(stderr, "ERROR: couldn't start the emulation thread: %s\n", SDL_GetError());
+            exit(1);
+        }
+    }
 
-    CHIP8* interpreter = setupInterpreter(argv[1]);
+    uint16_t held_keys = 0;
 
     SDL_Event event;
     int running = 1;
 
-    uint32_t last_time = SDL_GetTicks();
-
     while (running) {
-        // check for QUIT EVENT or KEY_DOWN
+        // sleeps until the next frame is due
+        int frames = waitFrames(threaded ? render_pacer : emu.pacer);
+
+        // check for QUIT EVENT or KEY_DOWN / KEY_UP
+        // (in threaded mode they are only forwarded: the emulation thread owns the machine)
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 running = false;
-            } else if (event.type == SDL_KEYUP && waitingForKey(interpreter))
-                handleKeyPressed(interpreter, &event);
+            } else if (event.type == SDL_KEYDOWN && event.key.keysym.scancode == SAVE_STATE_KEY) {
+                if (threaded) __atomic_store_n(&shared.command, COMMAND_SAVE, __ATOMIC_RELEASE);
+                else saveMachine(&emu);
+            } else if (event.type == SDL_KEYDOWN && event.key.keysym.scancode == LOAD_STATE_KEY) {
+                if (threaded) __atomic_store_n(&shared.command, COMMAND_LOAD, __ATOMIC_RELEASE);
+                else if (loadMachine(&emu)) presentFrame(display, interpreter, getFramebuffer(interpreter));
+            } else if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && event.key.keysym.scancode == REWIND_KEY) {
+                if (threaded) __atomic_store_n(&shared.rewinding, event.type == SDL_KEYDOWN, __ATOMIC_RELEASE);
+                else setRewinding(&emu, event.type == SDL_KEYDOWN, held_keys);
+            } else if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && handleKeyEvent(&event, &held_keys)) {
+                if (threaded) __atomic_store_n(&shared.keys, held_keys, __ATOMIC_RELEASE);
+                else if (!emu.rewinding) applyKeys(&emu, held_keys);
+            }
         }
 
-        uint32_t current_time = SDL_GetTicks();
-
-        // calculates elapsed time for better sinc
-        double elapsed_time = current_time - last_time;
-        last_time = current_time;
+        if (threaded) {
+            // RENDER (presents the newest complete frame, a slow present never holds the emulation back)
+            bool fresh;
+            const FRAMEBUFFER* frame = acquireFrame(shared.frames, &fresh);
+            if (fresh) presentFrame(display, interpreter, frame);
+            if (!__atomic_load_n(&shared.running, __ATOMIC_ACQUIRE)) running = false;
+            continue;
+        }
 
-        // update accumulators
-        cpu_accumulator += elapsed_time;
-        display_accumulator += elapsed_time;
-        timers_accumulator += elapsed_time;
+        // program has ended
+        if (hasEnded(interpreter)) running = false;
 
-        // CPU
-        while(cpu_accumulator >= cpu_interval_ms) {
-            if (!waitingForKey(interpreter))
-                processNextInstruction(interpreter);
-            cpu_accumulator -= cpu_interval_ms;
+        // one frame when on time, a few back to back to catch up after a stall
+        bool new_frame = false;
+        for(int i = 0; i < frames; i++) {
+            if (runFrame(&emu)) new_frame = true;
         }
+        if (new_frame) presentFrame(display, interpreter, getFramebuffer(interpreter));
+    }
 
-        // DISPLAY
-        while(display_accumulator >= display_interval_ms) {
-            if (needsToDraw(interpreter))
-                drawDisplay(interpreter);
-            display_accumulator -= display_interval_ms;
-        }
+    if (thread != NULL) {
+        __atomic_store_n(&shared.running, false, __ATOMIC_RELEASE);
+        SDL_WaitThread(thread, NULL);
+        freeTripleBuffer(shared.frames);
+        freePacer(render_pacer);
+    }
 
-        // TIMERS
-        while(timers_accumulator >= timers_interval_ms) {
-            updateTimers(interpreter);
-            timers_accumulator -= timers_interval_ms;
-        }
+    uint64_t dropped = getDroppedFrames(emu.pacer);
+    if (dropped > 0) fprintf(stderr, "pacing: %llu frames dropped\n", (unsigned long long) dropped);
+    freePacer(emu.pacer);
+
+    if (emu.speaker != NULL) {
+        uint64_t underruns = getSpeakerUnderruns(emu.speaker);
+        if (underruns > 0) fprintf(stderr, "audio: %llu underruns\n", (unsigned long long) underruns);
+        freeSpeaker(emu.speaker);
+    }
+    if (profile) printProfile(interpreter, stderr, PROFILE_HOT_ADDRESSES);
+
+    if (emu.capture != NULL) {
+        CAPTURE_STATS stats;
+        if (!closeCapture(emu.capture, &stats)) fprintf(stderr, "WARNING: couldn't write the capture %s\n", capture_path);
+        fprintf(stderr, "capture: %llu frames, %llu written, %llu dropped\n", (unsigned long long) stats.frames,
+                (unsigned long long) stats.written, (unsigned long long) stats.dropped);
+    }
 
-        SDL_Delay(1);
+    if (movie != NULL) {
+        if (record_path != NULL && !saveMovie(movie, record_path))
+            fprintf(stderr, "WARNING: couldn't save the movie %s\n", record_path);
+        freeMovie(movie);
     }
 
+    if (emu.debug != NULL) freeDebugServer(emu.debug);
+    freeRewind(emu.rewind);
     freeInterpreter(interpreter);
+    freeDisplay(display);
     SDL_Quit();
-}
\ No newline at end of file
+}
@@ -0,0 +1,323 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "movie.h"
+#include "chip8_internal.h"
+
+/*
+ movie format (version 1, little-endian):
+   "C8MV" magic, u16 version, u8 quirk profile (index), u64 seed, u64 hash of the memory at the start
+   u32 cpu_hz, u32 frame_hz, u32 frames, u32 event count
+   events: varint slots since the previous event, u16 key mask
+*/
+
+#define MOVIE_MAGIC "C8MV"
+#define MOVIE_VERSION 1
+#define MOVIE_HEADER_SIZE (4 + 2 + 1 + 8 + 8 + 4 + 4 + 4 + 4)
+#define MAX_EVENT_SIZE (10 + 2)
+
+#define MOVIE_IDLE 0
+#define MOVIE_RECORDING 1
+#define MOVIE_PLAYING 2
+
+typedef struct movie_event_ {
+    uint64_t slot;
+    uint16_t keys;
+} MOVIE_EVENT;
+
+struct movie_ {
+    int mode;
+
+    uint8_t profile;
+    uint64_t seed, memory_hash;
+    uint32_t cpu_hz, frame_hz;
+    uint32_t frames; // recorded so far / to play
+
+    MOVIE_EVENT* events;
+    uint32_t count, capacity;
+
+    // position: frames and slots run, next event to play, last mask logged
+    uint32_t frame;
+    uint64_t slot;
+    uint32_t next;
+    uint16_t keys;
+};
+
+// FNV-1a over the memory of the profile: identifies the ROM (and the quirk profile's memory size)
+static uint64_t hashMemory(CHIP8* chip8) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(uint32_t i = 0; i <= chip8->memory_mask; i++) {
+        hash ^= chip8->memory[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int profileIndex(const char* name) {
+    int i = 0;
+    while (strcmp(getQuirkProfileName(i), name) != 0) i++;
+    return i;
+}
+
+static MOVIE* allocateMovie(uint32_t capacity) {
+    MOVIE* movie = (MOVIE*) calloc(1, sizeof(MOVIE));
+    if (movie == NULL) return NULL;
+
+    movie->capacity = capacity > 0 ? capacity : 1;
+    movie->events = (MOVIE_EVENT*) malloc(movie->capacity * sizeof(MOVIE_EVENT));
+    if (movie->events == NULL) {
+        free(movie);
+        return NULL;
+    }
+    return movie;
+}
+
+static bool addEvent(MOVIE* movie, uint16_t keys) {
+    if (movie->count == movie->capacity) {
+        MOVIE_EVENT* events = (MOVIE_EVENT*) realloc(movie->events, 2 * movie->capacity * sizeof(MOVIE_EVENT));
+        if (events == NULL) return false;
+        movie->events = events;
+        movie->capacity *= 2;
+    }
+
+    movie->events[movie->count].slot = movie->slot;
+    movie->events[movie->count].keys = keys;
+    movie->count++;
+    movie->keys = keys;
+    return true;
+}
+
+MOVIE* createMovie(CHIP8* chip8, uint64_t seed, uint32_t cpu_hz, uint32_t frame_hz) {
+    MOVIE* movie = allocateMovie(256);
+    if (movie == NULL) return NULL;
+
+    movie->mode = MOVIE_RECORDING;
+    movie->profile = profileIndex(getQuirkProfile(chip8));
+    movie->seed = seed;
+    movie->memory_hash = hashMemory(chip8);
+    movie->cpu_hz = cpu_hz;
+    movie->frame_hz = frame_hz;
+
+    // keys already held are the first event
+    if (chip8->keys != 0) addEvent(movie, chip8->keys);
+    return movie;
+}
+
+bool recordKeys(MOVIE* movie, CHIP8* chip8, uint16_t keys) {
+    if (movie->mode == MOVIE_PLAYING) return true;
+
+    setKeys(chip8, keys);
+    return movie->mode != MOVIE_RECORDING || keys == movie->keys || addEvent(movie, keys);
+}
+
+uint8_t runMovieFrame(MOVIE* movie, CHIP8* chip8) {
+    uint64_t end = (uint64_t) (movie->frame + 1) * movie->cpu_hz / movie->frame_hz;
+    bool playing = movie->mode == MOVIE_PLAYING;
+    uint8_t events = 0;
+
+    // the batch is split at every recorded change, so keys reach the machine at the slot they were pressed
+    while (true) {
+        while (playing && movie->next < movie->count && movie->events[movie->next].slot <= movie->slot)
+            setKeys(chip8, movie->events[movie->next++].keys);
+        if (movie->slot == end) break;
+
+        uint64_t stop = end;
+        if (playing && movie->next < movie->count && movie->events[movie->next].slot < stop)
+            stop = movie->events[movie->next].slot;
+
+        // slots stalled in FX0A are counted all the same
+        events |= runCycles(chip8, stop - movie->slot, EVENT_NONE);
+        movie->slot = stop;
+    }
+
+    movie->frame++;
+    if (movie->mode == MOVIE_RECORDING) movie->frames = movie->frame;
+    else if (playing && movie->frame >= movie->frames) movie->mode = MOVIE_IDLE;
+
+    return events;
+}
+
+/*
+    FILES
+*/
+
+static uint8_t* put16(uint8_t* p, uint16_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    return p + 2;
+}
+
+static uint8_t* put32(uint8_t* p, uint32_t value) {
+    for(int i = 0; i < 4; i++) p[i] = value >> (8*i);
+    return p + 4;
+}
+
+static uint8_t* put64(uint8_t* p, uint64_t value) {
+    for(int i = 0; i < 8; i++) p[i] = value >> (8*i);
+    return p + 8;
+}
+
+static const uint8_t* get16(const uint8_t* p, uint16_t* value) {
+    *value = p[0] | (p[1] << 8);
+    return p + 2;
+}
+
+static const uint8_t* get32(const uint8_t* p, uint32_t* value) {
+    *value = 0;
+    for(int i = 0; i < 4; i++) *value |= (uint32_t) p[i] << (8*i);
+    return p + 4;
+}
+
+static const uint8_t* get64(const uint8_t* p, uint64_t* value) {
+    *value = 0;
+    for(int i = 0; i < 8; i++) *value |= (uint64_t) p[i] << (8*i);
+    return p + 8;
+}
+
+// returns NULL if the varint runs past end
+static const uint8_t* getVarint(const uint8_t* p, const uint8_t* end, uint64_t* value) {
+    *value = 0;
+    for(int shift = 0; p < end && shift < 64; shift += 7) {
+        *value |= (uint64_t) (*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) return p;
+    }
+    return NULL;
+}
+
+bool saveMovie(MOVIE* movie, const char* file_path) {
+    uint8_t* buffer = (uint8_t*) malloc(MOVIE_HEADER_SIZE + (size_t) movie->count * MAX_EVENT_SIZE);
+    if (buffer == NULL) return false;
+
+    uint8_t* p = buffer;
+    memcpy(p, MOVIE_MAGIC, 4);
+    p = put16(p + 4, MOVIE_VERSION);
+    *p++ = movie->profile;
+    p = put64(p, movie->seed);
+    p = put64(p, movie->memory_hash);
+    p = put32(p, movie->cpu_hz);
+    p = put32(p, movie->frame_hz);
+    p = put32(p, movie->frames);
+    p = put32(p, movie->count);
+
+    uint64_t slot = 0;
+    for(uint32_t i = 0; i < movie->count; i++) {
+        uint64_t delta = movie->events[i].slot - slot;
+        slot = movie->events[i].slot;
+        while (delta >= 0x80) {
+            *p++ = delta | 0x80;
+            delta >>= 7;
+        }
+        *p++ = delta;
+        p = put16(p, movie->events[i].keys);
+    }
+
+    size_t size = p - buffer;
+    FILE* f = fopen(file_path, "wb");
+    bool ok = f != NULL && fwrite(buffer, 1, size, f) == size;
+    if (f != NULL && fclose(f) != 0) ok = false;
+
+    free(buffer);
+    return ok;
+}
+
+static MOVIE* parseMovie(const uint8_t* buffer, size_t size) {
+    if (size < MOVIE_HEADER_SIZE || memcmp(buffer, MOVIE_MAGIC, 4) != 0) return NULL;
+
+    uint16_t version;
+    const uint8_t* p = get16(buffer + 4, &version);
+    if (version != MOVIE_VERSION) return NULL;
+
+    uint8_t profile = *p++;
+    uint64_t seed, memory_hash;
+    uint32_t cpu_hz, frame_hz, frames, count;
+    p = get64(p, &seed);
+    p = get64(p, &memory_hash);
+    p = get32(p, &cpu_hz);
+    p = get32(p, &frame_hz);
+    p = get32(p, &frames);
+    p = get32(p, &count);
+
+    // every event takes at least 3 bytes
+    if (getQuirkProfileName(profile) == NULL || cpu_hz == 0 || frame_hz == 0 || count > (size - MOVIE_HEADER_SIZE) / 3)
+        return NULL;
+
+    MOVIE* movie = allocateMovie(count);
+    if (movie == NULL) return NULL;
+    movie->profile = profile;
+    movie->seed = seed;
+    movie->memory_hash = memory_hash;
+    movie->cpu_hz = cpu_hz;
+    movie->frame_hz = frame_hz;
+    movie->frames = frames;
+
+    const uint8_t* end = buffer + size;
+    uint64_t slot = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        uint64_t delta;
+        p = getVarint(p, end, &delta);
+        if (p == NULL || end - p < 2 || slot + delta < slot) {
+            freeMovie(movie);
+            return NULL;
+        }
+        slot += delta;
+        movie->events[i].slot = slot;
+        p = get16(p, &movie->events[i].keys);
+    }
+    movie->count = count;
+
+    if (p != end) {
+        freeMovie(movie);
+        return NULL;
+    }
+    return movie;
+}
+
+MOVIE* loadMovie(const char* file_path) {
+    FILE* f = fopen(file_path, "rb");
+    if (f == NULL) return NULL;
+
+    uint8_t* buffer = NULL;
+    long size = -1;
+    if (fseek(f, 0, SEEK_END) == 0) size = ftell(f);
+    if (size >= 0 && fseek(f, 0, SEEK_SET) == 0) buffer = (uint8_t*) malloc(size > 0 ? size : 1);
+
+    bool ok = buffer != NULL && fread(buffer, 1, size, f) == (size_t) size;
+    fclose(f);
+
+    MOVIE* movie = ok ? parseMovie(buffer, size) : NULL;
+    free(buffer);
+    return movie;
+}
+
+bool startPlayback(MOVIE* movie, CHIP8* chip8) {
+    if (!setQuirkProfile(chip8, getMovieQuirks(movie))) return false;
+    if (hashMemory(chip8) != movie->memory_hash) return false;
+
+    seedRandom(chip8, movie->seed);
+    setKeys(chip8, 0);
+
+    movie->mode = movie->frames > 0 ? MOVIE_PLAYING : MOVIE_IDLE;
+    movie->frame = 0;
+    movie->slot = 0;
+    movie->next = 0;
+    return true;
+}
+
+const char* getMovieQuirks(MOVIE* movie) {
+    return getQuirkProfileName(movie->profile);
+}
+
+bool moviePlaying(MOVIE* movie) {
+    return movie->mode == MOVIE_PLAYING;
+}
+
+uint32_t getMovieFrames(MOVIE* movie) {
+    return movie->frames;
+}
+
+void freeMovie(MOVIE* movie) {
+    free(movie->events);
+    free(movie);
+}
@@ -0,0 +1,42 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// input movies: the key mask changes of a session, tagged with the cycle slot they happened at
+// (slots stalled in FX0A count, like in chip8-batch), replayed exactly given the same ROM, quirks and seed
+typedef struct movie_ MOVIE;
+
+// starts recording from the machine as it is now (freshly loaded, quirk profile set, seeded with seed)
+// frames run cpu_hz/frame_hz cycle slots each, rounded so that frame f starts at slot f*cpu_hz/frame_hz
+MOVIE* createMovie(CHIP8* chip8, uint64_t seed, uint32_t cpu_hz, uint32_t frame_hz);
+
+// sets the keys like setKeys, logging the change when recording (ignored while a movie is playing)
+// returns false if there was no memory to log the change (the keys are set all the same)
+bool recordKeys(MOVIE* movie, CHIP8* chip8, uint16_t keys);
+
+// runs one frame of cycle slots (applying the recorded key changes when playing), the caller ticks the timers
+uint8_t runMovieFrame(MOVIE* movie, CHIP8* chip8);
+
+bool saveMovie(MOVIE* movie, const char* file_path);
+
+// returns NULL if the file can't be read or isn't a valid movie
+MOVIE* loadMovie(const char* file_path);
+
+// quirk profile the movie was recorded with (load the ROM under it, so XO-CHIP ROMs get their 64 KB)
+const char* getMovieQuirks(MOVIE* movie);
+
+// sets the recorded quirk profile and seed and starts playing
+// returns false if the machine wasn't loaded with the ROM the movie was recorded with (or has no memory for the profile)
+bool startPlayback(MOVIE* movie, CHIP8* chip8);
+
+// true until every recorded frame has been played
+bool moviePlaying(MOVIE* movie);
+uint32_t getMovieFrames(MOVIE* movie);
+
+void freeMovie(MOVIE* movie);
+
+#endif
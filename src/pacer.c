@@ -0,0 +1,65 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pacer.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <SDL2/SDL.h>
+
+struct pacer_ {
+    // in performance counter ticks
+    uint64_t period;
+    uint64_t deadline;
+    uint64_t frequency;
+
+    // frames run back to back after a stall before the schedule gives up and restarts from now
+    int max_catch_up;
+    uint64_t dropped;
+};
+
+PACER* createPacer(double hz, int max_catch_up) {
+    PACER* pacer = (PACER*) malloc(sizeof(PACER));
+    if (pacer == NULL) return NULL;
+
+    pacer->frequency = SDL_GetPerformanceFrequency();
+    pacer->period = pacer->frequency / hz;
+    pacer->deadline = SDL_GetPerformanceCounter() + pacer->period;
+    pacer->max_catch_up = max_catch_up > 0 ? max_catch_up : 1;
+    pacer->dropped = 0;
+
+    return pacer;
+}
+
+// sleeps until the next frame deadline and returns how many frames are due (1 when on time)
+// after a stall at most max_catch_up frames are due, the rest are dropped so the loop can't spiral
+int waitFrames(PACER* pacer) {
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    if (now < pacer->deadline) {
+        uint64_t ns = (pacer->deadline - now) * 1000000000.0 / pacer->frequency;
+        struct timespec rest = {ns / 1000000000, ns % 1000000000};
+        // relative sleep: an early wake-up (signal) just runs the frame a bit early
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &rest, NULL);
+        now = SDL_GetPerformanceCounter();
+    }
+
+    uint64_t due = now >= pacer->deadline ? 1 + (now - pacer->deadline) / pacer->period : 1;
+    if (due > (uint64_t) pacer->max_catch_up) {
+        pacer->dropped += due - pacer->max_catch_up;
+        due = pacer->max_catch_up;
+        pacer->deadline = now + pacer->period;
+    } else {
+        pacer->deadline += due * pacer->period;
+    }
+
+    return due;
+}
+
+// frames skipped because the host fell more than max_catch_up frames behind
+uint64_t getDroppedFrames(PACER* pacer) {
+    return pacer->dropped;
+}
+
+void freePacer(PACER* pacer) {
+    free(pacer);
+}
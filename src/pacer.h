@@ -0,0 +1,15 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+
+// fixed-rate frame scheduler: sleeps until each frame deadline instead of polling the clock
+typedef struct pacer_ PACER;
+
+PACER* createPacer(double hz, int max_catch_up);
+int waitFrames(PACER* pacer);
+uint64_t getDroppedFrames(PACER* pacer);
+
+void freePacer(PACER* pacer);
+
+#endif
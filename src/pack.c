@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "romlib.h"
+
+/*
+ chip8-pack: packs a ROM directory (with its library.txt metadata) into a single archive
+ that chip8-batch -L maps in one go
+*/
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <rom directory or archive> <archive>\n", argv[0]);
+        return 1;
+    }
+
+    ROM_LIBRARY* library = openRomLibrary(argv[1]);
+    if (library == NULL) {
+        fprintf(stderr, "ERROR: %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    if (!writeRomArchive(library, argv[2])) {
+        fprintf(stderr, "ERROR: couldn't write %s\n", argv[2]);
+        closeRomLibrary(library);
+        return 1;
+    }
+
+    fprintf(stderr, "%d ROMs packed into %s\n", getLibrarySize(library), argv[2]);
+    closeRomLibrary(library);
+    return 0;
+}
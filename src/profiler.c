@@ -0,0 +1,191 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "profiler.h"
+#include "chip8_internal.h"
+
+struct profiler_ {
+    // executed instructions by kind and by address
+    uint64_t kinds[OP_COUNT];
+    uint64_t hits[MAX_MEMORY_SIZE];
+    uint64_t instructions;
+    double run_time;
+
+    // DXYN / DXY0
+    uint64_t draws;
+    double draw_time;
+
+    // FX0A: from the wait starting to the first run after the key is released
+    uint64_t key_waits;
+    double key_wait_time;
+    double wait_start; // 0 when not waiting
+
+    // frames presented by the frontend
+    uint64_t frames;
+    double render_time;
+};
+
+static const char* kind_names[OP_COUNT] = {
+    [OP_NOP] = "NOP", [OP_HALT] = "0000",
+    [OP_00E0] = "00E0", [OP_00EE] = "00EE", [OP_1NNN] = "1NNN", [OP_2NNN] = "2NNN", [OP_3XNN] = "3XNN",
+    [OP_4XNN] = "4XNN", [OP_5XY0] = "5XY0", [OP_6XNN] = "6XNN", [OP_7XNN] = "7XNN",
+    [OP_8XY0] = "8XY0", [OP_8XY1] = "8XY1", [OP_8XY2] = "8XY2", [OP_8XY3] = "8XY3", [OP_8XY4] = "8XY4",
+    [OP_8XY5] = "8XY5", [OP_8XY6] = "8XY6", [OP_8XY7] = "8XY7", [OP_8XYE] = "8XYE",
+    [OP_9XY0] = "9XY0", [OP_ANNN] = "ANNN", [OP_BNNN] = "BNNN", [OP_CXNN] = "CXNN", [OP_DXYN] = "DXYN",
+    [OP_EX9E] = "EX9E", [OP_EXA1] = "EXA1",
+    [OP_FX07] = "FX07", [OP_FX0A] = "FX0A", [OP_FX15] = "FX15", [OP_FX18] = "FX18", [OP_FX1E] = "FX1E",
+    [OP_FX29] = "FX29", [OP_FX33] = "FX33", [OP_FX55] = "FX55", [OP_FX65] = "FX65",
+    [OP_00CN] = "00CN", [OP_00FB] = "00FB", [OP_00FC] = "00FC", [OP_00FD] = "00FD", [OP_00FE] = "00FE",
+    [OP_00FF] = "00FF", [OP_DXY0] = "DXY0", [OP_FX30] = "FX30", [OP_FX75] = "FX75", [OP_FX85] = "FX85",
+    [OP_00DN] = "00DN", [OP_5XY2] = "5XY2", [OP_5XY3] = "5XY3", [OP_F000] = "F000", [OP_FN01] = "FN01",
+    [OP_F002] = "F002", [OP_FX3A] = "FX3A"
+};
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+bool enableProfiler(CHIP8* chip8) {
+    if (chip8->profiler != NULL) return true;
+
+    chip8->profiler = (PROFILER*) calloc(1, sizeof(PROFILER));
+    return chip8->profiler != NULL;
+}
+
+void freeProfiler(PROFILER* profiler) {
+    free(profiler);
+}
+
+// runCycles while profiling: every instruction is interpreted and counted (no recompiler, no idle loop skipping,
+// so the counts are the program's own instruction mix)
+uint8_t runProfiled(CHIP8* chip8, uint32_t n, uint8_t stop_on) {
+    PROFILER* p = chip8->profiler;
+    double start = now();
+
+    // the key of the last FX0A has been released since the previous run
+    if (p->wait_start > 0) {
+        p->key_wait_time += start - p->wait_start;
+        p->wait_start = 0;
+    }
+
+    stop_on |= EVENT_KEY_WAIT | EVENT_HALT;
+    while (n > 0) {
+        uint16_t pc = chip8->pc & chip8->memory_mask;
+        uint16_t inst = (chip8->memory[pc] << 8)|(chip8->memory[(pc+1) & chip8->memory_mask]);
+        DECODED scratch;
+        INSTRUCTION kind = decodeInstruction(chip8->profile, inst, &scratch);
+
+        p->kinds[kind]++;
+        p->hits[pc]++;
+        p->instructions++;
+
+        if (kind == OP_DXYN || kind == OP_DXY0) {
+            double draw_start = now();
+            executeInstruction(chip8);
+            p->draw_time += now() - draw_start;
+            p->draws++;
+        } else {
+            executeInstruction(chip8);
+        }
+        n--;
+
+        if (kind == OP_FX0A && chip8->waiting_key) {
+            p->key_waits++;
+            p->wait_start = now();
+        }
+        if (chip8->events & stop_on) break;
+    }
+
+    p->run_time += now() - start;
+    return chip8->events & ~EVENT_LOOP;
+}
+
+void profileRender(CHIP8* chip8, double seconds) {
+    if (chip8->profiler == NULL) return;
+
+    chip8->profiler->frames++;
+    chip8->profiler->render_time += seconds;
+}
+
+/*
+    REPORT
+*/
+
+static const uint64_t* sort_hits; // qsort has no context argument
+
+static int compareHits(const void* a, const void* b) {
+    uint64_t ha = sort_hits[*(const uint16_t*) a];
+    uint64_t hb = sort_hits[*(const uint16_t*) b];
+    return ha < hb ? 1 : (ha > hb ? -1 : 0);
+}
+
+static double percent(uint64_t count, uint64_t total) {
+    return total > 0 ? 100.0 * count / total : 0.0;
+}
+
+bool getProfileSummary(CHIP8* chip8, PROFILE_SUMMARY* summary) {
+    PROFILER* p = chip8->profiler;
+    if (p == NULL) return false;
+
+    summary->instructions = p->instructions;
+    summary->draws = p->draws;
+    summary->key_waits = p->key_waits;
+    summary->frames = p->frames;
+    summary->run_time = p->run_time;
+    summary->draw_time = p->draw_time;
+    summary->key_wait_time = p->key_wait_time;
+    summary->render_time = p->render_time;
+    return true;
+}
+
+void printProfile(CHIP8* chip8, FILE* out, int hot_addresses) {
+    PROFILER* p = chip8->profiler;
+    if (p == NULL) return;
+
+    fprintf(out, "profile: %llu instructions in %.3f s (%.2f M/s)\n", (unsigned long long) p->instructions,
+            p->run_time, p->run_time > 0 ? p->instructions / p->run_time / 1e6 : 0.0);
+
+    fprintf(out, "\ninstruction mix:\n");
+    for(int k = 0; k < OP_COUNT; k++) {
+        if (p->kinds[k] == 0) continue;
+        fprintf(out, "  %-5s %12llu  %6.2f%%\n", kind_names[k], (unsigned long long) p->kinds[k],
+                percent(p->kinds[k], p->instructions));
+    }
+
+    fprintf(out, "\nsprites (DXYN): %llu draws, %.3f ms", (unsigned long long) p->draws, p->draw_time * 1e3);
+    if (p->draws > 0) fprintf(out, " (%.1f ns each)", p->draw_time / p->draws * 1e9);
+    fprintf(out, "\nkey waits (FX0A): %llu waits, %.3f s\n", (unsigned long long) p->key_waits, p->key_wait_time);
+    fprintf(out, "rendering: %llu frames, %.3f ms", (unsigned long long) p->frames, p->render_time * 1e3);
+    if (p->frames > 0) fprintf(out, " (%.3f ms each)", p->render_time / p->frames * 1e3);
+    fprintf(out, "\n");
+
+    // hottest addresses of memory, with the instruction there now
+    uint32_t size = chip8->memory_mask + 1;
+    uint16_t* order = (uint16_t*) malloc(size * sizeof(uint16_t));
+    if (order == NULL) return;
+
+    int used = 0;
+    for(uint32_t a = 0; a < size; a++) {
+        if (p->hits[a] > 0) order[used++] = a;
+    }
+    sort_hits = p->hits;
+    qsort(order, used, sizeof(uint16_t), compareHits);
+
+    fprintf(out, "\nhot addresses:\n");
+    for(int i = 0; i < used && i < hot_addresses; i++) {
+        uint16_t a = order[i];
+        uint16_t inst = (chip8->memory[a] << 8)|(chip8->memory[(a+1) & chip8->memory_mask]);
+        DECODED scratch;
+        INSTRUCTION kind = decodeInstruction(chip8->profile, inst, &scratch);
+
+        fprintf(out, "  %04X  %04X %-5s %12llu  %6.2f%%\n", a, inst, kind_names[kind],
+                (unsigned long long) p->hits[a], percent(p->hits[a], p->instructions));
+    }
+
+    free(order);
+}
@@ -0,0 +1,28 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "chip8.h"
+
+// totals of a profile, for tools that report them their own way
+typedef struct profile_summary_ {
+    uint64_t instructions, draws, key_waits, frames;
+    double run_time, draw_time, key_wait_time, render_time; // seconds
+} PROFILE_SUMMARY;
+
+// optional instruction-level profiler: while enabled, runCycles runs a separate counting loop
+// (when disabled the interpreter pays a single pointer check per run)
+bool enableProfiler(CHIP8* chip8);
+
+// presentation time measured by the frontend, reported with the rest
+void profileRender(CHIP8* chip8, double seconds);
+
+// returns false if the profiler isn't enabled
+bool getProfileSummary(CHIP8* chip8, PROFILE_SUMMARY* summary);
+
+// report: instruction mix, draw / key wait / render time and the hot_addresses most executed addresses
+void printProfile(CHIP8* chip8, FILE* out, int hot_addresses);
+
+#endif
@@ -0,0 +1,202 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+#include "chip8_internal.h"
+
+/*
+ the ring holds one record per frame, newest at head:
+   u32 length, delta (length bytes), u32 length
+ a delta is XOR(older snapshot, newer snapshot) as runs of "varint zero bytes to skip, varint length, bytes",
+ so going back one frame is XORing the newest delta into the latest snapshot
+*/
+
+#define RECORD_OVERHEAD 8
+
+struct rewind_ {
+    uint8_t* ring;
+    size_t capacity, head, tail, used;
+    int frames;
+
+    // latest recorded state and the one being recorded (both zeroed on allocation, so padding never differs)
+    SNAPSHOT* current;
+    SNAPSHOT* next;
+    bool has_current;
+
+    // encoded delta (worst case: every other byte differs)
+    uint8_t* scratch;
+};
+
+REWIND* createRewind(size_t capacity) {
+    REWIND* rewind = (REWIND*) calloc(1, sizeof(REWIND));
+    if (rewind == NULL) return NULL;
+
+    rewind->capacity = capacity;
+    rewind->ring = (uint8_t*) malloc(capacity);
+    rewind->current = createSnapshot();
+    rewind->next = createSnapshot();
+    rewind->scratch = (uint8_t*) malloc(2*sizeof(SNAPSHOT) + 16);
+
+    if (rewind->ring == NULL || rewind->current == NULL || rewind->next == NULL || rewind->scratch == NULL) {
+        freeRewind(rewind);
+        return NULL;
+    }
+
+    return rewind;
+}
+
+static void ringWrite(REWIND* rewind, size_t pos, const void* data, size_t len) {
+    size_t first = rewind->capacity - pos;
+    if (first > len) first = len;
+
+    memcpy(&rewind->ring[pos], data, first);
+    memcpy(rewind->ring, (const uint8_t*) data + first, len - first);
+}
+
+static void ringRead(REWIND* rewind, size_t pos, void* data, size_t len) {
+    size_t first = rewind->capacity - pos;
+    if (first > len) first = len;
+
+    memcpy(data, &rewind->ring[pos], first);
+    memcpy((uint8_t*) data + first, rewind->ring, len - first);
+}
+
+static uint8_t* putVarint(uint8_t* p, uint32_t value) {
+    while (value >= 0x80) {
+        *p++ = value | 0x80;
+        value >>= 7;
+    }
+    *p++ = value;
+    return p;
+}
+
+static const uint8_t* getVarint(const uint8_t* p, uint32_t* value) {
+    int shift = 0;
+    *value = 0;
+    while (*p & 0x80) {
+        *value |= (uint32_t) (*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *value |= (uint32_t) *p++ << shift;
+    return p;
+}
+
+// encodes a XOR b into out and returns the length
+static size_t encodeDelta(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t size) {
+    uint8_t* p = out;
+    size_t i = 0;
+
+    while (i < size) {
+        size_t start = i;
+        while (i < size && a[i] == b[i]) i++;
+        if (i == size) break;
+
+        size_t skip = i - start;
+        start = i;
+        while (i < size && a[i] != b[i]) i++;
+
+        p = putVarint(p, skip);
+        p = putVarint(p, i - start);
+        for(size_t j = start; j < i; j++) *p++ = a[j] ^ b[j];
+    }
+
+    return p - out;
+}
+
+static void applyDelta(uint8_t* target, const uint8_t* delta, size_t len) {
+    const uint8_t* p = delta;
+    const uint8_t* end = delta + len;
+    size_t pos = 0;
+
+    while (p < end) {
+        uint32_t skip, count;
+        p = getVarint(p, &skip);
+        p = getVarint(p, &count);
+
+        pos += skip;
+        for(uint32_t j = 0; j < count; j++) target[pos++] ^= *p++;
+    }
+}
+
+// drops the oldest frame
+static void dropOldest(REWIND* rewind) {
+    uint32_t len;
+    ringRead(rewind, rewind->tail, &len, sizeof(len));
+
+    rewind->tail = (rewind->tail + len + RECORD_OVERHEAD) % rewind->capacity;
+    rewind->used -= len + RECORD_OVERHEAD;
+    rewind->frames--;
+}
+
+// called once per displayed frame
+void recordFrame(REWIND* rewind, CHIP8* chip8) {
+    takeSnapshot(chip8, rewind->next);
+
+    if (rewind->has_current) {
+        // only the memory of the profiles in use is compared (4kb unless XO-CHIP)
+        size_t size = snapshotSize(rewind->current);
+        if (snapshotSize(rewind->next) > size) size = snapshotSize(rewind->next);
+
+        uint32_t len = encodeDelta(rewind->scratch, (const uint8_t*) rewind->current, (const uint8_t*) rewind->next, size);
+
+        if (len + RECORD_OVERHEAD > rewind->capacity) {
+            clearRewind(rewind);
+        } else {
+            while (rewind->capacity - rewind->used < len + RECORD_OVERHEAD) dropOldest(rewind);
+
+            ringWrite(rewind, rewind->head, &len, sizeof(len));
+            ringWrite(rewind, (rewind->head + 4) % rewind->capacity, rewind->scratch, len);
+            ringWrite(rewind, (rewind->head + 4 + len) % rewind->capacity, &len, sizeof(len));
+
+            rewind->head = (rewind->head + len + RECORD_OVERHEAD) % rewind->capacity;
+            rewind->used += len + RECORD_OVERHEAD;
+            rewind->frames++;
+        }
+    }
+
+    SNAPSHOT* swap = rewind->current;
+    rewind->current = rewind->next;
+    rewind->next = swap;
+    rewind->has_current = true;
+}
+
+// restores the frame before the latest recorded one (returns false when the history is empty)
+bool rewindFrame(REWIND* rewind, CHIP8* chip8) {
+    if (rewind->frames == 0) return false;
+
+    uint32_t len;
+    ringRead(rewind, (rewind->head + rewind->capacity - 4) % rewind->capacity, &len, sizeof(len));
+
+    size_t start = (rewind->head + rewind->capacity - len - RECORD_OVERHEAD) % rewind->capacity;
+    ringRead(rewind, (start + 4) % rewind->capacity, rewind->scratch, len);
+    applyDelta((uint8_t*) rewind->current, rewind->scratch, len);
+
+    rewind->head = start;
+    rewind->used -= len + RECORD_OVERHEAD;
+    rewind->frames--;
+
+    return restoreSnapshot(chip8, rewind->current);
+}
+
+void clearRewind(REWIND* rewind) {
+    rewind->head = rewind->tail = rewind->used = 0;
+    rewind->frames = 0;
+    rewind->has_current = false;
+}
+
+int getRewindFrames(REWIND* rewind) {
+    return rewind->frames;
+}
+
+size_t getRewindUsage(REWIND* rewind) {
+    return rewind->used;
+}
+
+void freeRewind(REWIND* rewind) {
+    free(rewind->ring);
+    freeSnapshot(rewind->current);
+    freeSnapshot(rewind->next);
+    free(rewind->scratch);
+    free(rewind);
+}
@@ -0,0 +1,21 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "chip8.h"
+
+typedef struct rewind_ REWIND;
+
+// history of machine states in a fixed-size ring (each frame is stored as an XOR delta to the next one)
+REWIND* createRewind(size_t capacity);
+void recordFrame(REWIND* rewind, CHIP8* chip8);
+bool rewindFrame(REWIND* rewind, CHIP8* chip8); // false if there is no frame left (or no memory to restore it)
+void clearRewind(REWIND* rewind);
+int getRewindFrames(REWIND* rewind);
+size_t getRewindUsage(REWIND* rewind);
+void freeRewind(REWIND* rewind);
+
+#endif
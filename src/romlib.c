@@ -0,0 +1,432 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "romlib.h"
+
+/*
+ archive format (version 1, little-endian):
+   "C8PK" magic, u16 version, u32 entry count
+   entries: u32 offset, u32 size, u64 hash, u32 cpu hz, u8 quirk profile (index, 0xff if none), u8 name length, name
+   contents at their offsets (from the start of the file)
+*/
+
+#define ARCHIVE_MAGIC "C8PK"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_SIZE (4 + 2 + 4)
+#define ARCHIVE_ENTRY_SIZE (4 + 4 + 8 + 4 + 1 + 1) // without the name
+#define NO_PROFILE 0xff
+
+#define METADATA_FILE "library.txt"
+
+struct rom_library_ {
+    ROM_ENTRY* entries;
+    int count;
+
+    // open addressing on the content hash: entry index + 1 (0 is empty)
+    int* index;
+    uint32_t index_mask;
+
+    // mappings: one for an archive, one per file for a directory
+    void** maps;
+    size_t* map_sizes;
+    int map_count;
+};
+
+/*
+    XXH64
+*/
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t value = 0;
+    for(int i = 0; i < 8; i++) value |= (uint64_t) p[i] << (8*i);
+    return value;
+}
+
+static inline uint32_t read32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t xxhRound(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    return rotl64(acc, 31) * PRIME64_1;
+}
+
+static inline uint64_t xxhMerge(uint64_t acc, uint64_t value) {
+    acc ^= xxhRound(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t hashRomData(const uint8_t* data, size_t size) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        uint64_t v1 = PRIME64_1 + PRIME64_2, v2 = PRIME64_2, v3 = 0, v4 = -PRIME64_1;
+        do {
+            v1 = xxhRound(v1, read64(p));
+            v2 = xxhRound(v2, read64(p + 8));
+            v3 = xxhRound(v3, read64(p + 16));
+            v4 = xxhRound(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = xxhMerge(hash, v1);
+        hash = xxhMerge(hash, v2);
+        hash = xxhMerge(hash, v3);
+        hash = xxhMerge(hash, v4);
+    } else {
+        hash = PRIME64_5;
+    }
+    hash += size;
+
+    for(; end - p >= 8; p += 8) hash = rotl64(hash ^ xxhRound(0, read64(p)), 27) * PRIME64_1 + PRIME64_4;
+    if (end - p >= 4) {
+        hash = rotl64(hash ^ (read32(p) * PRIME64_1), 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for(; p < end; p++) hash = rotl64(hash ^ (*p * PRIME64_5), 11) * PRIME64_1;
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/*
+    LIBRARY
+*/
+
+static int profileIndex(const char* name) {
+    for(int i = 0; getQuirkProfileName(i) != NULL; i++) {
+        if (strcmp(getQuirkProfileName(i), name) == 0) return i;
+    }
+    return -1;
+}
+
+static ROM_LIBRARY* allocateLibrary(int count, int map_count) {
+    ROM_LIBRARY* library = (ROM_LIBRARY*) calloc(1, sizeof(ROM_LIBRARY));
+    if (library == NULL) return NULL;
+
+    library->entries = (ROM_ENTRY*) calloc(count > 0 ? count : 1, sizeof(ROM_ENTRY));
+    library->maps = (void**) calloc(map_count > 0 ? map_count : 1, sizeof(void*));
+    library->map_sizes = (size_t*) calloc(map_count > 0 ? map_count : 1, sizeof(size_t));
+    if (library->entries == NULL || library->maps == NULL || library->map_sizes == NULL) {
+        closeRomLibrary(library);
+        return NULL;
+    }
+    return library;
+}
+
+// maps a whole file read-only (NULL with errno set on failure, or for an empty file)
+static void* mapFile(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void* map = NULL;
+    if (fstat(fd, &st) == 0) {
+        if (st.st_size == 0) errno = EINVAL;
+        else map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) map = NULL;
+        *size = st.st_size;
+    }
+
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return map;
+}
+
+static bool buildIndex(ROM_LIBRARY* library) {
+    uint32_t size = 16;
+    while (size < 2 * (uint32_t) library->count) size *= 2;
+
+    library->index = (int*) calloc(size, sizeof(int));
+    if (library->index == NULL) return false;
+    library->index_mask = size - 1;
+
+    // identical contents keep the first entry
+    for(int i = 0; i < library->count; i++) {
+        uint32_t slot = library->entries[i].hash & library->index_mask;
+        while (library->index[slot] != 0 && library->entries[library->index[slot] - 1].hash != library->entries[i].hash)
+            slot = (slot + 1) & library->index_mask;
+        if (library->index[slot] == 0) library->index[slot] = i + 1;
+    }
+    return true;
+}
+
+static int compareEntries(const void* a, const void* b) {
+    return strcmp(((const ROM_ENTRY*) a)->name, ((const ROM_ENTRY*) b)->name);
+}
+
+// applies the lines of a directory's metadata file to its entries (already sorted by name)
+static void readMetadata(ROM_LIBRARY* library, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) return;
+
+    char line[512];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line_number++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+
+        char name[256], quirks[32];
+        unsigned long cpu_hz = 0;
+        int fields = sscanf(line, "%255s %31s %lu", name, quirks, &cpu_hz);
+        if (fields <= 0) continue;
+
+        ROM_ENTRY key = { name };
+        ROM_ENTRY* entry = (ROM_ENTRY*) bsearch(&key, library->entries, library->count, sizeof(ROM_ENTRY), compareEntries);
+        int profile = fields >= 2 && strcmp(quirks, "-") != 0 ? profileIndex(quirks) : -1;
+        if (entry == NULL || fields < 2 || (profile < 0 && strcmp(quirks, "-") != 0)) {
+            fprintf(stderr, "WARNING: %s:%d: expected \"<file> <quirks or -> [cpu hz]\" for a file of the library\n", path, line_number);
+            continue;
+        }
+
+        entry->quirks = profile >= 0 ? getQuirkProfileName(profile) : NULL;
+        entry->cpu_hz = cpu_hz;
+    }
+
+    fclose(f);
+}
+
+static ROM_LIBRARY* openDirectory(const char* path, DIR* dir) {
+    // first pass counts the candidates
+    int capacity = 0;
+    struct dirent* d;
+    while ((d = readdir(dir)) != NULL) capacity++;
+    rewinddir(dir);
+
+    ROM_LIBRARY* library = allocateLibrary(capacity, capacity);
+    if (library == NULL) {
+        closedir(dir);
+        return NULL;
+    }
+
+    char file_path[4096];
+    while ((d = readdir(dir)) != NULL && library->count < capacity) {
+        if (d->d_name[0] == '.' || strcmp(d->d_name, METADATA_FILE) == 0) continue;
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, d->d_name);
+
+        struct stat st;
+        if (stat(file_path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) continue;
+
+        size_t size;
+        void* map = mapFile(file_path, &size);
+        char* name = strdup(d->d_name);
+        if (map == NULL || name == NULL) {
+            if (map != NULL) munmap(map, size);
+            free(name);
+            closedir(dir);
+            closeRomLibrary(library);
+            return NULL;
+        }
+
+        library->maps[library->map_count] = map;
+        library->map_sizes[library->map_count++] = size;
+
+        ROM_ENTRY* entry = &library->entries[library->count++];
+        entry->name = name;
+        entry->data = (const uint8_t*) map;
+        entry->size = size;
+        entry->hash = hashRomData(entry->data, size);
+    }
+    closedir(dir);
+
+    qsort(library->entries, library->count, sizeof(ROM_ENTRY), compareEntries);
+    snprintf(file_path, sizeof(file_path), "%s/%s", path, METADATA_FILE);
+    readMetadata(library, file_path);
+
+    if (!buildIndex(library)) {
+        closeRomLibrary(library);
+        return NULL;
+    }
+    return library;
+}
+
+static ROM_LIBRARY* openArchive(const char* path) {
+    size_t size;
+    void* map = mapFile(path, &size);
+    if (map == NULL) return NULL;
+
+    const uint8_t* base = (const uint8_t*) map;
+    uint32_t count = size >= ARCHIVE_HEADER_SIZE ? read32(base + 6) : 0;
+    bool valid = size >= ARCHIVE_HEADER_SIZE && memcmp(base, ARCHIVE_MAGIC, 4) == 0 &&
+        (base[4] | (base[5] << 8)) == ARCHIVE_VERSION && count <= (size - ARCHIVE_HEADER_SIZE) / ARCHIVE_ENTRY_SIZE;
+
+    ROM_LIBRARY* library = valid ? allocateLibrary(count, 1) : NULL;
+    if (library == NULL) {
+        munmap(map, size);
+        errno = valid ? ENOMEM : EINVAL;
+        return NULL;
+    }
+    library->maps[0] = map;
+    library->map_sizes[0] = size;
+    library->map_count = 1;
+
+    const uint8_t* p = base + ARCHIVE_HEADER_SIZE;
+    const uint8_t* end = base + size;
+    for(uint32_t i = 0; i < count && valid; i++) {
+        if (end - p < ARCHIVE_ENTRY_SIZE || end - p < ARCHIVE_ENTRY_SIZE + p[ARCHIVE_ENTRY_SIZE - 1]) {
+            valid = false;
+            break;
+        }
+
+        ROM_ENTRY* entry = &library->entries[library->count];
+        uint32_t offset = read32(p);
+        entry->size = read32(p + 4);
+        entry->hash = read64(p + 8);
+        entry->cpu_hz = read32(p + 16);
+        uint8_t profile = p[20];
+        uint8_t name_length = p[21];
+
+        char* name = (char*) malloc(name_length + 1);
+        if (name == NULL) {
+            valid = false;
+            break;
+        }
+        memcpy(name, p + ARCHIVE_ENTRY_SIZE, name_length);
+        name[name_length] = '\0';
+        entry->name = name;
+        library->count++;
+        p += ARCHIVE_ENTRY_SIZE + name_length;
+
+        valid = offset <= size && entry->size <= size - offset &&
+            (profile == NO_PROFILE || getQuirkProfileName(profile) != NULL);
+        if (!valid) break;
+        entry->data = base + offset;
+        entry->quirks = profile != NO_PROFILE ? getQuirkProfileName(profile) : NULL;
+    }
+
+    // the index is trusted only once the contents match it
+    for(int i = 0; i < library->count && valid; i++) {
+        const ROM_ENTRY* entry = &library->entries[i];
+        if (hashRomData(entry->data, entry->size) != entry->hash) valid = false;
+    }
+    if (valid) qsort(library->entries, library->count, sizeof(ROM_ENTRY), compareEntries);
+
+    if (!valid || !buildIndex(library)) {
+        closeRomLibrary(library);
+        errno = valid ? ENOMEM : EINVAL;
+        return NULL;
+    }
+    return library;
+}
+
+ROM_LIBRARY* openRomLibrary(const char* path) {
+    DIR* dir = opendir(path);
+    if (dir != NULL) return openDirectory(path, dir);
+    if (errno != ENOTDIR) return NULL;
+    return openArchive(path);
+}
+
+int getLibrarySize(ROM_LIBRARY* library) {
+    return library->count;
+}
+
+const ROM_ENTRY* getLibraryRom(ROM_LIBRARY* library, int i) {
+    return i >= 0 && i < library->count ? &library->entries[i] : NULL;
+}
+
+const ROM_ENTRY* findRomByHash(ROM_LIBRARY* library, uint64_t hash) {
+    uint32_t slot = hash & library->index_mask;
+    while (library->index[slot] != 0) {
+        const ROM_ENTRY* entry = &library->entries[library->index[slot] - 1];
+        if (entry->hash == hash) return entry;
+        slot = (slot + 1) & library->index_mask;
+    }
+    return NULL;
+}
+
+const ROM_ENTRY* findRomByName(ROM_LIBRARY* library, const char* name) {
+    ROM_ENTRY key = { name };
+    return (const ROM_ENTRY*) bsearch(&key, library->entries, library->count, sizeof(ROM_ENTRY), compareEntries);
+}
+
+bool loadLibraryRom(CHIP8* chip8, const ROM_ENTRY* rom) {
+    if (rom->quirks != NULL && !setQuirkProfile(chip8, rom->quirks)) return false;
+    return loadProgram(chip8, rom->data, rom->size);
+}
+
+bool writeRomArchive(ROM_LIBRARY* library, const char* file_path) {
+    FILE* f = fopen(file_path, "wb");
+    if (f == NULL) return false;
+
+    size_t table_size = 0;
+    for(int i = 0; i < library->count; i++) table_size += ARCHIVE_ENTRY_SIZE + strlen(library->entries[i].name);
+    uint8_t* table = (uint8_t*) malloc(ARCHIVE_HEADER_SIZE + table_size);
+    if (table == NULL) {
+        fclose(f);
+        return false;
+    }
+
+    uint8_t* p = table;
+    memcpy(p, ARCHIVE_MAGIC, 4);
+    p[4] = ARCHIVE_VERSION & 0xff;
+    p[5] = ARCHIVE_VERSION >> 8;
+    p += 6;
+    for(int i = 0; i < 4; i++) *p++ = library->count >> (8*i);
+
+    uint64_t offset = ARCHIVE_HEADER_SIZE + table_size;
+    bool ok = true;
+    for(int i = 0; i < library->count; i++) {
+        const ROM_ENTRY* entry = &library->entries[i];
+        size_t name_length = strlen(entry->name);
+        if (name_length > 255 || offset + entry->size > UINT32_MAX) ok = false;
+
+        uint32_t fields[4] = { (uint32_t) offset, entry->size, (uint32_t) entry->hash, (uint32_t) (entry->hash >> 32) };
+        for(int j = 0; j < 4; j++)
+            for(int k = 0; k < 4; k++) *p++ = fields[j] >> (8*k);
+        for(int k = 0; k < 4; k++) *p++ = entry->cpu_hz >> (8*k);
+        *p++ = entry->quirks != NULL ? profileIndex(entry->quirks) : NO_PROFILE;
+        *p++ = name_length;
+        memcpy(p, entry->name, name_length & 0xff);
+        p += name_length & 0xff;
+
+        offset += entry->size;
+    }
+
+    ok = ok && fwrite(table, 1, p - table, f) == (size_t) (p - table);
+    for(int i = 0; i < library->count && ok; i++)
+        ok = fwrite(library->entries[i].data, 1, library->entries[i].size, f) == library->entries[i].size;
+    if (fclose(f) != 0) ok = false;
+
+    free(table);
+    return ok;
+}
+
+void closeRomLibrary(ROM_LIBRARY* library) {
+    for(int i = 0; i < library->count; i++) free((char*) library->entries[i].name);
+    for(int i = 0; i < library->map_count; i++) munmap(library->maps[i], library->map_sizes[i]);
+
+    free(library->entries);
+    free(library->index);
+    free(library->maps);
+    free(library->map_sizes);
+    free(library);
+}
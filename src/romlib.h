@@ -0,0 +1,45 @@
+#ifndef ROMLIB_H
+#define ROMLIB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// read-only ROM library: a directory or a packed archive, mapped into memory once and indexed by content hash
+// (loading a ROM into an instance is then a single memcpy, without opening files)
+typedef struct rom_library_ ROM_LIBRARY;
+
+typedef struct rom_entry_ {
+    const char* name;
+    const uint8_t* data; // mapped contents
+    uint32_t size;
+    uint64_t hash; // hashRomData of the contents
+    const char* quirks; // recommended quirk profile (NULL if none)
+    uint32_t cpu_hz; // recommended speed (0 if none)
+} ROM_ENTRY;
+
+// a directory maps every file in it, with the metadata of its "library.txt" (lines "<file> <quirks or -> [cpu hz]")
+// returns NULL (with errno set) if the path can't be read or isn't a valid archive
+ROM_LIBRARY* openRomLibrary(const char* path);
+
+int getLibrarySize(ROM_LIBRARY* library);
+const ROM_ENTRY* getLibraryRom(ROM_LIBRARY* library, int i); // in name order
+
+// NULL if not in the library
+const ROM_ENTRY* findRomByHash(ROM_LIBRARY* library, uint64_t hash);
+const ROM_ENTRY* findRomByName(ROM_LIBRARY* library, const char* name);
+
+// XXH64 (seed 0)
+uint64_t hashRomData(const uint8_t* data, size_t size);
+
+// selects the recommended quirk profile (if any) and copies the ROM into memory
+bool loadLibraryRom(CHIP8* chip8, const ROM_ENTRY* rom);
+
+// packs the whole library (contents and metadata) into one archive file
+bool writeRomArchive(ROM_LIBRARY* library, const char* file_path);
+
+void closeRomLibrary(ROM_LIBRARY* library);
+
+#endif
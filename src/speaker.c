@@ -0,0 +1,86 @@
+#include "speaker.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <SDL2/SDL.h>
+
+#include "audio.h"
+
+#define SAMPLE_RATE 44100
+#define DEVICE_SAMPLES 512 // samples per callback
+#define LATENCY_SAMPLES 2048 // samples kept queued ahead of the device (about 46 ms)
+#define RING_SAMPLES 8192
+
+struct speaker_ {
+    SDL_AudioDeviceID device;
+    AUDIO_RING* ring;
+
+    // position in the audio pattern and render buffer (emulation thread only)
+    double phase;
+    int16_t buffer[LATENCY_SAMPLES];
+};
+
+// runs on SDL's audio thread: only reads from the ring, never waits for the emulation
+static void audioCallback(void* userdata, Uint8* stream, int len) {
+    SPEAKER* speaker = (SPEAKER*) userdata;
+    readAudio(speaker->ring, (int16_t*) stream, len / sizeof(int16_t));
+}
+
+// returns NULL (the interpreter runs silently) if there is no audio device
+SPEAKER* createSpeaker() {
+    SPEAKER* speaker = (SPEAKER*) calloc(1, sizeof(SPEAKER));
+    if (speaker == NULL) return NULL;
+
+    speaker->ring = createAudioRing(RING_SAMPLES);
+    if (speaker->ring == NULL || SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+        printf("Couldn't initialize audio: %s\n", SDL_GetError());
+        if (speaker->ring != NULL) freeAudioRing(speaker->ring);
+        free(speaker);
+        return NULL;
+    }
+
+    SDL_AudioSpec want, have;
+    SDL_zero(want);
+    want.freq = SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = DEVICE_SAMPLES;
+    want.callback = audioCallback;
+    want.userdata = speaker;
+
+    speaker->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (speaker->device == 0) {
+        printf("Couldn't open audio device: %s\n", SDL_GetError());
+        freeAudioRing(speaker->ring);
+        free(speaker);
+        return NULL;
+    }
+
+    // starts with the queue full of silence, so the first callbacks don't count as underruns
+    writeAudio(speaker->ring, speaker->buffer, LATENCY_SAMPLES);
+    SDL_PauseAudioDevice(speaker->device, 0);
+
+    return speaker;
+}
+
+// called from the emulation loop: tops the queue up to LATENCY_SAMPLES with the current tone
+// (the device clock decides how much is needed, so the loop never blocks on audio)
+void feedSpeaker(SPEAKER* speaker, CHIP8* chip8) {
+    uint32_t queued = getAudioQueued(speaker->ring);
+    if (queued >= LATENCY_SAMPLES) return;
+
+    uint32_t n = LATENCY_SAMPLES - queued;
+    renderAudio(chip8, speaker->buffer, n, SAMPLE_RATE, &speaker->phase);
+    writeAudio(speaker->ring, speaker->buffer, n);
+}
+
+// callbacks that found the queue short (the emulation loop fell behind the device)
+uint64_t getSpeakerUnderruns(SPEAKER* speaker) {
+    return getAudioUnderruns(speaker->ring);
+}
+
+void freeSpeaker(SPEAKER* speaker) {
+    SDL_CloseAudioDevice(speaker->device);
+    freeAudioRing(speaker->ring);
+    free(speaker);
+}
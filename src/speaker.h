@@ -0,0 +1,17 @@
+#ifndef SPEAKER_H
+#define SPEAKER_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// SDL audio device that plays the interpreter's buzzer
+typedef struct speaker_ SPEAKER;
+
+SPEAKER* createSpeaker();
+void feedSpeaker(SPEAKER* speaker, CHIP8* chip8);
+uint64_t getSpeakerUnderruns(SPEAKER* speaker);
+
+void freeSpeaker(SPEAKER* speaker);
+
+#endif
@@ -0,0 +1,285 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_internal.h"
+
+/*
+ save state format (version 3, little-endian):
+   "C8ST" magic, u16 version, u8 quirk profile (index)
+   memory (the profile's memory size), u16 stack[STACK_SIZE]
+   u8 width, u8 height, u8 selected planes, u64 framebuffer rows[DISPLAY_PLANES][DISPLAY_HEIGHT][ROW_WORDS]
+   u16 pc, u16 idx, u8 sp, u8 delay timer, u8 sound timer, v[16], rpl[RPL_FLAGS]
+   audio pattern[AUDIO_PATTERN_SIZE], u8 pitch
+   u64 rng, u16 keys, u8 flags (waiting_key, needs_to_draw, ended), u8 key_register
+   u64 cycles
+*/
+
+#define STATE_MAGIC "C8ST"
+#define STATE_VERSION 3
+#define STATE_HEADER_SIZE (4 + 2 + 1)
+#define FRAMEBUFFER_WORDS (DISPLAY_PLANES*DISPLAY_HEIGHT*ROW_WORDS)
+#define STATE_FIXED_SIZE (STATE_HEADER_SIZE + 2*STACK_SIZE + 3 + 8*FRAMEBUFFER_WORDS + 2+2+1+1+1 + 16 + RPL_FLAGS + AUDIO_PATTERN_SIZE+1 + 8+2+1+1 + 8)
+
+// memory is compared in chunks on restore, so unchanged code keeps its decoded / compiled form
+#define RESTORE_CHUNK 64
+
+/*
+    SNAPSHOTS
+*/
+
+SNAPSHOT* createSnapshot() {
+    return (SNAPSHOT*) calloc(1, sizeof(SNAPSHOT));
+}
+
+void takeSnapshot(CHIP8* chip8, SNAPSHOT* snapshot) {
+    snapshot->profile = chip8->profile;
+    memcpy(snapshot->memory, chip8->memory, chip8->memory_mask + 1);
+    memcpy(snapshot->stack, chip8->stack, sizeof(snapshot->stack));
+    snapshot->framebuffer = chip8->framebuffer;
+    snapshot->planes = chip8->planes;
+    memcpy(snapshot->rpl, chip8->rpl, sizeof(snapshot->rpl));
+    memcpy(snapshot->audio_pattern, chip8->audio_pattern, sizeof(snapshot->audio_pattern));
+    snapshot->pitch = chip8->pitch;
+
+    snapshot->pc = chip8->pc;
+    snapshot->idx = chip8->idx;
+    snapshot->sp = chip8->sp;
+    snapshot->delay_timer = chip8->delay_timer;
+    snapshot->sound_timer = chip8->sound_timer;
+    memcpy(snapshot->v, chip8->v, sizeof(snapshot->v));
+    snapshot->rng = chip8->rng;
+
+    snapshot->keys = chip8->keys;
+    snapshot->waiting_key = chip8->waiting_key;
+    snapshot->needs_to_draw = chip8->needs_to_draw;
+    snapshot->ended = chip8->ended;
+    snapshot->key_register = chip8->key_register;
+
+    snapshot->cycles = chip8->cycles;
+}
+
+// only the bytes that differ are written and invalidated in the decode cache / recompiler
+static void restoreMemory(CHIP8* chip8, const uint8_t* memory) {
+    uint32_t size = chip8->memory_mask + 1;
+    if (memcmp(chip8->memory, memory, size) == 0) return;
+
+    for(uint32_t chunk = 0; chunk < size; chunk += RESTORE_CHUNK) {
+        if (memcmp(&chip8->memory[chunk], &memory[chunk], RESTORE_CHUNK) == 0) continue;
+
+        uint32_t i = chunk;
+        while (i < chunk + RESTORE_CHUNK) {
+            if (chip8->memory[i] == memory[i]) {
+                i++;
+                continue;
+            }
+
+            uint32_t start = i;
+            while (i < chunk + RESTORE_CHUNK && chip8->memory[i] != memory[i]) i++;
+
+            memcpy(&chip8->memory[start], &memory[start], i - start);
+            invalidateDecodeCache(chip8, start, i - start);
+        }
+    }
+}
+
+// returns false (leaving the machine as it was) if there is no memory for the snapshot's profile
+bool restoreSnapshot(CHIP8* chip8, const SNAPSHOT* snapshot) {
+    if (!applyProfile(chip8, snapshot->profile)) return false;
+
+    restoreMemory(chip8, snapshot->memory);
+    memcpy(chip8->stack, snapshot->stack, sizeof(chip8->stack));
+    chip8->framebuffer = snapshot->framebuffer;
+    chip8->planes = snapshot->planes;
+    memcpy(chip8->rpl, snapshot->rpl, sizeof(chip8->rpl));
+    memcpy(chip8->audio_pattern, snapshot->audio_pattern, sizeof(chip8->audio_pattern));
+    chip8->pitch = snapshot->pitch;
+
+    chip8->pc = snapshot->pc;
+    chip8->idx = snapshot->idx;
+    chip8->sp = snapshot->sp;
+    chip8->delay_timer = snapshot->delay_timer;
+    chip8->sound_timer = snapshot->sound_timer;
+    memcpy(chip8->v, snapshot->v, sizeof(chip8->v));
+    chip8->rng = snapshot->rng;
+
+    chip8->keys = snapshot->keys;
+    chip8->waiting_key = snapshot->waiting_key;
+    chip8->needs_to_draw = snapshot->needs_to_draw;
+    chip8->ended = snapshot->ended;
+    chip8->key_register = snapshot->key_register;
+
+    chip8->cycles = snapshot->cycles;
+    chip8->events = 0;
+    return true;
+}
+
+void freeSnapshot(SNAPSHOT* snapshot) {
+    free(snapshot);
+}
+
+/*
+    SAVE STATES
+*/
+
+static uint8_t* put16(uint8_t* p, uint16_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    return p + 2;
+}
+
+static uint8_t* put64(uint8_t* p, uint64_t value) {
+    for(int i = 0; i < 8; i++) p[i] = value >> (8*i);
+    return p + 8;
+}
+
+static const uint8_t* get16(const uint8_t* p, uint16_t* value) {
+    *value = p[0] | (p[1] << 8);
+    return p + 2;
+}
+
+static const uint8_t* get64(const uint8_t* p, uint64_t* value) {
+    *value = 0;
+    for(int i = 0; i < 8; i++) *value |= (uint64_t) p[i] << (8*i);
+    return p + 8;
+}
+
+static int profileIndex(const PROFILE* profile) {
+    int i = 0;
+    while (getProfile(i) != profile) i++;
+    return i;
+}
+
+size_t getStateSize(CHIP8* chip8) {
+    return STATE_FIXED_SIZE + chip8->memory_mask + 1;
+}
+
+void writeState(CHIP8* chip8, uint8_t* buffer) {
+    uint8_t* p = buffer;
+    memcpy(p, STATE_MAGIC, 4);
+    p = put16(p + 4, STATE_VERSION);
+    *p++ = profileIndex(chip8->profile);
+
+    memcpy(p, chip8->memory, chip8->memory_mask + 1);
+    p += chip8->memory_mask + 1;
+    for(int i = 0; i < STACK_SIZE; i++) p = put16(p, chip8->stack[i]);
+
+    const FRAMEBUFFER* fb = &chip8->framebuffer;
+    *p++ = fb->width;
+    *p++ = fb->height;
+    *p++ = chip8->planes;
+    const uint64_t* words = &fb->rows[0][0][0];
+    for(int i = 0; i < FRAMEBUFFER_WORDS; i++) p = put64(p, words[i]);
+
+    p = put16(p, chip8->pc);
+    p = put16(p, chip8->idx);
+    *p++ = chip8->sp;
+    *p++ = chip8->delay_timer;
+    *p++ = chip8->sound_timer;
+    memcpy(p, chip8->v, 16);
+    p += 16;
+    memcpy(p, chip8->rpl, RPL_FLAGS);
+    p += RPL_FLAGS;
+    memcpy(p, chip8->audio_pattern, AUDIO_PATTERN_SIZE);
+    p += AUDIO_PATTERN_SIZE;
+    *p++ = chip8->pitch;
+
+    p = put64(p, chip8->rng);
+    p = put16(p, chip8->keys);
+    *p++ = chip8->waiting_key | (chip8->needs_to_draw << 1) | (chip8->ended << 2);
+    *p++ = chip8->key_register;
+    put64(p, chip8->cycles);
+}
+
+// returns false (leaving the machine untouched) if the buffer isn't a valid state, or there is no memory for its profile
+bool readState(CHIP8* chip8, const uint8_t* buffer, size_t size) {
+    if (size < STATE_HEADER_SIZE || memcmp(buffer, STATE_MAGIC, 4) != 0) return false;
+
+    uint16_t version;
+    const uint8_t* p = get16(buffer + 4, &version);
+    if (version != STATE_VERSION) return false;
+
+    const PROFILE* profile = getProfile(*p++);
+    if (profile == NULL || size != STATE_FIXED_SIZE + profile->memory_size) return false;
+
+    SNAPSHOT* s = createSnapshot();
+    if (s == NULL) return false;
+
+    s->profile = profile;
+    memcpy(s->memory, p, profile->memory_size);
+    p += profile->memory_size;
+    for(int i = 0; i < STACK_SIZE; i++) p = get16(p, &s->stack[i]);
+
+    FRAMEBUFFER* fb = &s->framebuffer;
+    fb->width = *p++;
+    fb->height = *p++;
+    s->planes = *p++ & ((1 << DISPLAY_PLANES) - 1);
+    uint64_t* words = &fb->rows[0][0][0];
+    for(int i = 0; i < FRAMEBUFFER_WORDS; i++) p = get64(p, &words[i]);
+
+    p = get16(p, &s->pc);
+    p = get16(p, &s->idx);
+    s->sp = *p++;
+    s->delay_timer = *p++;
+    s->sound_timer = *p++;
+    memcpy(s->v, p, 16);
+    p += 16;
+    memcpy(s->rpl, p, RPL_FLAGS);
+    p += RPL_FLAGS;
+    memcpy(s->audio_pattern, p, AUDIO_PATTERN_SIZE);
+    p += AUDIO_PATTERN_SIZE;
+    s->pitch = *p++;
+
+    p = get64(p, &s->rng);
+    p = get16(p, &s->keys);
+    uint8_t flags = *p++;
+    s->waiting_key = flags & 1;
+    s->needs_to_draw = flags & 2;
+    s->ended = flags & 4;
+    s->key_register = *p++ & 0xf;
+    get64(p, &s->cycles);
+
+    // xorshift would get stuck at 0, and the framebuffer must be in one of the two resolutions
+    bool valid = s->rng != 0 &&
+        ((fb->width == LORES_WIDTH && fb->height == LORES_HEIGHT) || (fb->width == DISPLAY_WIDTH && fb->height == DISPLAY_HEIGHT));
+    if (valid) valid = restoreSnapshot(chip8, s);
+
+    freeSnapshot(s);
+    return valid;
+}
+
+bool saveState(CHIP8* chip8, const char* file_path) {
+    size_t size = getStateSize(chip8);
+    uint8_t* buffer = (uint8_t*) malloc(size);
+    if (buffer == NULL) return false;
+    writeState(chip8, buffer);
+
+    FILE* f = fopen(file_path, "wb");
+    bool ok = f != NULL && fwrite(buffer, 1, size, f) == size;
+    if (f != NULL && fclose(f) != 0) ok = false;
+
+    free(buffer);
+    return ok;
+}
+
+// returns false if the file can't be read or isn't a valid state
+bool loadState(CHIP8* chip8, const char* file_path) {
+    FILE* f = fopen(file_path, "rb");
+    if (f == NULL) return false;
+
+    // one extra byte detects files that are too long
+    size_t capacity = STATE_FIXED_SIZE + MAX_MEMORY_SIZE + 1;
+    uint8_t* buffer = (uint8_t*) malloc(capacity);
+    if (buffer == NULL) {
+        fclose(f);
+        return false;
+    }
+    size_t size = fread(buffer, 1, capacity, f);
+    fclose(f);
+
+    bool ok = readState(chip8, buffer, size);
+    free(buffer);
+    return ok;
+}
@@ -0,0 +1,119 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "threadpool.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ Every worker owns a deque with a contiguous range of task indexes. It takes
+ work from the front of its own deque and, once that is empty, steals from the
+ back of the other workers' deques, so long tasks never leave cores idle.
+*/
+
+typedef struct deque_ {
+    pthread_mutex_t lock;
+    int front, back; // tasks [front, back) are still pending
+} DEQUE;
+
+typedef struct pool_ {
+    DEQUE* deques;
+    int threads;
+    TASK task;
+    void* data;
+} POOL;
+
+typedef struct worker_ {
+    POOL* pool;
+    int id;
+} WORKER;
+
+// pops from the front (owner side), returns -1 if empty
+static int popFront(DEQUE* d) {
+    int index = -1;
+    pthread_mutex_lock(&d->lock);
+    if (d->front < d->back) index = d->front++;
+    pthread_mutex_unlock(&d->lock);
+    return index;
+}
+
+// steals from the back (thief side), returns -1 if empty
+static int popBack(DEQUE* d) {
+    int index = -1;
+    pthread_mutex_lock(&d->lock);
+    if (d->front < d->back) index = --d->back;
+    pthread_mutex_unlock(&d->lock);
+    return index;
+}
+
+static void* workerMain(void* arg) {
+    WORKER* worker = (WORKER*) arg;
+    POOL* pool = worker->pool;
+
+    while (true) {
+        int index = popFront(&pool->deques[worker->id]);
+
+        // nothing left locally: try every other worker once
+        for(int i = 1; index < 0 && i < pool->threads; i++) {
+            index = popBack(&pool->deques[(worker->id + i) % pool->threads]);
+        }
+
+        // tasks are never added, so all deques empty means we are done
+        if (index < 0) break;
+
+        pool->task(index, pool->data);
+    }
+
+    return NULL;
+}
+
+void runParallel(int threads, int count, TASK task, void* data) {
+    if (threads < 1) threads = 1;
+    if (threads > count) threads = count;
+    if (count <= 0) return;
+
+    POOL pool;
+    pool.threads = threads;
+    pool.task = task;
+    pool.data = data;
+    pool.deques = (DEQUE*) malloc(threads * sizeof(DEQUE));
+
+    WORKER* workers = (WORKER*) malloc(threads * sizeof(WORKER));
+    pthread_t* ids = (pthread_t*) malloc(threads * sizeof(pthread_t));
+    if (pool.deques == NULL || workers == NULL || ids == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+
+    // split the tasks in contiguous ranges
+    for(int i = 0; i < threads; i++) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].front = (long) count * i / threads;
+        pool.deques[i].back = (long) count * (i+1) / threads;
+        workers[i].pool = &pool;
+        workers[i].id = i;
+    }
+
+    // the calling thread is worker 0
+    for(int i = 1; i < threads; i++) {
+        if (pthread_create(&ids[i], NULL, workerMain, &workers[i]) != 0) {
+            fprintf(stderr, "ERROR: couldn't create thread\n");
+            exit(1);
+        }
+    }
+    workerMain(&workers[0]);
+    for(int i = 1; i < threads; i++) pthread_join(ids[i], NULL);
+
+    for(int i = 0; i < threads; i++) pthread_mutex_destroy(&pool.deques[i].lock);
+    free(pool.deques);
+    free(workers);
+    free(ids);
+}
+
+int getCpuCount() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
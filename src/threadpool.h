@@ -0,0 +1,10 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+// runs task(0) ... task(count-1) on a pool of threads with work stealing
+typedef void (*TASK)(int index, void* data);
+
+void runParallel(int threads, int count, TASK task, void* data);
+int getCpuCount();
+
+#endif
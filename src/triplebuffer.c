@@ -0,0 +1,58 @@
+#include <stdlib.h>
+
+#include "triplebuffer.h"
+
+// bit set in middle while it holds a frame the consumer hasn't taken yet
+#define FRESH 4
+
+/*
+ Three slots: the producer writes into back, the consumer reads front, and
+ middle holds the last published frame. Publishing swaps back and middle,
+ acquiring swaps front and middle, each with a single atomic exchange, so
+ neither side ever touches the slot the other one is using.
+*/
+
+struct triple_buffer_ {
+    FRAMEBUFFER slots[3];
+    int back;   // producer only
+    int middle; // shared: slot index | FRESH
+    int front;  // consumer only
+};
+
+TRIPLE_BUFFER* createTripleBuffer() {
+    TRIPLE_BUFFER* tb = (TRIPLE_BUFFER*) calloc(1, sizeof(TRIPLE_BUFFER));
+    if (tb == NULL) return NULL;
+
+    for(int i = 0; i < 3; i++) setResolution(&tb->slots[i], false);
+    tb->back = 0;
+    tb->middle = 1;
+    tb->front = 2;
+
+    return tb;
+}
+
+// producer: the frame being built (its contents are undefined after publishFrame)
+FRAMEBUFFER* getBackBuffer(TRIPLE_BUFFER* tb) {
+    return &tb->slots[tb->back];
+}
+
+// producer: makes the back buffer the newest frame
+void publishFrame(TRIPLE_BUFFER* tb) {
+    int old = __atomic_exchange_n(&tb->middle, tb->back | FRESH, __ATOMIC_ACQ_REL);
+    tb->back = old & ~FRESH;
+}
+
+// consumer: the newest published frame (fresh tells if it wasn't returned before)
+// the frame stays valid until the next call
+const FRAMEBUFFER* acquireFrame(TRIPLE_BUFFER* tb, bool* fresh) {
+    *fresh = __atomic_load_n(&tb->middle, __ATOMIC_ACQUIRE) & FRESH;
+    if (*fresh) {
+        int old = __atomic_exchange_n(&tb->middle, tb->front, __ATOMIC_ACQ_REL);
+        tb->front = old & ~FRESH;
+    }
+    return &tb->slots[tb->front];
+}
+
+void freeTripleBuffer(TRIPLE_BUFFER* tb) {
+    free(tb);
+}
@@ -0,0 +1,18 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <stdbool.h>
+
+#include "framebuffer.h"
+
+typedef struct triple_buffer_ TRIPLE_BUFFER;
+
+// hands complete frames from one producer thread to one consumer thread without locks
+// the producer never waits and the consumer always gets the newest published frame (older ones are dropped)
+TRIPLE_BUFFER* createTripleBuffer();
+FRAMEBUFFER* getBackBuffer(TRIPLE_BUFFER* tb);
+void publishFrame(TRIPLE_BUFFER* tb);
+const FRAMEBUFFER* acquireFrame(TRIPLE_BUFFER* tb, bool* fresh);
+void freeTripleBuffer(TRIPLE_BUFFER* tb);
+
+#endif